@@ -43,6 +43,8 @@
 #define MDCR_SPD32_DISABLED 0x8000
 #define MDCR_SPD32_ENABLED 0xc000
 
+#define PMCR_E 1
+#define PMCR_C 4
 #define PMCR_LC 0x40
 #define PMCR_LP 0x80
 
@@ -59,6 +61,7 @@
 #define SCR_FIQ 4
 #define SCR_EA 8
 #define SCR_EL3_RES1 0x30
+#define CPTR_EL2_RES1 0x33ff
 
 /* each region has size, granule, inner and outer cacheability and shareability attributes */
 #define TCR_TxSZ(x) ((x) & 0x3f)
@@ -1,12 +1,13 @@
 /* SPDX-License-Identifier: CC0-1.0 */
 #pragma once
 
-#define CTX_STATUS_OFF 0x8
+#define CTX_STATUS_OFF 0x10
 #define CTX_STATUS_PREEMPT_REQ_BIT 4
-#define CTX_SPSR_OFF 0xc
-#define CTX_PC_OFF 0x10
-#define CTX_VOLATILES_OFF 0x18
-#define CTX_NONVOLATILES_OFF 0xb0
+#define CTX_SPSR_OFF 0x14
+#define CTX_PC_OFF 0x18
+#define CTX_VOLATILES_OFF 0x20
+#define CTX_NONVOLATILES_OFF 0xb8
+#define CTX_SIMD_OFF 0x120
 
 #define THREAD_LOCKED 0
 #define THREAD_PREEMPTED 1
@@ -29,15 +30,20 @@ struct thread {
 		u64 gpr0[19];
 	};
 	u64 gpr19 [32 - 19];
+	/// q0 and q1, saved on every exception entry. C code is built with
+	/// -mgeneral-regs-only, so only leaf assembly routines (lzcommon_*_copy
+	/// and the string functions) may use SIMD registers, and only q0 and q1
+	u64 simd[4] __attribute__((aligned(16)));
 };
 CHECK_OFFSET(thread, status, CTX_STATUS_OFF);
 CHECK_OFFSET(thread, pc, CTX_PC_OFF);
 CHECK_OFFSET(thread, spsr, CTX_SPSR_OFF);
 CHECK_OFFSET(thread, gpr0, CTX_VOLATILES_OFF);
 CHECK_OFFSET(thread, gpr19, CTX_NONVOLATILES_OFF);
+CHECK_OFFSET(thread, simd, CTX_SIMD_OFF);
 
 #define THREAD_START_STATE(sp, fn, ...) (struct thread) {\
-	.runnable.next = 0, .status = THREAD_PREEMPTED, .spsr = 0xc,\
+	.runnable = {.next = 0, .priority = SCHED_PRIO_NORMAL}, .status = THREAD_PREEMPTED, .spsr = 0xc,\
 	.gpr0 = {__VA_ARGS__},\
 	.gpr19 = {[30 - 19] = (u64)aarch64_abandon_thread, [31 - 19] = (sp)},\
 	.pc = (u64)(fn)\
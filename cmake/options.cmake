@@ -25,6 +25,10 @@ else ()
     set(boot_media "")
 endif ()
 
+if (boot_arbitration)
+    message(STATUS "boot_arbitration: loading from all boot media concurrently")
+endif ()
+
 if (decompressors AND NOT boot_media)
     set_property(SOURCE dramstage/decompression.c PROPERTY COMPILE_DEFINITIONS CONFIG_DRAMSTAGE_MEMORY=1)
 endif ()
@@ -39,6 +43,11 @@ if (NOT CONFIG_BUF_SIZE)
 endif ()
 message(STATUS "CONFIG_BUF_SIZE=${CONFIG_BUF_SIZE}")
 
+if (NOT CONFIG_NVME_QUEUE_DEPTH)
+    set(CONFIG_NVME_QUEUE_DEPTH 4)
+endif ()
+message(STATUS "CONFIG_NVME_QUEUE_DEPTH=${CONFIG_NVME_QUEUE_DEPTH}")
+
 if (NOT CONFIG_GREETING)
     set(CONFIG_GREETING \"\\"levinboot/0.8\\r\\n\\"\")
 endif ()
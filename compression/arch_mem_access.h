@@ -31,3 +31,13 @@ static inline uint32_t ldle32a(const uint32_t *ptr) {
 #endif
 	return val;
 }
+
+/* unaligned load, only to be used if !CONFIG_NO_UNALIGNED. compiles to a single load where the target allows it */
+static inline uint64_t ldle64u(const uint8_t *ptr) {
+	uint64_t val;
+	__builtin_memcpy(&val, ptr, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	val = __builtin_bswap64(val);
+#endif
+	return val;
+}
@@ -0,0 +1,226 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include "checksum.h"
+#include <assert.h>
+#include <string.h>
+#include "arch_mem_access.h"
+
+#if __ARM_FEATURE_CRC32
+static inline u32 crc32_u64(u32 crc, u64 val) {
+	__asm__("crc32x %w0, %w0, %1" : "+r"(crc) : "r"(val));
+	return crc;
+}
+
+static inline u32 crc32_u8(u32 crc, u8 val) {
+	__asm__("crc32b %w0, %w0, %w1" : "+r"(crc) : "r"((u32)val));
+	return crc;
+}
+#else
+/* slicing-by-8: crc_tables[k][i] is the CRC of byte i followed by k zero bytes */
+static u32 crc_tables[8][256];
+static _Bool crc_tables_ready = 0;
+
+static void build_crc_tables() {
+	for_range(i, 0, 256) {
+		u32 crc = i;
+		for_range(bit, 0, 8) {crc = crc >> 1 ^ (crc & 1 ? 0xedb88320 : 0);}
+		crc_tables[0][i] = crc;
+	}
+	for_range(k, 1, 8) {
+		for_range(i, 0, 256) {
+			u32 prev = crc_tables[k - 1][i];
+			crc_tables[k][i] = prev >> 8 ^ crc_tables[0][(u8)prev];
+		}
+	}
+	crc_tables_ready = 1;
+}
+
+static inline u32 crc32_u64(u32 crc, u64 val) {
+	u32 lo = crc ^ (u32)val, hi = val >> 32;
+	return crc_tables[7][(u8)lo] ^ crc_tables[6][(u8)(lo >> 8)]
+		^ crc_tables[5][(u8)(lo >> 16)] ^ crc_tables[4][lo >> 24]
+		^ crc_tables[3][(u8)hi] ^ crc_tables[2][(u8)(hi >> 8)]
+		^ crc_tables[1][(u8)(hi >> 16)] ^ crc_tables[0][hi >> 24];
+}
+
+static inline u32 crc32_u8(u32 crc, u8 val) {
+	return crc >> 8 ^ crc_tables[0][(u8)crc ^ val];
+}
+#endif
+
+u32 crc32_update(u32 crc, const u8 *buf, size_t size) {
+#if !__ARM_FEATURE_CRC32
+	if (unlikely(!crc_tables_ready)) {build_crc_tables();}
+#endif
+	const u8 *end = buf + size;
+	while (buf < end && ((uintptr_t)buf & 7)) {crc = crc32_u8(crc, *buf++);}
+	/* aligned from here, so this is safe without CONFIG_NO_UNALIGNED too */
+	const u64 *ptr = (const u64 *)buf;
+	size_t words = (end - buf) / 8;
+	for (; words >= 4; words -= 4, ptr += 4) {
+		crc = crc32_u64(crc, ldle64a(ptr));
+		crc = crc32_u64(crc, ldle64a(ptr + 1));
+		crc = crc32_u64(crc, ldle64a(ptr + 2));
+		crc = crc32_u64(crc, ldle64a(ptr + 3));
+	}
+	for (; words; --words) {crc = crc32_u64(crc, ldle64a(ptr++));}
+	buf = (const u8 *)ptr;
+	while (buf < end) {crc = crc32_u8(crc, *buf++);}
+	return crc;
+}
+
+#define U64(x) x##ull
+static const u64 xxh64_primes[5] = {
+	U64(11400714785074694791),
+	U64(14029467366897019727),
+	U64(1609587929392839161),
+	U64(9650029242287828579),
+	U64(2870177450012600261)
+};
+
+static u64 xxh64_step(u64 state) {
+	return (state << 31 | state >> 33) * xxh64_primes[0];
+}
+
+static u64 xxh64_shuffle(u64 val) {
+	return xxh64_step(val * xxh64_primes[1]);
+}
+
+static u64 xxh64_round(u64 state, u64 val) {
+	return xxh64_step(state + (val * xxh64_primes[1]));
+}
+
+static u64 xxh64_mergestep(u64 state) {
+	return state * xxh64_primes[0] + xxh64_primes[3];
+}
+
+static u64 xxh64_merge(u64 state, u64 val) {
+	return xxh64_mergestep(state ^ xxh64_shuffle(val));
+}
+
+static inline u64 xxh64_load(const u8 *ptr) {
+#if !CONFIG_NO_UNALIGNED
+	return ldle64u(ptr);
+#else
+	u64 val = 0;
+	for_range(i, 0, 8) {val |= (u64)ptr[i] << (8 * i);}
+	return val;
+#endif
+}
+
+void xxh64_init(struct xxh64_state *state, u64 seed) {
+	state->offset = 0;
+	state->len = 0;
+	state->long_hash = 0;
+	state->state[0] = seed + xxh64_primes[0] + xxh64_primes[1];
+	state->state[1] = seed + xxh64_primes[1];
+	state->state[2] = seed;
+	state->state[3] = seed - xxh64_primes[0];
+}
+
+void xxh64_update(struct xxh64_state *state, const u8 *buf, size_t size) {
+	state->len += size;
+	u8 xxh_offset = state->offset;
+	if (size <= 32 && xxh_offset + size < 32) {
+		memcpy((u8 *)state->buf + xxh_offset, buf, size);
+		state->offset = xxh_offset + size;
+		return;
+	}
+	u8 fillup = 32 - xxh_offset;
+	assert(size >= fillup);
+	memcpy((u8 *)state->buf + xxh_offset, buf, fillup);
+	size -= fillup;
+	buf += fillup;
+	u64 a = xxh64_round(state->state[0], ldle64a(state->buf));
+	u64 b = xxh64_round(state->state[1], ldle64a(state->buf + 1));
+	u64 c = xxh64_round(state->state[2], ldle64a(state->buf + 2));
+	u64 d = xxh64_round(state->state[3], ldle64a(state->buf + 3));
+	state->long_hash = 1;
+	/* the four lanes are independent, so do two stripes per iteration to give the multipliers something to overlap */
+	while (size >= 64) {
+		u64 a0 = xxh64_load(buf), b0 = xxh64_load(buf + 8);
+		u64 c0 = xxh64_load(buf + 16), d0 = xxh64_load(buf + 24);
+		u64 a1 = xxh64_load(buf + 32), b1 = xxh64_load(buf + 40);
+		u64 c1 = xxh64_load(buf + 48), d1 = xxh64_load(buf + 56);
+		a = xxh64_round(xxh64_round(a, a0), a1);
+		b = xxh64_round(xxh64_round(b, b0), b1);
+		c = xxh64_round(xxh64_round(c, c0), c1);
+		d = xxh64_round(xxh64_round(d, d0), d1);
+		buf += 64;
+		size -= 64;
+	}
+	if (size >= 32) {
+		a = xxh64_round(a, xxh64_load(buf));
+		b = xxh64_round(b, xxh64_load(buf + 8));
+		c = xxh64_round(c, xxh64_load(buf + 16));
+		d = xxh64_round(d, xxh64_load(buf + 24));
+		buf += 32;
+		size -= 32;
+	}
+	state->state[0] = a;
+	state->state[1] = b;
+	state->state[2] = c;
+	state->state[3] = d;
+	memcpy(state->buf, buf, size);
+	state->offset = size;
+}
+
+u64 xxh64_finalize(const struct xxh64_state *state) {
+	u64 xxh64 = state->state[2] + xxh64_primes[4];	/* state[2] is the seed for short inputs */
+	if (state->long_hash) {
+		u64 a, b, c, d;
+		a = state->state[0];
+		b = state->state[1];
+		c = state->state[2];
+		d = state->state[3];
+		xxh64 = (a << 1 | a >> 63) + (b << 7 | b >> 57) + (c << 12 | c >> 52) + (d << 18 | d >> 46);
+		xxh64 = xxh64_merge(xxh64, a);
+		xxh64 = xxh64_merge(xxh64, b);
+		xxh64 = xxh64_merge(xxh64, c);
+		xxh64 = xxh64_merge(xxh64, d);
+	}
+	xxh64 += state->len;
+	u8 single_rounds = state->offset >> 3;
+	assert(single_rounds < 4);
+	const u8 *ptr = (const u8 *)state->buf;
+	for (int i = 0; i < single_rounds; ++i) {
+		xxh64 ^= xxh64_shuffle(ldle64a(state->buf + i));
+		ptr += 8;
+		xxh64 = xxh64_mergestep(xxh64 << 27 | xxh64 >> 37);
+	}
+	if (state->offset & 4) {
+		u32 w = (u32)ptr[0] | (u32)ptr[1] << 8 | (u32)ptr[2] << 16 | (u32)ptr[3] << 24;
+		xxh64 ^= w * xxh64_primes[0];
+		ptr += 4;
+		xxh64 = (xxh64 << 23 | xxh64 >> 41) * xxh64_primes[1] + xxh64_primes[2];
+	}
+	u8 byte_rounds = state->offset & 3;
+	while (byte_rounds--) {
+		xxh64 ^= *ptr++ * xxh64_primes[4];
+		xxh64 = (xxh64 << 11 | xxh64 >> 53) * xxh64_primes[0];
+	}
+	xxh64 ^= xxh64 >> 33;
+	xxh64 *= xxh64_primes[1];
+	xxh64 ^= xxh64 >> 29;
+	xxh64 *= xxh64_primes[2];
+	xxh64 ^= xxh64 >> 32;
+	return xxh64;
+}
+
+void checksum_update(struct checksum_state *st, const u8 *buf, size_t size) {
+	switch (st->type) {
+	case CHECKSUM_CRC32:
+		st->crc = crc32_update(st->crc, buf, size);
+		break;
+	case CHECKSUM_XXH64:
+		xxh64_update(&st->xxh64, buf, size);
+		break;
+	}
+}
+
+u32 checksum_value(const struct checksum_state *st) {
+	switch (st->type) {
+	case CHECKSUM_CRC32: return ~st->crc;
+	case CHECKSUM_XXH64: return xxh64_finalize(&st->xxh64);
+	default: return 0;
+	}
+}
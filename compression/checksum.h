@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#pragma once
+#include "../include/defs.h"
+
+/* CRC-32 as used by gzip (reflected, polynomial 0xedb88320). `crc` is the running value: start with ~0 and invert the result */
+u32 crc32_update(u32 crc, const u8 *buf, size_t size);
+
+struct xxh64_state {
+	u64 buf[4];
+	u64 state[4];
+	u64 len;
+	u8 offset;
+	_Bool long_hash;
+};
+
+void xxh64_init(struct xxh64_state *state, u64 seed);
+void xxh64_update(struct xxh64_state *state, const u8 *buf, size_t size);
+u64 xxh64_finalize(const struct xxh64_state *state);
+
+enum checksum_type {
+	CHECKSUM_NONE,
+	CHECKSUM_CRC32,
+	CHECKSUM_XXH64,
+};
+
+/* content checksum of a decompressor frame */
+struct checksum_state {
+	u8 type;
+	/* set by the client after `decompressor::init` if it wants to checksum the output itself, off the decode path (e. g. on another CPU or while waiting for I/O). it then has to pass all output to `checksum_update` in order and call `checksum_verify` once the frame is decoded */
+	_Bool deferred;
+	/* set by the decoder when it reaches the trailer */
+	_Bool have_expected;
+	u32 expected;
+	u32 crc;
+	struct xxh64_state xxh64;
+};
+
+HEADER_FUNC void checksum_init(struct checksum_state *st, enum checksum_type type) {
+	st->type = type;
+	st->deferred = st->have_expected = 0;
+	st->crc = ~(u32)0;
+	if (type == CHECKSUM_XXH64) {xxh64_init(&st->xxh64, 0);}
+}
+
+void checksum_update(struct checksum_state *st, const u8 *buf, size_t size);
+/* the value stored in the frame trailer: the final CRC-32, or the lower 32 bits of the XXH64 */
+u32 checksum_value(const struct checksum_state *st);
+
+/* for decoders: checksums freshly decoded output, unless the client does it */
+HEADER_FUNC void checksum_decoded(struct checksum_state *st, const u8 *buf, size_t size) {
+	if (!st->deferred) {checksum_update(st, buf, size);}
+}
+
+/* for decoders: records the checksum read from the trailer. returns 0 on a mismatch, which can only be detected here if the checksum is not deferred */
+HEADER_FUNC _Bool checksum_expect(struct checksum_state *st, u32 expected) {
+	st->expected = expected;
+	st->have_expected = 1;
+	return st->deferred || checksum_value(st) == expected;
+}
+
+/* for clients using deferred checksums: returns whether the output passed to `checksum_update` matches the trailer. frames without a content checksum always pass */
+HEADER_FUNC _Bool checksum_verify(const struct checksum_state *st) {
+	return !st->have_expected || checksum_value(st) == st->expected;
+}
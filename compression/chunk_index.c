@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include "compression.h"
+
+static u32 read_le32(const u8 *in) {
+	return in[0] | (u32)in[1] << 8 | (u32)in[2] << 16 | (u32)in[3] << 24;
+}
+
+enum compr_probe_status chunk_index_probe(const u8 *in, const u8 *end, size_t *size) {
+	if (end - in < 4) {return COMPR_PROBE_NOT_ENOUGH_DATA;}
+	if (read_le32(in) != CHUNK_INDEX_MAGIC) {return COMPR_PROBE_WRONG_MAGIC;}
+	if (end - in < CHUNK_INDEX_HEADER_SIZE) {return COMPR_PROBE_NOT_ENOUGH_DATA;}
+	/* other skippable frames are not ours to interpret */
+	if (read_le32(in + 8) != CHUNK_INDEX_TAG) {return COMPR_PROBE_WRONG_MAGIC;}
+	u32 frame_size = read_le32(in + 4), num_chunks = read_le32(in + 12);
+	if (!num_chunks || frame_size != CHUNK_INDEX_HEADER_SIZE - 8 + (u64)num_chunks * CHUNK_INDEX_ENTRY_SIZE) {
+		return COMPR_PROBE_RESERVED_FEATURE;
+	}
+	*size = (size_t)frame_size + 8;
+	return COMPR_PROBE_SIZE_KNOWN;
+}
+
+u32 chunk_index_num_chunks(const u8 *index) {
+	return read_le32(index + 12);
+}
+
+struct chunk_index_entry chunk_index_entry(const u8 *index, u32 chunk) {
+	const u8 *entry = index + CHUNK_INDEX_HEADER_SIZE + (size_t)chunk * CHUNK_INDEX_ENTRY_SIZE;
+	return (struct chunk_index_entry) {read_le32(entry), read_le32(entry + 4)};
+}
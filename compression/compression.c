@@ -127,6 +127,13 @@ int main(int argc, char **argv) {
 				info("decompression did not produce the probed amout of output\n");
 				return 1;
 			}
+			if ((*decomp)->frame_size) {
+				size_t res = (*decomp)->frame_size(buf, buf + buf_size);
+				if (res < NUM_DECODE_STATUS || res - NUM_DECODE_STATUS != (size_t)(ptr - buf)) {
+					info("frame size scan disagrees with the decoder: %zu vs. %zu bytes\n", res - NUM_DECODE_STATUS, (size_t)(ptr - buf));
+					return 1;
+				}
+			}
 			goto decompressed;
 		case COMPR_PROBE_WRONG_MAGIC: break;
 		default:
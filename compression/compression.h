@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: CC0-1.0 */
 #pragma once
 #include "../include/defs.h"
+#include "checksum.h"
 
 enum {LZCOMMON_BLOCK = 8};
 void lzcommon_literal_copy(u8 *dest, const u8 *src, u32 length);
@@ -46,6 +47,9 @@ struct decompressor_state {
 	u8 *window_start;
 	u8 *out;
 	u8 *out_end;
+
+	/* initialized by `decompressor::init`. the client may set `checksum.deferred` afterwards, see checksum.h */
+	struct checksum_state checksum;
 };
 
 struct decompressor {
@@ -58,4 +62,40 @@ struct decompressor {
 	/* is allowed to assume that `decompressor::probe` returned a success code.
 	 * returns the decode pointer (everything before which can be reclaimed) or null on failure */
 	const u8 *(*init)(struct decompressor_state *state, const u8 *in, const u8 *end);
+	/* optional. walks the block headers of the frame at `in` without decoding it.
+	 * returns NUM_DECODE_STATUS + the compressed size of the frame, DECODE_NEED_MORE_DATA or DECODE_ERR.
+	 * may be null if the format does not allow delimiting a frame without decoding it. */
+	size_t (*frame_size)(const u8 *in, const u8 *end);
+};
+
+/* a chunk index is a skippable frame (in the sense of both the zstd and LZ4 frame formats) that precedes a sequence of independently decodable frames, recording the compressed and decompressed size of each. this allows the frames to be decoded in parallel, each into its known output offset.
+
+layout (all fields little-endian u32): magic, frame size (of everything after these 8 bytes), tag, number of chunks, then compressed and decompressed size for each chunk. */
+enum {
+	CHUNK_INDEX_MAGIC = 0x184d2a5c,
+	CHUNK_INDEX_TAG = 0x6963626c,	/* "lbci" */
+	CHUNK_INDEX_HEADER_SIZE = 16,
+	CHUNK_INDEX_ENTRY_SIZE = 8,
+};
+
+struct chunk_index_entry {
+	u32 compressed_size, decompressed_size;
 };
+
+/* returns COMPR_PROBE_SIZE_KNOWN and sets `*size` to the size of the whole index frame if `in` starts with a chunk index */
+enum compr_probe_status chunk_index_probe(const u8 *in, const u8 *end, size_t *size);
+/* `index` must point to a complete index frame accepted by `chunk_index_probe` */
+u32 chunk_index_num_chunks(const u8 *index);
+struct chunk_index_entry chunk_index_entry(const u8 *index, u32 chunk);
+
+/* a stored frame is a skippable frame carrying an uncompressed payload component. block device loaders can DMA its data directly to the final location, see async_transfer::redirect.
+
+layout (all fields little-endian u32): magic, frame size (of everything after these 8 bytes), tag, offset of the data from the start of the frame. the data extends to the end of the frame; the padding before it can be used to align it on the medium. */
+enum {
+	STORED_FRAME_MAGIC = 0x184d2a5c,
+	STORED_FRAME_TAG = 0x6473626c,	/* "lbsd" */
+	STORED_FRAME_HEADER_SIZE = 16,
+};
+
+/* returns COMPR_PROBE_SIZE_KNOWN if `in` starts with a stored frame, setting `*data_offset` and `*size` to the offset and size of its data */
+enum compr_probe_status stored_frame_probe(const u8 *in, const u8 *end, size_t *data_offset, size_t *size);
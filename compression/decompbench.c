@@ -0,0 +1,272 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#define _POSIX_C_SOURCE 200809L
+#include "../include/defs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#undef NDEBUG
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#if __x86_64__
+#include <x86intrin.h>
+#endif
+#include "compression.h"
+
+/* end-to-end throughput benchmark for the decompressors.
+usage: decompbench [-r runs] [-c chunk sizes] [-f MHz] file…
+
+every file (e. g. a compressed kernel Image, initramfs, DTB or BL31 ELF) is decoded `runs` times for each chunk size, handing the input to the decoder in pieces of that size like the async pumps in dramstage do (0 means the whole file at once). the best run is reported as JSON on stdout, with the time split into decoding, content checksumming (deferred, see checksum.h) and copying the input into the staging buffer. cycles are derived from the clock given with -f, or from the TSC on x86. */
+
+extern const struct decompressor lz4_decompressor, gzip_decompressor, zstd_decompressor;
+
+static const struct {const char *name; const struct decompressor *decomp;} formats[] = {
+	{"lz4", &lz4_decompressor},
+	{"gzip", &gzip_decompressor},
+	{"zstd", &zstd_decompressor},
+};
+
+static u8 *read_file(int fd, size_t *size) {
+	size_t buf_size = 0, buf_cap = 128;
+	u8 *buf = malloc(buf_cap);
+	assert(buf);
+	while (1) {
+		if (buf_cap - buf_size < 128) {
+			buf = realloc(buf, buf_cap *= 2);
+			assert(buf);
+		}
+		ssize_t res = read(fd, buf + buf_size, buf_cap - buf_size);
+		if (res > 0) {
+			buf_size += res;
+		} else if (!res) {
+			break;
+		} else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("While reading input");
+			return 0;
+		}
+	}
+	*size = buf_size;
+	return buf;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static u64 cycle_counter() {
+#if __x86_64__
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+struct timing {
+	double decode, checksum, copy, total;
+	u64 cycles;
+};
+
+struct bench_input {
+	const struct decompressor *decomp;
+	const u8 *data;
+	size_t size;
+	u8 *staging, *out;
+	size_t out_size;
+	struct decompressor_state *state;
+};
+
+enum {RUN_OK = 0, RUN_NEED_MORE_SPACE, RUN_FAILED};
+
+/* decodes the whole input once. the output is checksummed after every successful decode call, separately timed */
+static int run(const struct bench_input *in, size_t chunk, struct timing *t, size_t *decompressed_size) {
+	struct decompressor_state *state = in->state;
+	const struct decompressor *decomp = in->decomp;
+	memset(t, 0, sizeof(*t));
+	double start = now();
+	u64 start_cycles = cycle_counter();
+	if (!chunk) {chunk = in->size;}
+	size_t fetched = 0;
+	const u8 *ptr = in->staging;
+	double t0;
+#define FETCH do {\
+	size_t n = in->size - fetched < chunk ? in->size - fetched : chunk;\
+	t0 = now();\
+	memcpy(in->staging + fetched, in->data + fetched, n);\
+	fetched += n;\
+	t->copy += now() - t0;\
+} while (0)
+	size_t UNUSED probed;
+	while (fetched < in->size && decomp->probe(ptr, in->staging + fetched, &probed) == COMPR_PROBE_NOT_ENOUGH_DATA) {FETCH;}
+	t0 = now();
+	ptr = decomp->init(state, ptr, in->staging + fetched);
+	if (!ptr) {return RUN_FAILED;}
+	state->out = state->window_start = in->out;
+	state->out_end = in->out + in->out_size;
+	state->checksum.deferred = 1;
+	t->decode += now() - t0;
+	u8 *checked = in->out;
+	while (state->decode) {
+		t0 = now();
+		size_t res = state->decode(state, ptr, in->staging + fetched);
+		double t1 = now();
+		t->decode += t1 - t0;
+		if (res >= NUM_DECODE_STATUS) {
+			ptr += res - NUM_DECODE_STATUS;
+			checksum_update(&state->checksum, checked, state->out - checked);
+			checked = state->out;
+			t->checksum += now() - t1;
+		} else if (res == DECODE_NEED_MORE_DATA && fetched < in->size) {
+			FETCH;
+		} else if (res == DECODE_NEED_MORE_SPACE) {
+			return RUN_NEED_MORE_SPACE;
+		} else {
+			fprintf(stderr, "decoding failed with status %zu\n", res);
+			return RUN_FAILED;
+		}
+	}
+#undef FETCH
+	t0 = now();
+	_Bool ok = checksum_verify(&state->checksum);
+	t->checksum += now() - t0;
+	if (!ok) {
+		fprintf(stderr, "content checksum mismatch\n");
+		return RUN_FAILED;
+	}
+	t->total = now() - start;
+	t->cycles = cycle_counter() - start_cycles;
+	*decompressed_size = state->out - in->out;
+	return RUN_OK;
+}
+
+static void print_json_string(const char *str) {
+	putchar('"');
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\') {
+			printf("\\%c", *str);
+		} else if ((u8)*str < 0x20) {
+			printf("\\u%04x", (unsigned)(u8)*str);
+		} else {
+			putchar(*str);
+		}
+	}
+	putchar('"');
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-r runs] [-c chunk size,…] [-f MHz] file…\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	u32 runs = 10;
+	double mhz = 0;
+	size_t chunk_sizes[32] = {512, 4096, 65536, 1 << 20, 0};
+	u32 num_chunk_sizes = 5;
+	int opt;
+	while ((opt = getopt(argc, argv, "r:c:f:")) != -1) {
+		switch (opt) {
+		case 'r':
+			runs = atoi(optarg);
+			if (!runs) {usage(argv[0]);}
+			break;
+		case 'c':
+			num_chunk_sizes = 0;
+			for (char *tok = strtok(optarg, ","); tok; tok = strtok(0, ",")) {
+				if (num_chunk_sizes == ARRAY_SIZE(chunk_sizes)) {usage(argv[0]);}
+				chunk_sizes[num_chunk_sizes++] = strtoull(tok, 0, 0);
+			}
+			break;
+		case 'f':
+			mhz = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc) {usage(argv[0]);}
+	printf("{\"runs\": %"PRIu32", \"results\": [", runs);
+	_Bool first_result = 1;
+	for (int arg = optind; arg < argc; ++arg) {
+		int fd = open(argv[arg], O_RDONLY);
+		if (fd < 0) {
+			perror(argv[arg]);
+			return 1;
+		}
+		struct bench_input in;
+		u8 *data = read_file(fd, &in.size);
+		close(fd);
+		assert(data);
+		in.data = data;
+		const char *format = 0;
+		size_t probed_size = 0;
+		for_array(i, formats) {
+			enum compr_probe_status status = formats[i].decomp->probe(data, data + in.size, &probed_size);
+			if (status == COMPR_PROBE_WRONG_MAGIC) {continue;}
+			if (status > COMPR_PROBE_LAST_SUCCESS) {
+				fprintf(stderr, "%s: probing failed with status %u\n", argv[arg], (unsigned)status);
+				return 1;
+			}
+			if (status == COMPR_PROBE_SIZE_UNKNOWN) {probed_size = 0;}
+			in.decomp = formats[i].decomp;
+			format = formats[i].name;
+			break;
+		}
+		if (!format) {
+			fprintf(stderr, "%s: no known compression format detected\n", argv[arg]);
+			return 1;
+		}
+		in.staging = malloc(in.size);
+		in.state = malloc(in.decomp->state_size);
+		in.out_size = probed_size ? probed_size + LZCOMMON_BLOCK : 8 * in.size + (1 << 20);
+		in.out = malloc(in.out_size + LZCOMMON_BLOCK);
+		assert(in.staging && in.state && in.out);
+		/* warm-up, also finds the output size if the probe didn't */
+		struct timing t;
+		size_t decompressed_size;
+		int res;
+		while ((res = run(&in, 0, &t, &decompressed_size)) == RUN_NEED_MORE_SPACE) {
+			in.out_size *= 2;
+			in.out = realloc(in.out, in.out_size + LZCOMMON_BLOCK);
+			assert(in.out);
+		}
+		if (res != RUN_OK) {
+			fprintf(stderr, "%s: decoding failed\n", argv[arg]);
+			return 1;
+		}
+		for_range(c, 0, num_chunk_sizes) {
+			size_t chunk = chunk_sizes[c];
+			struct timing best = {.total = 1e30};
+			for_range(r, 0, runs) {
+				size_t size;
+				if (run(&in, chunk, &t, &size) != RUN_OK || size != decompressed_size) {
+					fprintf(stderr, "%s: decoding failed\n", argv[arg]);
+					return 1;
+				}
+				if (t.total < best.total) {best = t;}
+			}
+			double hz = mhz ? mhz * 1e6 : best.cycles / best.total;
+			printf("%s\n\t{\"file\": ", first_result ? "" : ",");
+			first_result = 0;
+			print_json_string(argv[arg]);
+			printf(", \"format\": \"%s\", \"compressed_size\": %zu, \"decompressed_size\": %zu, \"chunk_size\": %zu, ", format, in.size, decompressed_size, chunk ? chunk : in.size);
+			printf("\"total_s\": %.6f, \"decode_s\": %.6f, \"checksum_s\": %.6f, \"copy_s\": %.6f, ", best.total, best.decode, best.checksum, best.copy);
+			printf("\"mb_per_s\": %.2f, ", decompressed_size / best.total / 1e6);
+			if (hz > 0) {
+				printf("\"cycles_per_byte\": %.3f}", best.total * hz / decompressed_size);
+			} else {
+				printf("\"cycles_per_byte\": null}");
+			}
+		}
+		free(in.staging);
+		free(in.state);
+		free(in.out);
+		free(data);
+	}
+	printf("\n]}\n");
+	return 0;
+}
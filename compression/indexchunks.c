@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include "../include/defs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#undef NDEBUG
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include "compression.h"
+#include "../include/log.h"
+
+/* reads a concatenation of independently decodable frames (e. g. zstd or LZ4 frames or gzip members, each compressed from a separate slice of the input) on stdin and writes it to stdout, preceded by a chunk index. every frame is decoded once to find its sizes. */
+
+extern const struct decompressor lz4_decompressor, gzip_decompressor, zstd_decompressor;
+
+static const struct decompressor *const formats[] = {
+	&lz4_decompressor,
+	&gzip_decompressor,
+	&zstd_decompressor,
+};
+
+static u8 *read_file(int fd, size_t *size) {
+	size_t buf_size = 0, buf_cap = 128;
+	u8 *buf = malloc(buf_cap);
+	assert(buf);
+	while (1) {
+		if (buf_cap - buf_size < 128) {
+			buf = realloc(buf, buf_cap *= 2);
+			assert(buf);
+		}
+		ssize_t res = read(fd, buf + buf_size, buf_cap - buf_size);
+		if (res > 0) {
+			buf_size += res;
+		} else if (!res) {
+			break;
+		} else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("While reading input");
+			return 0;
+		}
+	}
+	*size = buf_size;
+	return buf;
+}
+
+static void write_buf(int fd, const u8 *buf, size_t size) {
+	const u8 *end = buf + size;
+	while (buf < end) {
+		ssize_t res = write(fd, buf, end - buf);
+		if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("While writing output");
+			exit(1);
+		}
+		if (res > 0) {buf += res;}
+	}
+}
+
+static void write_le32(u8 *out, u32 val) {
+	for_range(i, 0, 4) {out[i] = val >> (8 * i);}
+}
+
+/* decodes the frame at `in`, returns its compressed size and sets `*decompressed_size` */
+static size_t decode_frame(const u8 *in, const u8 *end, size_t *decompressed_size) {
+	static u8 state_buf[1 << 14] __attribute__((aligned(16)));
+	struct decompressor_state *state = (struct decompressor_state *)state_buf;
+	for_array(i, formats) {
+		size_t size;
+		enum compr_probe_status status = formats[i]->probe(in, end, &size);
+		if (status == COMPR_PROBE_WRONG_MAGIC) {continue;}
+		if (status > COMPR_PROBE_LAST_SUCCESS) {
+			fprintf(stderr, "probing failed with status %u\n", (unsigned)status);
+			exit(1);
+		}
+		if (status == COMPR_PROBE_SIZE_UNKNOWN) {size = (64 << 20) - LZCOMMON_BLOCK;}
+		assert(formats[i]->state_size <= sizeof(state_buf));
+		const u8 *ptr = formats[i]->init(state, in, end);
+		assert(ptr);
+		/* like in dramstage, leave the decoder LZCOMMON_BLOCK of slack before out_end, and LZCOMMON_BLOCK of scratch after it */
+		u8 *out = malloc(size + 2 * LZCOMMON_BLOCK);
+		assert(out);
+		state->out = state->window_start = out;
+		state->out_end = out + size + LZCOMMON_BLOCK;
+		while (state->decode) {
+			size_t res = state->decode(state, ptr, end);
+			if (res < NUM_DECODE_STATUS) {
+				fprintf(stderr, "decoding failed with status %zu\n", res);
+				exit(1);
+			}
+			ptr += res - NUM_DECODE_STATUS;
+		}
+		*decompressed_size = state->out - out;
+		free(out);
+		return ptr - in;
+	}
+	fprintf(stderr, "no known compression format detected at this position\n");
+	exit(1);
+}
+
+int main(int UNUSED argc, char UNUSED **argv) {
+	size_t size;
+	u8 *buf = read_file(0, &size);
+	assert(buf);
+	const u8 *ptr = buf, *end = buf + size;
+	size_t num_chunks = 0, cap = 16;
+	struct chunk_index_entry *entries = malloc(cap * sizeof(*entries));
+	assert(entries);
+	while (ptr < end) {
+		size_t decompressed_size, compressed_size = decode_frame(ptr, end, &decompressed_size);
+		if (compressed_size > UINT32_MAX || decompressed_size > UINT32_MAX) {
+			fprintf(stderr, "chunk %zu is too large\n", num_chunks);
+			return 1;
+		}
+		info("chunk %zu: %zu bytes → %zu bytes\n", num_chunks, compressed_size, decompressed_size);
+		if (num_chunks == cap) {
+			entries = realloc(entries, (cap *= 2) * sizeof(*entries));
+			assert(entries);
+		}
+		entries[num_chunks++] = (struct chunk_index_entry) {compressed_size, decompressed_size};
+		ptr += compressed_size;
+	}
+	if (!num_chunks) {
+		fprintf(stderr, "no input\n");
+		return 1;
+	}
+	size_t index_size = CHUNK_INDEX_HEADER_SIZE + num_chunks * CHUNK_INDEX_ENTRY_SIZE;
+	u8 *index = malloc(index_size);
+	assert(index);
+	write_le32(index, CHUNK_INDEX_MAGIC);
+	write_le32(index + 4, index_size - 8);
+	write_le32(index + 8, CHUNK_INDEX_TAG);
+	write_le32(index + 12, num_chunks);
+	for_range(i, 0, num_chunks) {
+		write_le32(index + CHUNK_INDEX_HEADER_SIZE + i * CHUNK_INDEX_ENTRY_SIZE, entries[i].compressed_size);
+		write_le32(index + CHUNK_INDEX_HEADER_SIZE + i * CHUNK_INDEX_ENTRY_SIZE + 4, entries[i].decompressed_size);
+	}
+	size_t check_size;
+	assert(chunk_index_probe(index, index + index_size, &check_size) == COMPR_PROBE_SIZE_KNOWN && check_size == index_size);
+	write_buf(1, index, index_size);
+	write_buf(1, buf, size);
+	return 0;
+}
@@ -2,17 +2,17 @@
 #define _POSIX_C_SOURCE 200809L
 #include "compression.h"
 #include "../include/log.h"
+#include "arch_mem_access.h"
 #include <assert.h>
 #include <string.h>
 #include <inttypes.h>
 
-static u32 crc32_byte(u32 input, u32 poly) {
-	for_range(i, 0, 8) {
-		input = (input >> 1) ^ (input & 1 ? poly : 0);
-	}
-	return input;
-}
-
+#if !CONFIG_INFLATE_BITS32
+/* with at least 8 bytes of input left, a refill is a single unaligned load and leaves enough bits for a whole length/distance pair */
+typedef u64 bits_t;
+enum {GUARANTEED_BITS = 56};
+#else
+/* the old 32-bit reader, kept for comparison (see inflatebench.c). it has to refill between the codes of a match */
 typedef u32 bits_t;
 enum {GUARANTEED_BITS = 25};
 #if __aarch64__ && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
@@ -22,6 +22,7 @@ enum {GUARANTEED_BITS = 25};
 #ifndef LDU32LEU_END
 #warning "no unaligned 32-bit little-endian load sequence available, using generic fallback"
 #endif
+#endif
 
 #define check(expr, ...) if (unlikely(!(expr))) {info(__VA_ARGS__);return 0;}
 enum {UNIMPLEMENTED = 0};
@@ -38,85 +39,156 @@ enum {
 			num_bits += 8;\
 			info("bits 0x%x/%u @ %u\n", bits, (unsigned)num_bits, (unsigned)(ptr - *in))
 
-static void construct_codes(u16 num_symbols, const u8 *lengths, u16 *codes) {
-	u16 active_syms = 0;
-	for_range(sym, 0, num_symbols) {
-		if (lengths[sym]) {
-			active_syms += 1;
-		} else {
-			codes[sym] = 0;
-		}
-	}
-	u16 code = 0;
-	u16 codes_allocated = 0;
-	for_range(len, 1, 16) {
-		for_range(sym, 0, num_symbols) {
-			if (lengths[sym] != len) {continue;}
-			codes[sym] = code;
-			codes_allocated += 1;
-			u8 pos = len - 1;
-			while (code & 1 << pos) {
-				code &= ~(1 << pos);
-				if (!pos) {goto end;}
-				pos -= 1;
-			}
-			code |= 1 << pos;
-		}
-	} end:;
-	assert(active_syms == codes_allocated);
+/* decoding table entries:
+ * bits 0–3: number of code bits to consume (for subtable pointers, the number of bits used to index the main table)
+ * bits 4–7: entry type
+ * bits 8–12: number of extra bits for lengths and distances, or number of index bits for subtable pointers
+ * bits 16–31: the literal(s) (first one in the low byte), the base value, or the offset of the subtable */
+enum {
+	ENTRY_INVALID = 0 << 4,
+	ENTRY_LITERAL = 1 << 4,
+	ENTRY_2LITERALS = 2 << 4,
+	ENTRY_BASE = 3 << 4,
+	ENTRY_END = 4 << 4,
+	ENTRY_SUBTABLE = 5 << 4,
+	ENTRY_TYPE_MASK = 15 << 4,
+};
+#define ENTRY(type, extra, payload) ((type) | (u32)(extra) << 8 | (u32)(payload) << 16)
+#define ENTRY_EXTRA(entry) ((entry) >> 8 & 31)
+#define ENTRY_PAYLOAD(entry) ((entry) >> 16)
+
+enum {
+	LIT_TABLE_BITS = 11, DIST_TABLE_BITS = 8, PRECODE_TABLE_BITS = 7,
+	/* worst-case sizes including subtables (`enough 288 11 15` and `enough 32 8 15` from zlib's examples/enough.c) */
+	LIT_TABLE_SIZE = 2342, DIST_TABLE_SIZE = 402,
+	MAX_CODE_LENGTH = 15,
+};
+
+/* length symbols 257–285. 285 has base 259 so that it can be told apart from 284 with all extra bits set (which would also be 258, but is invalid) */
+static const u16 length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 259
+};
+static const u8 length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const u16 dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const u8 dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static u32 lit_entry(u32 sym) {
+	if (sym < 256) {return ENTRY(ENTRY_LITERAL, 0, sym);}
+	if (sym == 256) {return ENTRY_END;}
+	if (sym < 286) {return ENTRY(ENTRY_BASE, length_extra[sym - 257], length_base[sym - 257]);}
+	return ENTRY_INVALID;
 }
 
-static void construct_dectable(u16 num_symbols, const u8 *lengths, const u16 *codes, u16 *dectable, u16 *overlength_offsets, u32 *overlength_symbols) {
-	u16 overlength_count[4];
-	for_array(i, overlength_count) {overlength_count[i] = 0;}
-	for_range(i, 0, 2048) {dectable[i] = 10;}
-	for_range(sym, 0, num_symbols) {
-		u8 len = lengths[sym];
-		if (!len) {continue;}
-		u16 code = codes[sym];
-		if (len <= 11) {
-			for_range(i, 0, 2048u >> len) {
-				dectable[i << len | code] = len | sym << 4;
-			}
-		} else {
-			assert(len <= 15);
-			overlength_count[len - 12] += 1;
-			dectable[code & 0x7ff] = 12;
+static u32 dist_entry(u32 sym) {
+	if (sym < 30) {return ENTRY(ENTRY_BASE, dist_extra[sym], dist_base[sym]);}
+	return ENTRY_INVALID;
+}
+
+static u32 precode_entry(u32 sym) {
+	return ENTRY(ENTRY_LITERAL, 0, sym);
+}
+
+/* builds a decoding table for the canonical code given by `lengths`, with a main table indexed by `table_bits` bits and subtables for longer codes.
+ * symbols are sorted by code length with a counting sort, then assigned codes in canonical order. codes are stored bit-reversed, since deflate packs them starting with the MSB.
+ * returns 0 if the code is oversubscribed, or incomplete in a way not allowed by RFC 1951 (only a single code of length 1, or no code at all, may be incomplete). */
+static _Bool build_table(u32 num_symbols, const u8 *lengths, u32 (*entry_for)(u32), u32 *table, u32 table_bits, u32 table_size, u16 *sorted) {
+	u16 count[MAX_CODE_LENGTH + 1], offset[MAX_CODE_LENGTH + 1];
+	for_array(i, count) {count[i] = 0;}
+	for_range(sym, 0, num_symbols) {count[lengths[sym]] += 1;}
+	int left = 1;
+	u32 max_len = 0;
+	for_range(len, 1, MAX_CODE_LENGTH + 1) {
+		left = left * 2 - count[len];
+		if (left < 0) {
+			info("oversubscribed Huffman code\n");
+			return 0;
 		}
+		if (count[len]) {max_len = len;}
 	}
-	u16 off = 0;
-	debug("counts: ");
-	for_array(i, overlength_count) {debug(" %u", (unsigned)overlength_count[i]);}
-	debug("\n");
-	for_range(len, 0, 4) {
-		overlength_offsets[len] = off;
-		off += overlength_count[len];
-		overlength_count[len] = 0;
+	u32 main_size = 1 << table_bits;
+	if (left > 0) {
+		if (max_len > 1) {
+			info("incomplete Huffman code\n");
+			return 0;
+		}
+		/* at most a single 1-bit code: the rest of the code space is unassigned */
+		for_range(i, 0, main_size) {table[i] = ENTRY_INVALID | 1;}
 	}
-	overlength_offsets[4] = off;
-	debug("offsets: ");
-	for_range(i, 0, 5) {debug(" %u", (unsigned)overlength_offsets[i]);}
-	debug("\n");
+	offset[1] = 0;
+	for_range(len, 1, MAX_CODE_LENGTH) {offset[len + 1] = offset[len] + count[len];}
 	for_range(sym, 0, num_symbols) {
-		u8 len = lengths[sym];
-		if (len < 12) {continue;}
-		u16 idx = overlength_count[len - 12]++ + overlength_offsets[len - 12];
-		debug("sym%u len%u idx%u code %x\n", (unsigned)sym, (unsigned)len, (unsigned)idx, (unsigned)codes[sym]);
-		assert(idx < overlength_offsets[len - 11]);
-		overlength_symbols[idx] = sym | codes[sym] << 9;
+		if (lengths[sym]) {sorted[offset[lengths[sym]]++] = sym;}
+	}
+	u32 code = 0, num_codes = num_symbols - count[0], sub_start = 0, sub_bits = 0, prefix = main_size, next_sub = main_size;
+	u32 len = 1;
+	for_range(i, 0, num_codes) {
+		while (!count[len]) {len += 1;}
+		u32 entry = entry_for(sorted[i]);
+		if (len <= table_bits) {
+			for (u32 j = code; j < main_size; j += 1 << len) {table[j] = entry | len;}
+		} else {
+			if ((code & (main_size - 1)) != prefix) {
+				/* start a new subtable, large enough for all remaining codes sharing this prefix */
+				prefix = code & (main_size - 1);
+				sub_bits = len - table_bits;
+				int space = 1 << sub_bits;
+				while (table_bits + sub_bits < max_len) {
+					space -= count[table_bits + sub_bits];
+					if (space <= 0) {break;}
+					sub_bits += 1;
+					space <<= 1;
+				}
+				sub_start = next_sub;
+				next_sub += 1 << sub_bits;
+				if (next_sub > table_size) {
+					info("Huffman decoding table overflow\n");
+					return 0;
+				}
+				table[prefix] = ENTRY(ENTRY_SUBTABLE, sub_bits, sub_start) | table_bits;
+			}
+			for (u32 j = code >> table_bits; j < (u32)1 << sub_bits; j += 1 << (len - table_bits)) {
+				table[sub_start + j] = entry | len;
+			}
+		}
+		count[len] -= 1;
+		/* increment the bit-reversed code */
+		u32 bit = 1 << (len - 1);
+		while (code & bit) {bit >>= 1;}
+		code = bit ? (code & (bit - 1)) | bit : 0;
 	}
-	for_array(len, overlength_count) {
-		assert(overlength_offsets[len] + overlength_count[len] == overlength_offsets[len + 1]);
+	return 1;
+}
+
+/* merges pairs of literals whose codes together fit in the main table into ENTRY_2LITERALS entries */
+static void pair_literals(u32 *table, u32 table_bits) {
+	/* going downwards, table[i >> len] is always still unmodified */
+	for (u32 i = 1 << table_bits; i-- > 0;) {
+		u32 first = table[i];
+		if ((first & ENTRY_TYPE_MASK) != ENTRY_LITERAL) {continue;}
+		u32 len = first & 15, second = table[i >> len];
+		if ((second & ENTRY_TYPE_MASK) != ENTRY_LITERAL || len + (second & 15) > table_bits) {continue;}
+		table[i] = ENTRY(ENTRY_2LITERALS, 0, ENTRY_PAYLOAD(first) | ENTRY_PAYLOAD(second) << 8) | (len + (second & 15));
 	}
 }
 
 struct huffman_state {
 	const u8 *ptr;
-	u32 bits, val;
+	bits_t bits;
+	u32 val;
 	u8 num_bits;
 };
 
-#define REPORT(ctx) spew(ctx ": 0x%x/%u\n", huff.bits, (unsigned)huff.num_bits)
+#define REPORT(ctx) spew(ctx ": 0x%"PRIx64"/%u\n", (u64)huff.bits, (unsigned)huff.num_bits)
 
 #define ERROR_CODES \
 	X(OUT_OF_DATA, "out of data")\
@@ -133,7 +205,7 @@ enum error_codes {
 	NUM_ERR_CODES
 };
 
-const char *const error_msg[NUM_ERR_CODES] = {
+static const char *const error_msg[NUM_ERR_CODES] UNUSED = {
 	"no error",
 #define X(a, b) b,
 	ERROR_CODES
@@ -141,137 +213,79 @@ const char *const error_msg[NUM_ERR_CODES] = {
 };
 
 #define SHIFT(n) do {huff.bits >>= (n); huff.num_bits -= (n);} while (0)
-/* WARNING: does not handle overlength codes; TODO: only used in length decoding function, maybe factor into that */
-static inline struct huffman_state huff_with_extra(struct huffman_state huff, const u8 *end, const u16 *dectable, const u8 *extra_bit_table, const u16 *baseline_table, const u16 *overlength_offsets, const u16 *overlength_symbols) {
-	REPORT("sym");
-	u16 len, val;
-	while ((len = (val = dectable[huff.bits & 0x7ff]) & 0xf) > huff.num_bits) {
-		if (huff.ptr >= end) {
-			huff.ptr = 0;
-			huff.val = ERR_OUT_OF_DATA;
-			return huff;
-		}
-		huff.bits |= *huff.ptr++ << huff.num_bits;
-		huff.num_bits += 8;
-		REPORT("code");
-	}
-	u16 sym;
-	if (len < 12) {
-		SHIFT(len);
-		sym = val >> 4;
-	} else {
-		for_range(len, 12, 16) {
-			if (len > huff.num_bits) {
-				if (huff.ptr >= end) {
-					huff.ptr = 0;
-					huff.val = ERR_OUT_OF_DATA;
-					return huff;
-				}
-				huff.bits |= *huff.ptr++ << huff.num_bits;
-				huff.num_bits += 8;
-				REPORT("overlength code");
-			}
-			u32 suffix = huff.bits & ((1 << len) - 1);
-			for_range(i, overlength_offsets[len - 12], overlength_offsets[len - 11]) {
-				u32 x = overlength_symbols[i];
-				sym = x & 0x1ff;
-				if ((x >> 9) == suffix) {
-					SHIFT(len);
-					goto found;
-				}
-			}
+#define HUFF_REFILL(n) do {\
+	while (huff.num_bits < (n)) {\
+		if (huff.ptr >= end) {\
+			huff.ptr = 0;\
+			huff.val = ERR_OUT_OF_DATA;\
+			return huff;\
+		}\
+		huff.bits |= *huff.ptr++ << huff.num_bits;\
+		huff.num_bits += 8;\
+		REPORT("refill");\
+	}\
+} while (0)
+
+static struct huffman_state decode_lengths(struct huffman_state huff, const u8 *end, const u32 *table, u8 *lengths) {
+	u32 num_symbols = huff.val;
+	static const u8 rep_extra[3] = {2, 3, 7};
+	static const u8 rep_base[3] = {3, 3, 11};
+	enum {REP_SYM = 16};
+	for_range(sym, 0, num_symbols) {
+		REPORT("sym");
+		u32 entry = table[huff.bits & ((1 << PRECODE_TABLE_BITS) - 1)];
+		u32 len = entry & 15;
+		if (len > huff.num_bits) {
+			HUFF_REFILL(len);
+			entry = table[huff.bits & ((1 << PRECODE_TABLE_BITS) - 1)];
+			len = entry & 15;
+			HUFF_REFILL(len);
 		}
-		debug("code not assigned");
-		huff.ptr = 0;
-		huff.val = ERR_CODE_UNASSIGNED;
-		return huff;
-	} found:;
-	if (sym < huff.val) {
-		huff.val = sym;
-		return huff;
-	}
-	u32 idx = sym - huff.val;
-	u8 extra = extra_bit_table[idx];
-	u16 base = baseline_table[idx];
-	spew("sym%u extra%u base%u\n", sym, (unsigned)extra, (unsigned)base);
-	while (huff.num_bits < extra) {
-		if (huff.ptr >= end) {
+		if (unlikely((entry & ENTRY_TYPE_MASK) == ENTRY_INVALID)) {
 			huff.ptr = 0;
-			huff.val = ERR_OUT_OF_DATA;
+			huff.val = ERR_CODE_UNASSIGNED;
 			return huff;
 		}
-		huff.bits |= *huff.ptr++ << huff.num_bits;
-		huff.num_bits += 8;
-		REPORT("extra");
-	}
-	huff.val += base + (huff.bits & ((1 << extra) - 1));
-	SHIFT(extra);
-	spew("val%u\n", huff.val);
-	return huff;
-}
-
-static struct huffman_state decode_lengths(struct huffman_state huff, const u8 *end, u16 *dectable, u8 *lengths) {
-	u32 num_symbols = huff.val;
-	static const u8 clength_extra[3] = {2, 3, 7};
-	enum {REP_BASE = 16, FILL_BASE = REP_BASE + 4};
-	static const u16 clength_base[3] = {0, 4, 12};
-	for_range(sym, 0, num_symbols) {
-		huff.val = REP_BASE;
-		huff = huff_with_extra(huff, end, dectable, clength_extra, clength_base, 0, 0);
-		if (!huff.ptr) {return huff;}
-		u32 length_code = huff.val;
-		if (length_code < REP_BASE) {
+		SHIFT(len);
+		u32 length_code = ENTRY_PAYLOAD(entry);
+		if (length_code < REP_SYM) {
 			lengths[sym] = length_code;
 			debug("sym %u %c len %u\n", sym, (sym >= 0x20 && sym <= 0x7e ? (char) sym : '.'), length_code);
-		} else if (length_code < FILL_BASE) {
-			u32 rep = length_code - REP_BASE + 3;
+			continue;
+		}
+		u8 extra = rep_extra[length_code - REP_SYM];
+		HUFF_REFILL(extra);
+		u32 rep = rep_base[length_code - REP_SYM] + (huff.bits & ((1 << extra) - 1));
+		SHIFT(extra);
+		u32 rep_end = sym + rep;
+		if (length_code == REP_SYM) {
 			if (sym == 0) {
 				huff.val = ERR_FIRST_REP;
 				return huff;
 			}
-			u32 end = sym + rep;
-			if (end > num_symbols) {
+			if (rep_end > num_symbols) {
 				huff.val = ERR_REP_TOO_LONG;
 				return huff;
 			}
 			debug("rep %u\n", rep);
-			while (sym < end) {
+			while (sym < rep_end) {
 				lengths[sym] = lengths[sym - 1];
 				sym += 1;
 			}
-			sym -= 1;
 		} else {
-			u32 rep = length_code - FILL_BASE + 3;
-			u32 end = sym + rep;
-			if (end > num_symbols) {
+			if (rep_end > num_symbols) {
 				huff.val = ERR_FILL_TOO_LONG;
 				return huff;
 			}
 			debug("0fill %u\n", rep);
-			while (sym < end) {lengths[sym++] = 0;}
-			sym -= 1;
+			while (sym < rep_end) {lengths[sym++] = 0;}
 		}
+		sym -= 1;
 	}
 	huff.val = NO_ERROR;
 	return huff;
 }
 
-static const u8 lit_extra[21] = {
-	1, 1, 1, 1,
-	2, 2, 2, 2,
-	3, 3, 3, 3,
-	4, 4, 4, 4,
-	5, 5, 5, 5,
-	0
-};
-static const u8 dist_extra[26] = {
-	1, 1, 2, 2, 3, 3,
-	4, 4, 5, 5, 6, 6,
-	7, 7, 8, 8, 9, 9,
-	10, 10, 11, 11, 12, 12,
-	13, 13
-};
-
 enum {
 	FTEXT = 1,
 	FHCRC = 2,
@@ -319,19 +333,13 @@ static enum compr_probe_status probe(const u8 *in, const u8 *end, size_t UNUSED
 
 struct gzip_dec_state {
 	struct decompressor_state st;
-	u32 crc_table[256];
-
-	u32 crc;
 	u32 isize;
 	u8 skip_bits;
 	_Bool last_block;
-	u8 lit_lengths[286], dist_lengths[30];
-	u16 lit_codes[286], dist_codes[30];
-	u32 lit_overlength[286], dist_overlength[30];
-	u16 lit_oloff[5], dist_oloff[5];
-	u16 lit_base[21], dist_base[26];
+	u8 lit_lengths[288], dist_lengths[32];
+	u16 sorted_syms[288];
 
-	u16 dectable_dist[2048], dectable_lit[2048];
+	u32 lit_table[LIT_TABLE_SIZE], dist_table[DIST_TABLE_SIZE];
 };
 
 static size_t trailer(struct decompressor_state *state, const u8 *in, const u8 *end) {
@@ -342,9 +350,8 @@ static size_t trailer(struct decompressor_state *state, const u8 *in, const u8 *
 	if (st->skip_bits) {in += 1;}
 	if (unlikely(end - in < 8)) {return DECODE_NEED_MORE_DATA;}
 	u32 crc_read = in[0] | (u32)in[1] << 8 | (u32)in[2] << 16 | (u32)in[3] << 24;
-	u32 crc = st->crc ^ 0xffffffff;
-	check(crc_read == crc, "content CRC mismatch: read %08x, computed %08x\n", crc_read, crc);
-	info("CRC32: %08x\n", crc);
+	check(checksum_expect(&st->st.checksum, crc_read), "content CRC mismatch: read %08x, computed %08x\n", crc_read, checksum_value(&st->st.checksum));
+	info("CRC32: %08x%s\n", crc_read, st->st.checksum.deferred ? " (deferred)" : "");
 	in += 4;
 	u32 isize = in[0] | (u32)in[1] << 8 | (u32)in[2] << 16 | (u32)in[3] << 24;
 	in += 4;
@@ -369,27 +376,42 @@ static size_t raw_block(struct decompressor_state *state, const u8 *in, const u8
 	end = in + len;
 	u8 *out = st->st.out;
 	if (st->st.out_end - out < len) {return DECODE_NEED_MORE_SPACE;}
-	u32 crc = st->crc;
-	while (in < end) {
-		u8 c = *out++ = *in++;
-		crc = crc >> 8 ^ st->crc_table[(u8)crc ^ c];
-	}
+	memcpy(out, in, len);
+	checksum_decoded(&st->st.checksum, out, len);
 	st->st.decode = !st->last_block ?  block_start : trailer;
-	st->st.out = out;
-	st->crc = crc;
+	st->st.out = out + len;
 	st->isize += len;
 	return NUM_DECODE_STATUS + 4 + len;
 }
 
 #define REFILL_LOOP do {\
-	spew("0x%"PRIx32"/%"PRIu8" refill\n", bits, num_bits);\
+	spew("0x%"PRIx64"/%"PRIu8" refill\n", (u64)bits, num_bits);\
 	while (num_bits < GUARANTEED_BITS && ptr < end) {\
-		bits |= *ptr++ << num_bits;\
+		bits |= (bits_t)*ptr++ << num_bits;\
 		num_bits += 8;\
 	}\
-	spew("0x%"PRIx32"/%"PRIu8"\n", bits, num_bits);\
+	spew("0x%"PRIx64"/%"PRIu8"\n", (u64)bits, num_bits);\
+} while (0)
+#if !CONFIG_INFLATE_BITS32
+#if !CONFIG_NO_UNALIGNED
+/* branchless except for the check for the end of the input window, near which REFILL_LOOP takes over.
+ the load may put bits above num_bits that are already in the container, but they are the same bits */
+#define REFILL do {\
+	if (likely(end - ptr >= 8)) {\
+		bits |= ldle64u(ptr) << num_bits;\
+		ptr += (63 - num_bits) >> 3;\
+		num_bits |= 56;\
+	} else {\
+		REFILL_LOOP;\
+	}\
 } while (0)
-//#undef LDU32LEU_END
+#else
+#define REFILL REFILL_LOOP
+#endif
+/* length code + extra bits + distance code + extra bits */
+_Static_assert(GUARANTEED_BITS >= 15 + 5 + 15 + 13, "bit container too small for a whole match");
+#define REFILL_WITHIN_MATCH
+#else
 #ifdef LDU32LEU_END
 #define REFILL do {\
 	u8 read_bits = 32 - num_bits, read_bytes = read_bits / 8;\
@@ -404,6 +426,8 @@ static size_t raw_block(struct decompressor_state *state, const u8 *in, const u8
 #else
 #define REFILL REFILL_LOOP
 #endif
+#define REFILL_WITHIN_MATCH REFILL
+#endif
 
 static size_t huff_block(struct decompressor_state *state, const u8 *in, const u8 *end) {
 	struct gzip_dec_state *st = (struct gzip_dec_state *)state;
@@ -414,7 +438,7 @@ static size_t huff_block(struct decompressor_state *state, const u8 *in, const u
 	assert(num_bits < 8);
 	u8 *out = st->st.out, *out_start = out, *out_end = st->st.out_end;
 	const u8 *ptr_save;
-	u32 crc = st->crc, bits_save;
+	bits_t bits_save;
 	u8 num_bits_save;
 	size_t res;
 	REFILL_LOOP;
@@ -422,98 +446,68 @@ static size_t huff_block(struct decompressor_state *state, const u8 *in, const u
 	debug("huffman block\n");
 
 	while (1) {
-		spew("0x%"PRIx32"/%"PRIu8" %zu left\n", bits, num_bits, end - ptr);
+		spew("0x%"PRIx64"/%"PRIu8" %zu left\n", (u64)bits, num_bits, end - ptr);
 		ptr_save = ptr; bits_save = bits; num_bits_save = num_bits;
 		_Static_assert(GUARANTEED_BITS >= 15 + 5, "bits container too small");
-		u16 val = st->dectable_lit[bits & 0x7ff], len = val & 0xf;
-		u32 lit;
-		if (len > 11) {
-			len = 12;
-			while (1) {
-				if (unlikely(len > num_bits)) {
-					res = DECODE_NEED_MORE_DATA;
-					goto interrupted;
-				}
-				bits_t mask = ((bits_t)1 << len) - 1, suffix = bits & mask;
-				for_range(i, st->lit_oloff[len - 12], st->lit_oloff[len - 11]) {
-					u32 x = st->lit_overlength[i];
-					lit = x & 0x1ff;
-					if ((x >> 9) == suffix) {
-						goto found;
-					}
-				}
-				if (unlikely(++len == 4)) {return DECODE_ERR;}
-			}found:;
-		} else if (unlikely(len > num_bits)) {
+		u32 entry = st->lit_table[bits & ((1 << LIT_TABLE_BITS) - 1)];
+		if ((entry & ENTRY_TYPE_MASK) == ENTRY_SUBTABLE) {
+			entry = st->lit_table[ENTRY_PAYLOAD(entry) + (bits >> LIT_TABLE_BITS & ((1 << ENTRY_EXTRA(entry)) - 1))];
+		}
+		u32 len = entry & 15, type = entry & ENTRY_TYPE_MASK;
+		if (unlikely(len > num_bits)) {
 			res = DECODE_NEED_MORE_DATA;
 			goto interrupted;
-		} else {
-			lit = val >> 4;
 		}
-		bits >>= len; num_bits -= len;
-		if (lit < 256) {
-			spew("literal 0x%02x %c\n", lit, lit >= 0x20 && lit < 0x7f ? (char)lit : '.');
+		if (likely(type == ENTRY_2LITERALS)) {
+			if (unlikely(out_end - out < 2)) {
+				res = DECODE_NEED_MORE_SPACE;
+				goto interrupted;
+			}
+			bits >>= len; num_bits -= len;
+			u8 a = ENTRY_PAYLOAD(entry), b = ENTRY_PAYLOAD(entry) >> 8;
+			spew("literals 0x%02x 0x%02x\n", a, b);
+			out[0] = a;
+			out[1] = b;
+			out += 2;
+		} else if (type == ENTRY_LITERAL) {
 			if (unlikely(out >= out_end)) {
 				res = DECODE_NEED_MORE_SPACE;
 				goto interrupted;
 			}
+			bits >>= len; num_bits -= len;
+			u8 lit = ENTRY_PAYLOAD(entry);
+			spew("literal 0x%02x %c\n", lit, lit >= 0x20 && lit < 0x7f ? (char)lit : '.');
 			*out++ = lit;
-			crc = crc >> 8 ^ st->crc_table[(u8)crc ^ lit];
-		} else if (lit > 256) {
-			u32 length = lit - 257 + 3;
-			if (length >= 11) {	/* TODO: fold this into the decoding table */
-				u8 num_extra = lit_extra[length - 11];
-				u16 base = st->lit_base[length - 11];
-				spew("len%"PRIu16"+%"PRIu8"b ", base, num_extra);
-				length = base + (bits & ((1 << num_extra) - 1));
-				if (unlikely(num_extra > num_bits)) {
-					res = DECODE_NEED_MORE_DATA;
-					goto interrupted;
-				}
-				bits >>= num_extra; num_bits -= num_extra;
+		} else if (type == ENTRY_BASE) {
+			u32 num_extra = ENTRY_EXTRA(entry);
+			if (unlikely(len + num_extra > num_bits)) {
+				res = DECODE_NEED_MORE_DATA;
+				goto interrupted;
 			}
-			REFILL;
+			u32 length = ENTRY_PAYLOAD(entry) + (bits >> len & ((1 << num_extra) - 1));
+			bits >>= len + num_extra; num_bits -= len + num_extra;
+			REFILL_WITHIN_MATCH;
 
 			_Static_assert(GUARANTEED_BITS >= 15, "Bit container is not big enough");
-			u16 val = st->dectable_dist[bits & 0x7ff], len = val & 0xf;
-			u32 sym;
-			if (len > 11) {
-				len = 12;
-				while (1) {
-					if (unlikely(len > num_bits)) {
-						res = DECODE_NEED_MORE_DATA;
-						goto interrupted;
-					}
-					bits_t mask = ((bits_t)1 << len) - 1, suffix = bits & mask;
-					for_range(i, st->dist_oloff[len - 12], st->dist_oloff[len - 11]) {
-						u32 x = st->dist_overlength[i];
-						sym = x & 0x1ff;
-						if ((x >> 9) == suffix) {
-							goto found2;
-						}
-					}
-					if (unlikely(++len == 4)) {return DECODE_ERR;}
-				}found2:;
-			} else if (unlikely(len > num_bits)) {
+			entry = st->dist_table[bits & ((1 << DIST_TABLE_BITS) - 1)];
+			if ((entry & ENTRY_TYPE_MASK) == ENTRY_SUBTABLE) {
+				entry = st->dist_table[ENTRY_PAYLOAD(entry) + (bits >> DIST_TABLE_BITS & ((1 << ENTRY_EXTRA(entry)) - 1))];
+			}
+			len = entry & 15;
+			if (unlikely(len > num_bits)) {
 				res = DECODE_NEED_MORE_DATA;
 				goto interrupted;
-			} else {
-				sym = val >> 4;
 			}
+			check((entry & ENTRY_TYPE_MASK) == ENTRY_BASE, "unassigned distance code used\n");
 			bits >>= len; num_bits -= len;
-			u32 dist = sym + 1;
-			if (dist >= 5) {	/* TODO: fold this into the decoding table */
-				u8 num_extra = dist_extra[dist - 5];
-				u16 base = st->dist_base[dist - 5];
-				spew("dist%"PRIu16"+%"PRIu8"b ", base, num_extra);
-				REFILL;
-				dist = base + (bits & ((1 << num_extra) - 1));
-				if (unlikely(num_extra > num_bits)) {
-					res = DECODE_NEED_MORE_DATA;
-					goto interrupted;
-				}
-				bits >>= num_extra; num_bits -= num_extra;
+			num_extra = ENTRY_EXTRA(entry);
+			REFILL_WITHIN_MATCH;
+			if (unlikely(num_extra > num_bits)) {
+				res = DECODE_NEED_MORE_DATA;
+				goto interrupted;
 			}
+			u32 dist = ENTRY_PAYLOAD(entry) + (bits & ((1 << num_extra) - 1));
+			bits >>= num_extra; num_bits -= num_extra;
 			check(dist <= out - st->st.window_start, "match distance of %u beyond start of buffer", dist);
 			if (length >= 258) {
 				check(length != 258, "file used literal/length symbol 284 with 5 1-bits, which is specced invalid (without it being specially noted no less, WTF)\n");
@@ -524,20 +518,21 @@ static size_t huff_block(struct decompressor_state *state, const u8 *in, const u
 				res = DECODE_NEED_MORE_SPACE;
 				goto interrupted;
 			}
-			do {
-				u8 c = *out = *(out - dist);
-				out += 1;
-				crc = crc >> 8 ^ st->crc_table[(u8)crc ^ c];
-			} while (--length);
+			lzcommon_match_copy(out, dist, length);
+			out += length;
 			if (out - st->st.window_start > 100) {
 				spew("%.100s\n", out - 100);
 			} else {
 				spew("%.*s\n", (int)(out - st->st.window_start), st->st.window_start);
 			}
-		} else {
+		} else if (type == ENTRY_END) {
+			bits >>= len; num_bits -= len;
 			st->st.decode = !st->last_block ? block_start : trailer;
 			res = NUM_DECODE_STATUS + (ptr - in - (num_bits + 7) / 8);
 			goto end;
+		} else {
+			info("unassigned literal/length code used\n");
+			return DECODE_ERR;
 		}
 		REFILL;
 	}
@@ -545,7 +540,7 @@ static size_t huff_block(struct decompressor_state *state, const u8 *in, const u
 	ptr = ptr_save;
 	bits = bits_save;
 	num_bits = num_bits_save;
-	spew("0x%"PRIx32"/%"PRIu8" %zu left, interrupted %zu\n", bits_save, num_bits_save, end - ptr_save, res);
+	spew("0x%"PRIx64"/%"PRIu8" %zu left, interrupted %zu\n", (u64)bits_save, num_bits_save, end - ptr_save, res);
 	if (out > out_start) {
 		res = NUM_DECODE_STATUS + (ptr - in - (num_bits + 7) / 8);
 	}
@@ -553,7 +548,7 @@ static size_t huff_block(struct decompressor_state *state, const u8 *in, const u
 	st->skip_bits = (unsigned)(8 - num_bits) % 8;
 	st->st.out = out;
 	st->isize += out - out_start;
-	st->crc = crc;
+	checksum_decoded(&st->st.checksum, out_start, out - out_start);
 	if (out - st->st.window_start > 32768) {
 		st->st.window_start = out - 32768;
 	}
@@ -570,7 +565,7 @@ static size_t block_start(struct decompressor_state *state, const u8 *in, const
 	REFILL_LOOP;
 	debug("skip_bits%"PRIu8"\n", st->skip_bits);
 	bits >>= st->skip_bits; num_bits -= st->skip_bits;
-	debug("block header: 0x%"PRIx32"/%"PRIu8"\n", bits & ((1 << num_bits) - 1), num_bits);
+	debug("block header: 0x%"PRIx64"/%"PRIu8"\n", (u64)bits, num_bits);
 	_Static_assert(GUARANTEED_BITS >= 3, "bit container too small");
 	if (unlikely(num_bits < 3)) {return DECODE_NEED_MORE_DATA;}
 	u8 block_header = bits & 7;
@@ -586,7 +581,6 @@ static size_t block_start(struct decompressor_state *state, const u8 *in, const
 		u32 hlit, UNUSED hdist;
 		if ((block_header >> 1) == 2) {
 			u8 lengths2[19];
-			u16 length_codes[19];
 			debug("dynamic block\n");
 			REFILL;
 			_Static_assert(GUARANTEED_BITS >= 17, "bit container too small");
@@ -613,72 +607,40 @@ static size_t block_start(struct decompressor_state *state, const u8 *in, const
 				bits >>= 3; num_bits -= 3;
 			}
 			for_range(i, hclen, 19) {lengths2[hclen_order[i]] = 0;}
-			construct_codes(19, lengths2, length_codes);
-			for_array(i, length_codes) {
-				debug("code length code %u length: %u, code %x\n", i, (unsigned)lengths2[i], (unsigned)length_codes[i]);
-			}
-			construct_dectable(19, lengths2, length_codes, st->dectable_dist, st->dist_oloff, st->dist_overlength);
-			/*for (size_t i = 0; i < 512; i += 4) {
-				debug("%04x %04x %04x %04x\n", dectable_dist[i], dectable_dist[i+1], dectable_dist[i+2], dectable_dist[i+3]);
-			}*/
+			check(build_table(19, lengths2, precode_entry, st->dist_table, PRECODE_TABLE_BITS, DIST_TABLE_SIZE, st->sorted_syms), "invalid code length code\n");
 			struct huffman_state huff = {.bits = bits, .ptr = ptr, .num_bits = num_bits};
 			huff.val = hlit;
-			huff = decode_lengths(huff, end, st->dectable_dist, st->lit_lengths);
+			huff = decode_lengths(huff, end, st->dist_table, st->lit_lengths);
 			if (unlikely(!huff.ptr)) {return DECODE_NEED_MORE_DATA;}
 			check(huff.val == NO_ERROR, "%s", error_msg[huff.val]);
-			for_range(lit, hlit, 286) {st->lit_lengths[lit] = 0;}
+			for_range(lit, hlit, 288) {st->lit_lengths[lit] = 0;}
 			huff.val = hdist;
-			huff = decode_lengths(huff, end, st->dectable_dist, st->dist_lengths);
+			huff = decode_lengths(huff, end, st->dist_table, st->dist_lengths);
 			if (unlikely(!huff.ptr)) {return DECODE_NEED_MORE_DATA;}
 			check(huff.val == NO_ERROR, "%s\n", error_msg[huff.val]);
 			ptr = huff.ptr;
 			num_bits = huff.num_bits;
 			bits = huff.bits;
-			for_range(dist, hdist, 30) {st->dist_lengths[dist] = 0;}
-			construct_codes(286, st->lit_lengths, st->lit_codes);
-			construct_dectable(286, st->lit_lengths, st->lit_codes, st->dectable_lit, st->lit_oloff, st->lit_overlength);
-			construct_codes(30, st->dist_lengths, st->dist_codes);
-			construct_dectable(30, st->dist_lengths, st->dist_codes, st->dectable_dist, st->dist_oloff, st->dist_overlength);
+			for_range(dist, hdist, 32) {st->dist_lengths[dist] = 0;}
+			check(st->lit_lengths[256] != 0, "no end-of-block code\n");
 		} else {
 			info("fixed huffman block\n");
-			static const u8 bitrev_nibble[16] = {
-				0x0, 0x8, 0x4, 0xc,
-				0x2, 0xa, 0x6, 0xe,
-				0x1, 0x9, 0x5, 0xd,
-				0x3, 0xb, 0x7, 0xf,
-			};
-			for_range(i, 0, 512) {
-				u16 rev = (i << 8 & 0x100) | bitrev_nibble[i >> 1 & 15] << 4 | bitrev_nibble[i >> 5 & 15];
-				u16 val = rev < 0x5f ? ((rev >> 2) + 256) << 4 | 7
-					: rev < 0x17f ? ((rev >> 1) - 0x30) << 4 | 8
-					: rev < 0x18b ? ((rev >> 1) - 0xc0 + 280) << 4 | 8
-					: rev < 0x18f ? 10
-					: (rev - 0x190 + 144) << 4 | 9;
-				st->dectable_lit[i] = st->dectable_lit[i + 512] = val;
-				st->dectable_lit[i + 1024] = st->dectable_lit[i + 1536] = val;
-			}
-			for_array(i, st->lit_oloff) {st->lit_oloff[i] = 0;}
-			assert(st->dectable_lit[0] == 0x1007);
-			assert(st->dectable_lit[0xc] == 0x8);
-			info("%x\n", (unsigned)st->dectable_lit[3]);
-			assert(st->dectable_lit[0x3] == (280 << 4 | 8));
-			assert(st->dectable_lit[0x13] == 0x909);
-
-			for_range(i, 0, 512) {
-				u16 rev = (i << 4 & 0x10) | bitrev_nibble[i >> 1 & 15];
-				u16 val = rev < 30 ? rev << 4 | 5 : 10;
-				st->dectable_dist[i] = st->dectable_dist[i + 512] = val;
-				st->dectable_dist[i + 1024] = st->dectable_dist[i + 1536] = val;
-			}
-			for_array(i, st->dist_oloff) {st->dist_oloff[i] = 0;}
+			for_range(i, 0, 144) {st->lit_lengths[i] = 8;}
+			for_range(i, 144, 256) {st->lit_lengths[i] = 9;}
+			for_range(i, 256, 280) {st->lit_lengths[i] = 7;}
+			for_range(i, 280, 288) {st->lit_lengths[i] = 8;}
+			for_range(i, 0, 32) {st->dist_lengths[i] = 5;}
 		}
+		check(build_table(288, st->lit_lengths, lit_entry, st->lit_table, LIT_TABLE_BITS, LIT_TABLE_SIZE, st->sorted_syms), "invalid literal/length code\n");
+		pair_literals(st->lit_table, LIT_TABLE_BITS);
+		check(build_table(32, st->dist_lengths, dist_entry, st->dist_table, DIST_TABLE_BITS, DIST_TABLE_SIZE, st->sorted_syms), "invalid distance code\n");
 		st->st.decode = huff_block;
 		st->skip_bits = (unsigned)(8 - num_bits) % 8;
-		for (size_t i = 0; i < 2048; i += 4) {
-			spew("%4zu: %04"PRIx16" %04"PRIx16" %04"PRIx16" %04"PRIx16"\n",
+		for (size_t i = 0; i < 1 << LIT_TABLE_BITS; i += 4) {
+			spew("%4zu: %08"PRIx32" %08"PRIx32" %08"PRIx32" %08"PRIx32"\n",
 				i,
-				st->dectable_lit[i], st->dectable_lit[i + 1],
-				st->dectable_lit[i + 2], st->dectable_lit[i + 3]
+				st->lit_table[i], st->lit_table[i + 1],
+				st->lit_table[i + 2], st->lit_table[i + 3]
 			);
 		}
 		return NUM_DECODE_STATUS + (ptr - in - (num_bits + 7) / 8);
@@ -688,10 +650,6 @@ static size_t block_start(struct decompressor_state *state, const u8 *in, const
 static const u8 *init(struct decompressor_state *state, const u8 *in, const u8 *end) {
 	assert(end - in >= 18);
 	struct gzip_dec_state *st = (struct gzip_dec_state *)state;
-	u32 poly = 0xedb88320;
-	for_array(i, st->crc_table) {
-		st->crc_table[i] = crc32_byte(i, poly);
-	}
 	u8 flags = in[3];
 	info("decompressing gzip, flags: 0x%x\n", (unsigned)flags);
 	const u8 *content = in + 10;
@@ -716,32 +674,15 @@ static const u8 *init(struct decompressor_state *state, const u8 *in, const u8 *
 	if (flags & FHCRC) {
 		check(end - content >= 2, "input not long enough for header CRC\n");
 		u16 hcrc = content[0] | (u16)content[1] << 8;
-		const u8 *ptr = in;
-		u32 hcrc_comp = ~(u32)0;
-		do {
-			hcrc_comp = hcrc_comp >> 8 ^ st->crc_table[(u8)hcrc_comp ^ *ptr];
-		} while (++ptr < content);
+		u32 hcrc_comp = crc32_update(~(u32)0, in, content - in);
 		check((u16)hcrc_comp == hcrc, "header CRC mismatch, read %04x, computed %04x\n", (unsigned)hcrc, (unsigned)(u16)hcrc_comp);
 		content += 2;
 	}
 	check(end - content > 8, "gzip input not long enough (%zu (%zx) bytes after header) for compressed stream and trailer\n", end - content, end - content);
-	u16 base = 11;
-	debug("lit_base: ");
-	for_array(i, st->lit_base) {
-		debug(" %"PRIu16, base + 11);
-		st->lit_base[i] = base;
-		base += 1 << lit_extra[i];
-	}
-	debug("\n");
-	base = 5;
-	for_array(i, st->dist_base) {
-		st->dist_base[i] = base;
-		base += 1 << dist_extra[i];
-	}
 	st->skip_bits = 0;
 	st->last_block = 0;
 	st->isize = 0;
-	st->crc = ~(u32)0;
+	checksum_init(&st->st.checksum, CHECKSUM_CRC32);
 	st->st.decode = block_start;
 	return content;
 }
@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#define _POSIX_C_SOURCE 200809L
+#include "../include/defs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#undef NDEBUG
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include "compression.h"
+
+/* reads a gzip file on stdin and decodes it repeatedly with the 64-bit and the old 32-bit bit reader (inflate.c built with CONFIG_INFLATE_BITS32), printing the best throughput of each.
+usage: inflatebench [runs] [input window size] */
+
+extern const struct decompressor gzip_decompressor, gzip32_decompressor;
+
+static const struct {const char *name; const struct decompressor *decomp;} readers[] = {
+	{"64-bit", &gzip_decompressor},
+	{"32-bit", &gzip32_decompressor},
+};
+
+static u8 *read_file(int fd, size_t *size) {
+	size_t buf_size = 0, buf_cap = 128;
+	u8 *buf = malloc(buf_cap);
+	assert(buf);
+	while (1) {
+		if (buf_cap - buf_size < 128) {
+			buf = realloc(buf, buf_cap *= 2);
+			assert(buf);
+		}
+		ssize_t res = read(fd, buf + buf_size, buf_cap - buf_size);
+		if (res > 0) {
+			buf_size += res;
+		} else if (!res) {
+			break;
+		} else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("While reading input");
+			return 0;
+		}
+	}
+	*size = buf_size;
+	return buf;
+}
+
+/* decodes the whole stream, handing the decoder at most `window` bytes of input at a time. returns the decompressed size */
+static size_t decode(const struct decompressor *decomp, struct decompressor_state *state, const u8 *in, const u8 *end, size_t window, u8 *out, size_t out_size) {
+	const u8 *ptr = decomp->init(state, in, end);
+	assert(ptr);
+	state->out = state->window_start = out;
+	state->out_end = out + out_size;
+	_Bool unlimit = 0;
+	while (state->decode) {
+		const u8 *limit = !unlimit && end - ptr > window ? ptr + window : end;
+		unlimit = 0;
+		size_t res = state->decode(state, ptr, limit);
+		if (res == DECODE_NEED_MORE_DATA && limit != end) {
+			unlimit = 1;
+			continue;
+		}
+		if (res < NUM_DECODE_STATUS) {
+			fprintf(stderr, "decoding failed with status %zu\n", res);
+			exit(1);
+		}
+		ptr += res - NUM_DECODE_STATUS;
+	}
+	return state->out - out;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+	u32 runs = argc > 1 ? atoi(argv[1]) : 10;
+	size_t window = argc > 2 ? strtoul(argv[2], 0, 0) : SIZE_MAX;
+	assert(runs > 0 && window > 0);
+	size_t in_size, size;
+	u8 *in = read_file(0, &in_size);
+	assert(in);
+	enum compr_probe_status status = gzip_decompressor.probe(in, in + in_size, &size);
+	if (status > COMPR_PROBE_LAST_SUCCESS) {
+		fprintf(stderr, "input is not a usable gzip file (probe status %u)\n", (unsigned)status);
+		return 1;
+	}
+	if (status == COMPR_PROBE_SIZE_UNKNOWN) {size = (64 << 20) - LZCOMMON_BLOCK;}
+	u8 *ref = 0;
+	for_array(r, readers) {
+		const struct decompressor *decomp = readers[r].decomp;
+		struct decompressor_state *state = malloc(decomp->state_size);
+		u8 *out = malloc(size + 2 * LZCOMMON_BLOCK);
+		assert(state && out);
+		double best = 1e30;
+		size_t out_size = 0;
+		for_range(i, 0, runs) {
+			double start = now();
+			out_size = decode(decomp, state, in, in + in_size, window, out, size + LZCOMMON_BLOCK);
+			double t = now() - start;
+			if (t < best) {best = t;}
+		}
+		if (!ref) {
+			ref = out;
+			size = out_size;
+		} else if (out_size != size || memcmp(out, ref, size)) {
+			fprintf(stderr, "%s reader output differs\n", readers[r].name);
+			return 1;
+		}
+		printf("%s reader: %zu → %zu bytes, best of %"PRIu32": %.3f ms, %.1f MB/s\n", readers[r].name, in_size, out_size, runs, best * 1e3, out_size / best / 1e6);
+		free(state);
+		if (out != ref) {free(out);}
+	}
+	return 0;
+}
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <string.h>
 
 #ifndef TINY
 #define check(expr, ...) if (unlikely(!(expr))) {info(__VA_ARGS__);return 0;}
@@ -21,6 +22,42 @@ enum {
 	FDICTID = 1,
 };
 
+/* headroom required by decode_fast_sequences: a sequence with short literal and match lengths reads at most 17 input bytes and writes at most 46 output bytes, and the input may not run into the last 6 bytes of the block (which must be literals) */
+enum {FAST_IN_MARGIN = 32, FAST_OUT_MARGIN = 48};
+
+/* decodes sequences while there is enough headroom to do so with fixed-size copies and without bounds checks.
+returns 0 on a decoding error, otherwise leaves *in and *out at the first sequence that has to go through the careful path in decompress_block */
+static _Bool decode_fast_sequences(const u8 **in_ptr, const u8 *end, u8 **out_ptr, u8 *out_end, const u8 *window_start) {
+	const u8 *in = *in_ptr;
+	u8 *out = *out_ptr;
+	while (likely(end - in >= FAST_IN_MARGIN && out_end - out >= FAST_OUT_MARGIN)) {
+		u8 token = *in;
+		u32 copy = token >> 4, length = token & 15;
+		if (unlikely(copy == 15 || length == 15)) {break;}
+		memcpy(out, in + 1, 16);
+		in += 1 + copy; out += copy;
+		u16 dist = in[0] | (u16)in[1] << 8;
+		in += 2;
+		check(dist != 0 && dist <= out - window_start, "invalid match distance %"PRIu16"\n", dist);
+		length += 4;
+		const u8 *match = out - dist;
+		if (likely(dist >= 16)) {
+			memcpy(out, match, 16);
+			if (length > 16) {memcpy(out + 16, match + 16, 16);}
+		} else if (dist >= 8) {
+			memcpy(out, match, 8);
+			memcpy(out + 8, match + 8, 8);
+			if (length > 16) {memcpy(out + 16, match + 16, 8);}
+		} else {
+			lzcommon_match_copy(out, dist, length);
+		}
+		out += length;
+	}
+	*in_ptr = in;
+	*out_ptr = out;
+	return 1;
+}
+
 static u8 *decompress_block(const u8 *in, const u8 *end, u8 *out, u8 *out_end, u8 *window_start) {
 	assert(out_end - out <= ((u32)1 << 31)); /* don't want to have to check match length for overflow */
 	check(in < end, "need at least one token byte\n");
@@ -34,6 +71,7 @@ static u8 *decompress_block(const u8 *in, const u8 *end, u8 *out, u8 *out_end, u
 	}
 	const u8 *max_final_block_start = end - 6;
 	while (1) {
+		if (!decode_fast_sequences(&in, end, &out, out_end, window_start)) {return 0;}
 		assert(in <= max_final_block_start);
 		assert(out_end - out >= 5);
 
@@ -142,7 +180,7 @@ static size_t decode_trailer(struct decompressor_state *state,  const u8 *in,  c
 	struct lz4_dec_state *st = (struct lz4_dec_state *)state;
 	st->st.decode = 0;
 	if (st->flags & FCCHECKSUM) {
-		check(end - in >= 4, "not enough data for content checksum\n");
+		if (unlikely(end - in < 4)) {return DECODE_NEED_MORE_DATA;}
 		/* FIXME: implement */
 		return NUM_DECODE_STATUS + 4;
 	}
@@ -151,7 +189,7 @@ static size_t decode_trailer(struct decompressor_state *state,  const u8 *in,  c
 
 static size_t decode_block(struct decompressor_state *state,  const u8 *in,  const u8 *end) {
 	struct lz4_dec_state *st = (struct lz4_dec_state *)state;
-	check(end - in >= 4, "not enough data for block size field\n");
+	if (unlikely(end - in < 4)) {return DECODE_NEED_MORE_DATA;}
 	u32 block_size = in[0] | (u32)in[1] << 8 | (u32)in[2] << 16 | (u32)in[3] << 24;
 	in += 4;
 	u32 actual_block_size = block_size & 0x7fffffff;
@@ -187,6 +225,8 @@ static const u8 *init(struct decompressor_state *state, const u8 *in, const u8 *
 	(void)end;
 	assert(end - in >= 7);
 	struct lz4_dec_state *st = (struct lz4_dec_state *)state;
+	/* the content checksum is XXH32, which is not implemented */
+	checksum_init(&st->st.checksum, CHECKSUM_NONE);
 	st->flags = in[4];
 	u8 bd = in[5];
 	info("decompressing LZ4, flags=0x%"PRIx8", bd=%"PRIx8"\n", st->flags, bd);
@@ -198,8 +238,32 @@ static const u8 *init(struct decompressor_state *state, const u8 *in, const u8 *
 	return in + 7;
 }
 
+static size_t frame_size(const u8 *in, const u8 *end) {
+	const u8 *start = in;
+	if (end - in < 7) {return DECODE_NEED_MORE_DATA;}
+	u8 flags = in[4];
+	size_t header_size = flags & FCSIZE ? 15 : 7;
+	if ((size_t)(end - in) < header_size) {return DECODE_NEED_MORE_DATA;}
+	in += header_size;
+	while (1) {
+		if (end - in < 4) {return DECODE_NEED_MORE_DATA;}
+		u32 block_size = (in[0] | (u32)in[1] << 8 | (u32)in[2] << 16 | (u32)in[3] << 24) & 0x7fffffff;
+		in += 4;
+		if (block_size == 0) {break;}
+		if (flags & FBCHECKSUM) {block_size += 4;}
+		if ((size_t)(end - in) < block_size) {return DECODE_NEED_MORE_DATA;}
+		in += block_size;
+	}
+	if (flags & FCCHECKSUM) {
+		if (end - in < 4) {return DECODE_NEED_MORE_DATA;}
+		in += 4;
+	}
+	return NUM_DECODE_STATUS + (in - start);
+}
+
 const struct decompressor lz4_decompressor = {
 	.probe = probe,
 	.state_size = sizeof(struct decompressor_state),
 	.init = init,
+	.frame_size = frame_size,
 };
@@ -8,6 +8,7 @@
 
 #define debug(...) /*fprintf(stderr, __VA_ARGS__)*/
 
+#if !CONFIG_LZCOMMON_NEON
 /* assumes that length >= 8.
 always copies front-to-back with aligned 8-byte accesses, which makes it a suitable lzcommon_match_copy for distance >= 8 */
 static void copy(u8 *dest, const u8 *src, u32 length) {
@@ -145,3 +146,4 @@ void lzcommon_match_copy(u8 *dest, u32 dist, u32 length) {
 		while (length--) {*dest++ = *src++;}
 	}
 }
+#endif
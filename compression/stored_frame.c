@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include "compression.h"
+
+static u32 read_le32(const u8 *in) {
+	return in[0] | (u32)in[1] << 8 | (u32)in[2] << 16 | (u32)in[3] << 24;
+}
+
+enum compr_probe_status stored_frame_probe(const u8 *in, const u8 *end, size_t *data_offset, size_t *size) {
+	if (end - in < 4) {return COMPR_PROBE_NOT_ENOUGH_DATA;}
+	if (read_le32(in) != STORED_FRAME_MAGIC) {return COMPR_PROBE_WRONG_MAGIC;}
+	if (end - in < STORED_FRAME_HEADER_SIZE) {return COMPR_PROBE_NOT_ENOUGH_DATA;}
+	if (read_le32(in + 8) != STORED_FRAME_TAG) {return COMPR_PROBE_WRONG_MAGIC;}
+	u64 frame_end = (u64)read_le32(in + 4) + 8;
+	u32 offset = read_le32(in + 12);
+	if (offset < STORED_FRAME_HEADER_SIZE || offset > frame_end) {return COMPR_PROBE_RESERVED_FEATURE;}
+	*data_offset = offset;
+	*size = frame_end - offset;
+	return COMPR_PROBE_SIZE_KNOWN;
+}
@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include "../include/defs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#undef NDEBUG
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include "compression.h"
+
+/* reads an uncompressed payload component on stdin and writes it to stdout as a stored frame.
+usage: storeframe [offset [alignment]]
+
+offset is the position the frame will have in the payload partition (i. e. the total size of the components before it), alignment defaults to 4096. the data is padded to start on an aligned position, so it can be DMA'd straight to its destination if the block size divides the alignment. */
+
+static u8 *read_file(int fd, size_t *size) {
+	size_t buf_size = 0, buf_cap = 128;
+	u8 *buf = malloc(buf_cap);
+	assert(buf);
+	while (1) {
+		if (buf_cap - buf_size < 128) {
+			buf = realloc(buf, buf_cap *= 2);
+			assert(buf);
+		}
+		ssize_t res = read(fd, buf + buf_size, buf_cap - buf_size);
+		if (res > 0) {
+			buf_size += res;
+		} else if (!res) {
+			break;
+		} else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("While reading input");
+			return 0;
+		}
+	}
+	*size = buf_size;
+	return buf;
+}
+
+static void write_buf(int fd, const u8 *buf, size_t size) {
+	const u8 *end = buf + size;
+	while (buf < end) {
+		ssize_t res = write(fd, buf, end - buf);
+		if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("While writing output");
+			exit(1);
+		}
+		if (res > 0) {buf += res;}
+	}
+}
+
+static void write_le32(u8 *out, u32 val) {
+	for_range(i, 0, 4) {out[i] = val >> (8 * i);}
+}
+
+int main(int argc, char **argv) {
+	if (argc > 3) {
+		fprintf(stderr, "usage: %s [offset [alignment]]\n", argv[0]);
+		return 1;
+	}
+	u64 offset = argc > 1 ? strtoull(argv[1], 0, 0) : 0;
+	u64 align = argc > 2 ? strtoull(argv[2], 0, 0) : 4096;
+	if (!align || align > 1 << 20) {
+		fprintf(stderr, "alignment must be between 1 and 1 MiB\n");
+		return 1;
+	}
+	size_t size;
+	u8 *buf = read_file(0, &size);
+	assert(buf);
+	u64 data_offset = STORED_FRAME_HEADER_SIZE;
+	data_offset += (align - (offset + data_offset) % align) % align;
+	if (data_offset + size - 8 > UINT32_MAX) {
+		fprintf(stderr, "input is too large\n");
+		return 1;
+	}
+	u8 *header = calloc(data_offset, 1);
+	assert(header);
+	write_le32(header, STORED_FRAME_MAGIC);
+	write_le32(header + 4, data_offset + size - 8);
+	write_le32(header + 8, STORED_FRAME_TAG);
+	write_le32(header + 12, data_offset);
+	size_t check_offset, check_size;
+	assert(stored_frame_probe(header, header + data_offset, &check_offset, &check_size) == COMPR_PROBE_SIZE_KNOWN && check_offset == data_offset && check_size == size);
+	write_buf(1, header, data_offset);
+	write_buf(1, buf, size);
+	return 0;
+}
@@ -5,7 +5,6 @@
 #include <assert.h>
 #include <string.h>
 #include "compression.h"
-#include "arch_mem_access.h"
 
 /*
 short decoding table format:
@@ -285,112 +284,24 @@ static enum compr_probe_status probe(const u8 *in, const u8 *end, size_t *size)
 	}
 }
 
-struct xxh64_state {
-	u64 buf[4];
-	u64 state[4];
-	u64 len;
-	u8 offset;
-	_Bool long_hash;
-};
-
 struct zstd_dec_state {
 	struct decompressor_state st;
 	struct dectables tables;
-	struct xxh64_state xxh64;
 	u64 window_size;
 	_Bool have_content_checksum;
 };
 
-#define XXH64_SEED 0
-
-#define U64(x) x##ull
-static const u64 xxh64_primes[5] = {
-	U64(11400714785074694791),
-	U64(14029467366897019727),
-	U64(1609587929392839161),
-	U64(9650029242287828579),
-	U64(2870177450012600261)
-};
-
-static u64 xxh64_step(u64 state) {
-	return (state << 31 | state >> 33) * xxh64_primes[0];
-}
-
-static u64 xxh64_shuffle(u64 val) {
-	return xxh64_step(val * xxh64_primes[1]);
-}
-
-static u64 xxh64_round(u64 state, u64 val) {
-	return xxh64_step(state + (val * xxh64_primes[1]));
-}
-
-static u64 xxh64_mergestep(u64 state) {
-	return state * xxh64_primes[0] + xxh64_primes[3];
-}
-
-static u64 xxh64_merge(u64 state, u64 val) {
-	return xxh64_mergestep(state ^ xxh64_shuffle(val));
-}
-
-static u64 xxh64_finalize(const struct xxh64_state *state) {
-	u64 xxh64 = XXH64_SEED + xxh64_primes[4];
-	if (state->long_hash) {
-		debug("xxh64 merge\n");
-		u64 a, b, c, d;
-		a = state->state[0];
-		b = state->state[1];
-		c = state->state[2];
-		d = state->state[3];
-		xxh64 = (a << 1 | a >> 63) + (b << 7 | b >> 57) + (c << 12 | c >> 52) + (d << 18 | d >> 46);
-		xxh64 = xxh64_merge(xxh64, a);
-		xxh64 = xxh64_merge(xxh64, b);
-		xxh64 = xxh64_merge(xxh64, c);
-		xxh64 = xxh64_merge(xxh64, d);
-	}
-	xxh64 += state->len;
-	u8 single_rounds = state->offset >> 3;
-	assert(single_rounds < 4);
-	const u8 *ptr = (const u8 *)state->buf;
-	for (int i = 0; i < single_rounds; ++i) {
-		u64 dw = ldle64a(state->buf + i);
-		debug("xxh64 8byte: 0x%"PRIx64"\n", dw);
-		xxh64 ^= xxh64_shuffle(dw);
-		ptr += 8;
-		xxh64 = xxh64_mergestep(xxh64 << 27 | xxh64 >> 37);
-	}
-	if (state->offset & 4) {
-		u32 w = (u32)ptr[0] | (u32)ptr[1] << 8 | (u32)ptr[2] << 16 | (u32)ptr[3] << 24;
-		debug("xxh64 4byte: 0x%"PRIx32"\n", w);
-		xxh64 ^= w * xxh64_primes[0];
-		ptr += 4;
-		xxh64 = (xxh64 << 23 | xxh64 >> 41) * xxh64_primes[1] + xxh64_primes[2];
-	}
-	u8 byte_rounds = state->offset & 3;
-	while (byte_rounds--) {
-		debug("xxh64 one byte: 0x%"PRIx8"\n", *ptr);
-		xxh64 ^= *ptr++ * xxh64_primes[4];
-		xxh64 = (xxh64 << 11 | xxh64 >> 53) * xxh64_primes[0];
-	}
-	xxh64 ^= xxh64 >> 33;
-	xxh64 *= xxh64_primes[1];
-	xxh64 ^= xxh64 >> 29;
-	xxh64 *= xxh64_primes[2];
-	xxh64 ^= xxh64 >> 32;
-	return xxh64;
-}
-
 static size_t decode_trailer(struct decompressor_state *state, const u8 *in, const u8 *end) {
 	struct zstd_dec_state *st = (struct zstd_dec_state *)state;
 	st->st.decode = 0;
 	if (st->have_content_checksum) {
 		if (end - in < 4) {return DECODE_NEED_MORE_DATA;}
-		u64 xxh64 = xxh64_finalize(&st->xxh64);
 		u32 csum = in[0] | (u32)in[1] << 8 | (u32)in[2] << 16 | (u32)in[3] << 24;
-		if (unlikely((xxh64 & 0xffffffff) != csum)) {
-			info("checksum mismatch: read %"PRIx32", computed %"PRIx64"\n", csum, xxh64);
+		if (unlikely(!checksum_expect(&st->st.checksum, csum))) {
+			info("checksum mismatch: read %"PRIx32", computed %"PRIx32"\n", csum, checksum_value(&st->st.checksum));
 			return DECODE_ERR;
 		}
-		info("XXH64: %"PRIx64"\n", xxh64);
+		info("XXH64: %"PRIx32"%s\n", csum, st->st.checksum.deferred ? " (deferred)" : "");
 		return NUM_DECODE_STATUS + 4;
 	} else {
 		info("no checksum\n");
@@ -398,49 +309,6 @@ static size_t decode_trailer(struct decompressor_state *state, const u8 *in, con
 	return NUM_DECODE_STATUS;
 }
 
-static void xxh64_update(struct xxh64_state *state, const u8 *buf, size_t size) {
-	state->len += size;
-	u8 xxh_offset = state->offset;
-	if (size <= 32 && xxh_offset + size < 32) {
-		memcpy((u8 *)state->buf + xxh_offset, buf, size);
-		state->offset = xxh_offset + size;
-	} else {
-		u8 fillup = 32 - xxh_offset;
-		assert(size >= fillup);
-		memcpy((u8 *)state->buf + xxh_offset, buf, fillup);
-		size -= fillup;
-		buf += fillup;
-		state->state[0] = xxh64_round(state->state[0], ldle64a(state->buf));
-		state->state[1] = xxh64_round(state->state[1], ldle64a(state->buf + 1));
-		state->state[2] = xxh64_round(state->state[2], ldle64a(state->buf + 2));
-		state->state[3] = xxh64_round(state->state[3], ldle64a(state->buf + 3));
-		state->long_hash = 1;
-		while (size >= 32) {
-			u64 a, b, c, d;
-#ifdef LDLE64U
-			LDLE64U(buf, a); buf += 8;
-			LDLE64U(buf, b); buf += 8;
-			LDLE64U(buf, c); buf += 8;
-			LDLE64U(buf, d); buf += 8;
-#else
-			memcpy(state->buf, buf, 32);
-			buf += 32;
-			a = ldle64a(state->buf);
-			b = ldle64a(state->buf + 1);
-			c = ldle64a(state->buf + 2);
-			d = ldle64a(state->buf + 3);
-#endif
-			size -= 32;
-			state->state[0] = xxh64_round(state->state[0], a);
-			state->state[1] = xxh64_round(state->state[1], b);
-			state->state[2] = xxh64_round(state->state[2], c);
-			state->state[3] = xxh64_round(state->state[3], d);
-		}
-		memcpy(state->buf, buf, size);
-		state->offset = size;
-	}
-}
-
 static size_t decode_block(struct decompressor_state *state, const u8 *in, const u8 *end) {
 	struct zstd_dec_state *st = (struct zstd_dec_state *)state;
 	if (unlikely(end - in < 3)) {return DECODE_NEED_MORE_DATA;}
@@ -483,9 +351,7 @@ static size_t decode_block(struct decompressor_state *state, const u8 *in, const
 		info("reserved block type used\n");
 		return DECODE_ERR;
 	}
-	if (st->have_content_checksum) {
-		xxh64_update(&st->xxh64, out, decomp_size);
-	}
+	checksum_decoded(&st->st.checksum, out, decomp_size);
 	out += decomp_size;
 	st->st.out = out;
 	if ((size_t)(out - st->st.window_start) > st->window_size) {
@@ -495,16 +361,6 @@ static size_t decode_block(struct decompressor_state *state, const u8 *in, const
 	return NUM_DECODE_STATUS + total_size;
 }
 
-static void xxh64_init(struct xxh64_state *state) {
-	state->offset = 0;
-	state->len = 0;
-	state->long_hash = 0;
-	state->state[0] = XXH64_SEED + xxh64_primes[0] + xxh64_primes[1];
-	state->state[1] = XXH64_SEED + xxh64_primes[1];
-	state->state[2] = XXH64_SEED;
-	state->state[3] = XXH64_SEED - xxh64_primes[0];
-}
-
 static const u8 *init(struct decompressor_state *state, const u8 *in, const u8 *end) {
     (void)end;
 	struct zstd_dec_state *st = (struct zstd_dec_state *)state;
@@ -550,12 +406,46 @@ static const u8 *init(struct decompressor_state *state, const u8 *in, const u8 *
 	st->tables.dist1 = 1; st->tables.dist2 = 4; st->tables.dist3 = 8;
 	st->st.decode = decode_block;
 	st->have_content_checksum = !!(frame_header_desc & Content_Checksum_Flag);
-	xxh64_init(&st->xxh64);
+	checksum_init(&st->st.checksum, st->have_content_checksum ? CHECKSUM_XXH64 : CHECKSUM_NONE);
 	return in;
 }
 
+static size_t frame_size(const u8 *in, const u8 *end) {
+	const u8 *start = in;
+	if (end - in < 5) {return DECODE_NEED_MORE_DATA;}
+	u8 frame_header_desc = in[4];
+	u8 fcs_field_size = frame_header_desc >> 6;
+	if ((frame_header_desc & Single_Segment_Flag) || fcs_field_size != 0) {
+		fcs_field_size = 1 << fcs_field_size;
+	}
+	size_t header_size = 5 + fcs_field_size + !(frame_header_desc & Single_Segment_Flag);
+	if ((size_t)(end - in) < header_size) {return DECODE_NEED_MORE_DATA;}
+	in += header_size;
+	_Bool last_block;
+	do {
+		if (end - in < 3) {return DECODE_NEED_MORE_DATA;}
+		u8 block_header0 = *in;
+		last_block = block_header0 & 1;
+		u32 block_size = block_header0 >> 3 | (u32)in[1] << 5 | (u32)in[2] << 13;
+		in += 3;
+		switch (block_header0 >> 1 & 3) {
+		case RLE_Block: block_size = 1; break;
+		case Raw_Block: case Compressed_Block: break;
+		default: return DECODE_ERR;
+		}
+		if ((size_t)(end - in) < block_size) {return DECODE_NEED_MORE_DATA;}
+		in += block_size;
+	} while (!last_block);
+	if (frame_header_desc & Content_Checksum_Flag) {
+		if (end - in < 4) {return DECODE_NEED_MORE_DATA;}
+		in += 4;
+	}
+	return NUM_DECODE_STATUS + (in - start);
+}
+
 const struct decompressor zstd_decompressor = {
 	.probe = probe,
 	.state_size = sizeof(struct zstd_dec_state),
-	.init = init
+	.init = init,
+	.frame_size = frame_size
 };
@@ -59,6 +59,8 @@ flags.update({
         '-DCONFIG_CONSOLE_FIFO_DEPTH=64',
     ],
     'lib/uart': ['-DCONFIG_BUF_SIZE=128'],
+    'dramstage/blk_nvme': ['-DCONFIG_NVME_QUEUE_DEPTH=4'],
+    'compression/lzcommon': ['-DCONFIG_LZCOMMON_NEON=1'],
     'aarch64/mmu_asm': ['-DASSERTIONS=1', '-DDEV_ASSERTIONS=0']
 })
 for x in ('entry-ret2brom', 'entry-first'):
@@ -155,6 +157,44 @@ parser.add_argument(
     dest='spew',
     help='modules to select debug verbosity for (comma-separated)'
 )
+parser.add_argument(
+    '--binlog',
+    action='store',
+    type=str,
+    dest='binlog',
+    help='dramstage modules whose log messages go to the binary log instead of the console (comma-separated)'
+)
+parser.add_argument(
+    '--spi-irq',
+    action='store_true',
+    dest='spi_irq',
+    help='read SPI payloads by interrupt instead of DMA'
+)
+parser.add_argument(
+    '--boot-arbitration',
+    action='store_true',
+    dest='boot_arbitration',
+    help='load from all boot media concurrently instead of one after the other'
+)
+parser.add_argument(
+    '--boot-hint',
+    action='store_true',
+    dest='boot_hint',
+    help='remember the last boot medium in SPI flash and cue it first on the next boot'
+)
+parser.add_argument(
+    '--sched-trace',
+    action='store_true',
+    dest='sched_trace',
+    help='record scheduler events in dramstage and dump them before handing off to BL31'
+)
+parser.add_argument(
+    '--console-ring-size',
+    type=int,
+    dest='console_ring_size',
+    default=16384,
+    help='size of the dramstage console buffer, which is drained into the UART when CPUs are idle (power of 2, 0 to write synchronously)'
+)
 parser.add_argument(
     '--uncached-memtest',
     action='store_true',
@@ -196,6 +236,11 @@ for f in (args.debug or '').split(','):
     flags[f].append('-DDEBUG_MSG')
 for f in (args.spew or '').split(','):
     flags[f].extend(('-DDEBUG_MSG', '-DSPEW_MSG'))
+binlog_modules = set((args.binlog or '').split(',')) - {''}
+for f in binlog_modules:
+    flags[f].append('-DBINLOG_MSG')
+if binlog_modules:
+    flags['dramstage/commit'].append('-DCONFIG_BINLOG=1')
 
 boot_media = set(args.boot_media or [])
 decompressors = set(args.decompressors or [])
@@ -217,6 +262,16 @@ elif boot_media or decompressors:
 if bool(decompressors) and not boot_media:
     flags['dramstage/decompression'].append('-DCONFIG_DRAMSTAGE_MEMORY=1')
 
+if args.sched_trace:
+    flags['lib/sched-trace'] = flags['lib/sched'] + ['-DCONFIG_SCHED_TRACE=1']
+    for f in ('dramstage/main', 'dramstage/commit', 'dramstage/decompression'):
+        flags[f].append('-DCONFIG_SCHED_TRACE=1')
+if args.console_ring_size & (args.console_ring_size - 1) or args.console_ring_size < 0:
+    print("ERROR: the console ring size must be a power of 2 or 0")
+    sys.exit(1)
+if args.console_ring_size:
+    flags['lib/uart16550a-ring'] = flags['lib/uart16550a'] + [f'-DCONFIG_CONSOLE_RING_SIZE={args.console_ring_size}']
+
 # ===== ninja skeleton =====
 srcdir = path.dirname(sys.argv[0])
 buildfile = open("build.ninja", "w", encoding='utf-8')
@@ -284,16 +339,16 @@ build('idbtool', 'buildcc', src('tools/idbtool.c'))
 build('regtool', 'buildcc', [src('tools/regtool.c'), src('tools/regtool_rpn.c')])
 
 # ===== C compile jobs =====
-lib = {'lib/error', 'lib/uart', 'lib/uart16550a', 'lib/mmu', 'lib/gicv2', 'lib/sched'}
+lib = {'lib/error', 'lib/uart', 'lib/uart16550a', 'lib/mmu', 'lib/gicv2', 'lib/sched', 'lib/boot_timeline'}
 sramstage = {'sramstage/main', 'rk3399/pll', 'sramstage/pmu_cru', 'sramstage/misc_init'} | {'dram/' + x for x in ('training', 'memorymap', 'mirror', 'ddrinit')}
-dramstage = {'dramstage/main', 'dramstage/transform_fdt', 'lib/rki2c', 'dramstage/commit', 'dramstage/entropy', 'dramstage/board_probe', 'dram/read_size'}
-dramstage_embedder =  {'sramstage/embedded_dramstage', 'compression/lzcommon', 'compression/lz4', 'lib/string'}
+dramstage = {'dramstage/main', 'dramstage/smp', 'dramstage/transform_fdt', 'lib/rki2c', 'dramstage/commit', 'dramstage/entropy', 'dramstage/board_probe', 'dram/read_size'}
+dramstage_embedder =  {'sramstage/embedded_dramstage', 'compression/lzcommon', 'compression/checksum', 'compression/lz4', 'lib/string'}
 usb_loader = {'sramstage/usb_loader', 'lib/dwc3', 'sramstage/usb_loader-spi', 'lib/rkspi'}
 memtest = {'sramstage/memtest', 'dram/read_size'}
 
 if decompressors:
     flags['dramstage/main'].append('-DCONFIG_DRAMSTAGE_DECOMPRESSION')
-    dramstage |= {'compression/lzcommon', 'lib/string', 'dramstage/decompression'}
+    dramstage |= {'compression/lzcommon', 'compression/checksum', 'compression/chunk_index', 'compression/stored_frame', 'lib/string', 'dramstage/decompression'}
 if 'lz4' in decompressors:
     flags['dramstage/decompression'].append('-DHAVE_LZ4')
     dramstage |= {'compression/lz4'}
@@ -305,27 +360,39 @@ if 'zstd' in decompressors:
     dramstage |= {'lib/string', 'compression/zstd', 'compression/zstd_fse', 'compression/zstd_literals', 'compression/zstd_probe_literals', 'compression/zstd_sequences'}
 
 boot_media_handlers = ('sramstage/main', 'dramstage/main')
+if args.boot_arbitration:
+    # everything that includes rk3399/payload.h needs to agree on the ring layout
+    for f in ('dramstage/main', 'dramstage/decompression', 'dramstage/commit', 'dramstage/boot_blockdev', 'dramstage/blk_sd', 'dramstage/blk_emmc', 'dramstage/blk_nvme', 'rk3399/spi'):
+        flags[f].append('-DCONFIG_BOOT_ARBITRATION=1')
 if 'spi' in boot_media:
     for f in boot_media_handlers:
         flags[f].append('-DCONFIG_SPI=1')
-    dramstage |= {'lib/rkspi', 'rk3399/spi'}
+    dramstage |= {'lib/rkspi', 'lib/pl330', 'rk3399/spi'}
+    if args.spi_irq:
+        flags['rk3399/spi'].append('-DCONFIG_SPI_DMA=0')
+    if args.boot_hint:
+        for f in ('dramstage/main', 'rk3399/spi'):
+            flags[f].append('-DCONFIG_BOOT_HINT=1')
+elif args.boot_hint:
+    print("ERROR: the boot hint is stored in SPI flash, configure with the 'spi' boot medium")
+    sys.exit(1)
 if 'emmc' in boot_media:
     for f in boot_media_handlers:
         flags[f].append('-DCONFIG_EMMC=1')
     emmc_modules = {'lib/sdhci_common', 'rk3399/emmcphy'}
     sramstage |= emmc_modules | {'sramstage/emmc_init'}
-    dramstage |= emmc_modules | {'dramstage/blk_emmc', 'lib/sdhci', 'dramstage/boot_blockdev'}
+    dramstage |= emmc_modules | {'dramstage/blk_emmc', 'lib/sdhci', 'dramstage/boot_blockdev', 'lib/readahead'}
 if 'sd' in boot_media:
     for f in boot_media_handlers:
         flags[f].append('-DCONFIG_SD=1')
     sdmmc_modules = {'lib/dwmmc_common', 'lib/sd'}
     sramstage |= sdmmc_modules | {'sramstage/sd_init', 'lib/dwmmc_early'}
-    dramstage |= sdmmc_modules | {'dramstage/blk_sd', 'lib/dwmmc', 'lib/dwmmc_xfer', 'dramstage/boot_blockdev'}
+    dramstage |= sdmmc_modules | {'dramstage/blk_sd', 'lib/dwmmc', 'lib/dwmmc_xfer', 'dramstage/boot_blockdev', 'lib/readahead'}
 if 'nvme' in boot_media:
     flags['sramstage/main'].append('-DCONFIG_PCIE=1')
     flags['dramstage/main'].append('-DCONFIG_NVME=1')
     sramstage |= {'sramstage/pcie_init'}
-    dramstage |= {'dramstage/blk_nvme', 'lib/nvme', 'lib/nvme_xfer', 'dramstage/boot_blockdev'}
+    dramstage |= {'dramstage/blk_nvme', 'lib/nvme', 'lib/nvme_xfer', 'dramstage/boot_blockdev', 'lib/readahead'}
 
 board_handlers = ('dramstage/board_probe',)
 for x in board_handlers:
@@ -336,7 +403,7 @@ for x in board_handlers:
         flags[x].append(f'-DCONFIG_BOARD_{n}={1 if o in boards else 0}')
     flags[x].append(f'-DCONFIG_SINGLE_BOARD={1 if len(boards) == 1 else 0}')
 
-modules = lib | sramstage | dramstage | usb_loader | memtest | {'rk3399/teststage', 'lib/dump_fdt'}
+modules = lib | sramstage | dramstage | usb_loader | memtest | {'rk3399/teststage', 'rk3399/stringbench', 'lib/dump_fdt'}
 if boot_media:
     modules |= dramstage_embedder
 build.comment(f'modules: {" ".join(modules)}')
@@ -352,9 +419,10 @@ for f in modules:
 # ===== special compile jobs =====
 asm_jobs = {x: x + '.S' for x in (
     'aarch64/gicv3', 'aarch64/save_restore', 'aarch64/string',
-    'aarch64/mmu_asm', 'rk3399/cpu_onoff'
+    'aarch64/mmu_asm', 'aarch64/lzcommon', 'rk3399/cpu_onoff'
 )}
 memtest |= {'rk3399/cpu_onoff'}
+dramstage |= {'rk3399/cpu_onoff'}
 
 for j, f in {
     'entry-first':  ('-DCONFIG_FIRST_STAGE=1',),
@@ -376,9 +444,21 @@ for x in (2, 3):
     flags[f'rk3399/handlers-el{x}'].append(f'-DCONFIG_EL={x}')
     build(f'rk3399/handlers-el{x}.o', 'cc', src('rk3399/handlers.c'), flags=' '.join(flags[f'rk3399/handlers-el{x}']))
 
-lib |= {'aarch64/'+x for x in ('dcache-el3', 'mmu_asm', 'context-el3', 'gicv3', 'save_restore', 'string')}
+lib |= {'aarch64/'+x for x in ('dcache-el3', 'mmu_asm', 'context-el3', 'gicv3', 'save_restore', 'string', 'lzcommon')}
 lib |= {'entry', 'rk3399/handlers-el3', 'rk3399/debug-el3'}
 
+# the trace and console rings don't fit in SRAM, so only dramstage gets the tracing scheduler and the buffered console
+dramstage_lib = lib
+if args.sched_trace:
+    build('lib/sched-trace.o', 'cc', src('lib/sched.c'), flags=' '.join(flags['lib/sched-trace']))
+    dramstage_lib = dramstage_lib - {'lib/sched'} | {'lib/sched-trace'}
+if args.console_ring_size:
+    build('lib/uart16550a-ring.o', 'cc', src('lib/uart16550a.c'), flags=' '.join(flags['lib/uart16550a-ring']))
+    dramstage_lib = dramstage_lib - {'lib/uart16550a'} | {'lib/uart16550a-ring'}
+if binlog_modules:
+    build('lib/binlog.o', 'cc', src('lib/binlog.c'), flags=' '.join(flags['lib/binlog']))
+    dramstage_lib = dramstage_lib | {'lib/binlog'}
+
 regtool_job = namedtuple('regtool_job', ('input', 'flags', 'macros'), defaults=([],))
 phy_job = lambda input, freq, flags='', range=None: regtool_job(input, flags=f'--set freq {freq} --mhz 50 800 400 '+flags+('' if range is None else f' --first {range[0]} --last {range[1]}'), macros=('phy-macros',))
 regtool_targets = {
@@ -436,10 +516,11 @@ def binary(name, modules, base_address):
 binary('sramstage-usb', sramstage | usb_loader, 'ff8c2000')
 binary('memtest', sramstage | memtest, 'ff8c2000')
 binary('teststage', ('rk3399/teststage', 'entry-el2', 'aarch64/dcache-el2', 'aarch64/context-el2', 'rk3399/handlers-el2', 'rk3399/debug-el2', 'aarch64/mmu_asm', 'lib/uart', 'lib/uart16550a', 'lib/error', 'lib/mmu', 'lib/dump_fdt', 'lib/sched', 'lib/string'), '00280000')
+binary('stringbench', ('rk3399/stringbench', 'entry-el2', 'aarch64/dcache-el2', 'aarch64/context-el2', 'rk3399/handlers-el2', 'rk3399/debug-el2', 'aarch64/mmu_asm', 'lib/uart', 'lib/uart16550a', 'lib/error', 'lib/mmu', 'lib/sched', 'lib/string', 'aarch64/string'), '00280000')
 build('memtest-sd.img', 'run', 'memtest.bin', deps='idbtool', bin='./idbtool')
-build.default('sramstage-usb.bin', 'memtest.bin', 'teststage.bin', 'memtest-sd.img')
+build.default('sramstage-usb.bin', 'memtest.bin', 'teststage.bin', 'stringbench.bin', 'memtest-sd.img')
 if args.tf_a_headers:
-    binary('dramstage', dramstage | lib, '04000000')
+    binary('dramstage', dramstage | dramstage_lib, '04000000')
     build.default('dramstage.bin')
 if boot_media:
     binary('levinboot-usb', sramstage | dramstage_embedder, 'ff8c2000')
@@ -5,6 +5,7 @@
 #include <inttypes.h>
 
 #include <arch.h>
+#include <boot_timeline.h>
 #include <die.h>
 #include <log.h>
 #include <rk3399.h>
@@ -261,6 +262,7 @@ void ddrinit_primary(struct ddrinit_state *st) {
 		);
 	}
 	encode_dram_size(st->geo);
+	boot_timeline_add(BOOT_EVENT_DRAM_TRAINED, 0);
 	rk3399_set_init_flags(RK3399_INIT_DRAM_TRAINING);
 	printf("[%"PRIuTS"] finished.\n", get_timestamp());
 	/* 256B interleaving */
@@ -270,6 +272,7 @@ void ddrinit_primary(struct ddrinit_state *st) {
 		if (test_mirror(MIRROR_TEST_ADDR, bit)) {die("mirroring detected\n");}
 	}
 	mmu_unmap_range(0, 0xf7ffffff);
+	boot_timeline_add(BOOT_EVENT_DRAM_READY, 0);
 	rk3399_set_init_flags(RK3399_INIT_DRAM_READY);
 }
 
@@ -6,6 +6,7 @@
 #include <stdatomic.h>
 
 #include <arch.h>
+#include <boot_timeline.h>
 #include <log.h>
 #include <mmu.h>
 #include <aarch64.h>
@@ -53,71 +54,35 @@ struct sdhci_state emmc_state = {
 };
 
 struct emmc_blockdev {
-	struct async_blockdev blk;
+	struct async_readahead ra;
 	struct sdhci_xfer xfer;
-	u8 *consume_ptr, *end_ptr, *next_end_ptr, *stop_ptr;
-	u32 next_lba;
 	unsigned address_shift : 4;
 	struct mmc_cardinfo card;
 };
 
-static u8 iost_u8[NUM_IOST];
+static enum iost start_request(struct async_readahead *ra, u32 UNUSED slot, u64 lba, u8 *buf, u8 *buf_end) {
+	struct emmc_blockdev *dev = (struct emmc_blockdev *)ra;
+	if (!sdhci_reset_xfer(&dev->xfer)) {return IOST_INVALID;}
+	_Bool success = sdhci_add_phys_buffer(&dev->xfer, plat_virt_to_phys(buf), plat_virt_to_phys(buf_end));
+	(void)success;
+	assert(success);
+	return sdhci_start_xfer(&emmc_state, &dev->xfer, (u32)lba);
+}
 
-static enum iost wait_xfer(struct emmc_blockdev *dev) {
+static enum iost wait_request(struct async_readahead *ra, u32 UNUSED slot) {
+	struct emmc_blockdev *dev = (struct emmc_blockdev *)ra;
 	debugs("waiting for xfer\n");
 	enum iost res = sdhci_wait_xfer(&emmc_state, &dev->xfer);
-	if (res != IOST_OK) {
-		info("xfer failed: %u\n", (unsigned)res);
-		return res;
-	}
-	invalidate_range(dev->end_ptr, dev->next_end_ptr - dev->end_ptr);
-	dev->end_ptr = dev->next_end_ptr;
-	return IOST_OK;
+	if (res != IOST_OK) {info("xfer failed: %u\n", (unsigned)res);}
+	return res;
 }
 
-enum {REQUEST_SIZE = 2 << 20};
-
-static struct async_buf pump(struct async_transfer *async, size_t consume, size_t min_size) {
-	struct emmc_blockdev *dev = (struct emmc_blockdev *)async;
-	debug("pump: %"PRIx64" %"PRIx64" %zu\n", (u64)dev->end_ptr, (u64)dev->consume_ptr, consume);
-	assert((size_t)(dev->end_ptr - dev->consume_ptr) >= consume);
-	dev->consume_ptr += consume;
-	while ((size_t)(dev->end_ptr - dev->consume_ptr) < min_size) {
-		if (dev->end_ptr != dev->next_end_ptr) {
-			enum iost res = wait_xfer(dev);
-			if (res != IOST_OK) {return (struct async_buf) {iost_u8 + res, iost_u8};}
-		}
-		if (dev->stop_ptr == dev->end_ptr) {
-			return (struct async_buf) {dev->consume_ptr, dev->end_ptr};
-		}
-		u8 *end = dev->stop_ptr - dev->end_ptr > REQUEST_SIZE ? dev->end_ptr + REQUEST_SIZE: dev->stop_ptr;
-		debug("starting new xfer LBA 0x%08"PRIx32" buf 0x%"PRIx64"–0x%"PRIx64"\n", dev->next_lba, (u64)dev->end_ptr, (u64)end);
-		flush_range(dev->end_ptr, end - dev->end_ptr);
-		if (!sdhci_reset_xfer(&dev->xfer)) {return (struct async_buf) {iost_u8 + IOST_INVALID, iost_u8};}
-		_Bool success = sdhci_add_phys_buffer(&dev->xfer, plat_virt_to_phys(dev->end_ptr), plat_virt_to_phys(end));
-		(void)success;
-		assert(success);
-		enum iost res = sdhci_start_xfer(&emmc_state, &dev->xfer, dev->next_lba);
-		if (res != IOST_OK) {return (struct async_buf) {iost_u8 + res, iost_u8};}
-		dev->next_lba += REQUEST_SIZE / dev->blk.block_size;
-		dev->next_end_ptr = end;
-	}
-	return (struct async_buf) {dev->consume_ptr, dev->end_ptr};
+static _Bool request_done(struct async_readahead *ra, u32 UNUSED slot) {
+	struct emmc_blockdev *dev = (struct emmc_blockdev *)ra;
+	return atomic_load_explicit(&dev->xfer.status, memory_order_acquire) < NUM_IOST;
 }
 
-static enum iost start(struct async_blockdev *dev_, u64 addr, u8 *buf, u8 *buf_end) {
-	struct emmc_blockdev *dev = (struct emmc_blockdev *)dev_;
-	if (buf_end < buf
-		|| (size_t)(buf_end - buf) % dev->blk.block_size != 0
-		|| addr >= dev->blk.num_blocks
-	) {return IOST_INVALID;}
-	enum iost res = wait_xfer(dev);
-	if (res != IOST_OK) {return res;}
-	dev->next_lba = (u32)addr;
-	dev->consume_ptr = dev->end_ptr = dev->next_end_ptr = buf;
-	dev->stop_ptr = buf_end;
-	return IOST_OK;
-}
+enum {REQUEST_SIZE = 2 << 20};
 
 static UNCACHED struct sdhci_adma2_desc8 desc_buf[4096 / sizeof(struct sdhci_adma2_desc8)];
 
@@ -134,18 +99,18 @@ static _Bool parse_cardinfo(struct emmc_blockdev *dev) {
 		return 0;
 	} else if (dev->card.ext_csd[EXTCSD_REV] >= 6) {
 		if (dev->card.ext_csd[EXTCSD_DATA_SECTOR_SIZE] == 1) {
-			dev->blk.block_size = 4096;
+			dev->ra.blk.block_size = 4096;
 		} else if (dev->card.ext_csd[EXTCSD_DATA_SECTOR_SIZE] != 0) {
 			infos("unknown data sector size");
 			return 0;
 		} else {
-			dev->blk.block_size = 512;
+			dev->ra.blk.block_size = 512;
 		}
 	} else {
-		dev->blk.block_size = 512;
+		dev->ra.blk.block_size = 512;
 	}
-	dev->blk.num_blocks = mmc_sector_count(&dev->card);
-	info("eMMC has %"PRIu64" %"PRIu32"-byte sectors\n", dev->blk.num_blocks, dev->blk.block_size);
+	dev->ra.blk.num_blocks = mmc_sector_count(&dev->card);
+	info("eMMC has %"PRIu64" %"PRIu32"-byte sectors\n", dev->ra.blk.num_blocks, dev->ra.blk.block_size);
 	if (~dev->card.rocr & 1 << 30) {dev->address_shift = 9;}
 	return 1;
 }
@@ -160,9 +125,18 @@ void boot_emmc() {
 	}
 
 	struct emmc_blockdev blk = {
-		.blk = {
-			.async = {pump},
-			.start = start,
+		.ra = {
+			.blk = {
+				.async = {async_readahead_pump, async_readahead_redirect, async_readahead_hold, get_io_stats(BOOT_MEDIUM_EMMC)},
+				.start = async_readahead_start,
+				.start_ring = async_readahead_start_ring,
+			},
+			.start_request = start_request,
+			.wait_request = wait_request,
+			.request_done = request_done,
+			.window = CONFIG_READAHEAD_WINDOW,
+			.request_size = REQUEST_SIZE,
+			.max_inflight = 1,
 		},
 		.xfer = {
 			.desc8 = desc_buf,
@@ -170,15 +144,16 @@ void boot_emmc() {
 			.desc_cap = ARRAY_SIZE(desc_buf),
 		},
 	};
-	if (IOST_OK != sdhci_init_late(&emmc_state, &blk.card)) {
+	enum iost init_res = sdhci_init_late(&emmc_state, &blk.card);
+	boot_timeline_add(BOOT_EVENT_EMMC_INIT, init_res);
+	if (IOST_OK != init_res) {
 		infos("eMMC init failed\n");
 		goto shut_down_emmc;
 	}
 	if (!parse_cardinfo(&blk)) {goto out;}
 
 	infos("eMMC init done\n");
-	if (!wait_for_boot_cue(BOOT_MEDIUM_EMMC)) {goto out;}
-	enum iost res = boot_blockdev(&blk.blk);
+	enum iost res = boot_blockdev(&blk.ra.blk, BOOT_MEDIUM_EMMC);
 	if (res == IOST_OK) {boot_medium_loaded(BOOT_MEDIUM_EMMC);}
 	if (res == IOST_GLOBAL) {goto shut_down_emmc;}
 
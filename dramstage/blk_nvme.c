@@ -8,6 +8,7 @@
 #include <assert.h>
 
 #include <arch.h>
+#include <boot_timeline.h>
 #include <pci_regs.h>
 #include <rkpcie_regs.h>
 #include <nvme.h>
@@ -22,7 +23,6 @@
 #include <async.h>
 #include <plat.h>
 #include <byteorder.h>
-#include <cache.h>
 
 struct rkpcie_ob_desc {
 	u32 addr[2];
@@ -40,11 +40,17 @@ struct rkpcie_addr_xlation {
 };
 CHECK_OFFSET(rkpcie_addr_xlation, link_down_indication, 0x828);
 
+#ifndef CONFIG_NVME_QUEUE_DEPTH
+#define CONFIG_NVME_QUEUE_DEPTH 4
+#endif
+_Static_assert(CONFIG_NVME_QUEUE_DEPTH >= 1 && CONFIG_NVME_QUEUE_DEPTH <= 63, "NVMe queue depth must fit in a single-page I/O submission queue");
+_Static_assert(CONFIG_NVME_QUEUE_DEPTH <= ASYNC_MAX_INFLIGHT, "NVMe queue depth exceeds what the readahead core can track");
+
 enum {
 	WTBUF_ASQ,
 	WTBUF_IOSQ,
 	WTBUF_PRP,
-	NUM_WTBUF
+	NUM_WTBUF = WTBUF_PRP + CONFIG_NVME_QUEUE_DEPTH
 };
 
 enum {
@@ -91,11 +97,11 @@ static struct nvme_cq cqs[] = {
 		.size = 3,
 	}, {
 		.buf =(struct nvme_completion *)uncached_buf[UBUF_IOCQ],
-		.size = 3,
+		.size = CONFIG_NVME_QUEUE_DEPTH,
 	},
 };
 static _Atomic(struct nvme_req *) admin_cmd[2];
-static _Atomic(struct nvme_req *) io_cmd[4];
+static _Atomic(struct nvme_req *) io_cmd[CONFIG_NVME_QUEUE_DEPTH];
 static struct nvme_sq sqs[] = {
 	{
 		.buf = (struct nvme_cmd *)wt_buf[WTBUF_ASQ],
@@ -105,8 +111,9 @@ static struct nvme_sq sqs[] = {
 		.cmd = admin_cmd
 	}, {
 		.buf = (struct nvme_cmd *)wt_buf[WTBUF_IOSQ],
-		.size = 3,
-		.max_cid = 3,
+		/* one more entry than commands in flight, so a full queue can be told apart from an empty one */
+		.size = CONFIG_NVME_QUEUE_DEPTH,
+		.max_cid = CONFIG_NVME_QUEUE_DEPTH - 1,
 		.cmd = io_cmd,
 	},
 };
@@ -118,77 +125,28 @@ static struct nvme_state st = {
 	.sq = sqs,
 };
 
-struct nvme_blockdev {
-	struct async_blockdev blk;
-	struct nvme_state *st;
-	struct nvme_xfer xfer;
-	u8 *consume_ptr, *end_ptr, *next_end_ptr, *stop_ptr;
-	u64 next_lba;
-	u8 xfer_shift;
-	u32 nsid;
-};
-
-static u8 iost_u8[NUM_IOST];
-
-static struct async_buf pump(struct async_transfer *async, size_t consume, size_t min_size) {
-	struct nvme_blockdev *dev = (struct nvme_blockdev *)async;
-	assert((size_t)(dev->end_ptr - dev->consume_ptr) >= consume);
-	dev->consume_ptr += consume;
-	while ((size_t)(dev->end_ptr - dev->consume_ptr) < min_size) {
-		if (dev->end_ptr != dev->next_end_ptr) {
-			enum iost res = nvme_wait_req(dev->st, &dev->xfer.req);
-			if (res != IOST_OK) {return (struct async_buf) {iost_u8 + res, iost_u8};}
-			invalidate_range(dev->end_ptr, dev->next_end_ptr - dev->end_ptr);
-			dev->end_ptr = dev->next_end_ptr;
-		}
-		if (dev->stop_ptr == dev->end_ptr) {
-			return (struct async_buf) {dev->consume_ptr, dev->end_ptr};
-		}
-		u32 xfer_size = UINT32_C(1) << dev->xfer_shift;
-		u8 *end = dev->stop_ptr - dev->end_ptr > xfer_size ? dev->end_ptr + xfer_size: dev->stop_ptr;
-		debug("starting new xfer LBA 0x%08"PRIx64" buf 0x%"PRIx64"–0x%"PRIx64"\n", dev->next_lba, (u64)dev->end_ptr, (u64)end);
-		enum iost res = nvme_reset_xfer(&dev->xfer);
-		if (res != IOST_OK) {return (struct async_buf) {iost_u8 + res, iost_u8};}
-		_Bool success = nvme_add_phys_buffer(&dev->xfer, plat_virt_to_phys(dev->end_ptr), plat_virt_to_phys(end));
-		(void)success;
-		assert(success);
-		/* we will invalidate later, but this prevents any previous
-		 * cache contents from overwriting DMA'd-in data */
-		flush_range(dev->end_ptr, end - dev->end_ptr);
-		if (!nvme_emit_read(dev->st, dev->st->sq + 1, &dev->xfer, dev->nsid, dev->next_lba)) {return (struct async_buf) {iost_u8 + IOST_INVALID, iost_u8};}
-		if (!nvme_submit_single_command(dev->st, 1, &dev->xfer.req)) {return (struct async_buf) {iost_u8 + IOST_TRANSIENT, iost_u8};}
-		dev->next_lba += xfer_size / dev->blk.block_size;
-		dev->next_end_ptr = end;
-	}
-	return (struct async_buf) {dev->consume_ptr, dev->end_ptr};
-}
-
-static enum iost start(struct async_blockdev *dev_, u64 addr, u8 *buf, u8 *buf_end) {
-	struct nvme_blockdev *dev = (struct nvme_blockdev *)dev_;
-	if (buf_end < buf
-		|| (size_t)(buf_end - buf) % dev->blk.block_size != 0
-		|| addr >= dev->blk.num_blocks
-	) {return IOST_INVALID;}
-	dev->next_lba = (u32)addr;
-	dev->consume_ptr = dev->end_ptr = dev->next_end_ptr = buf;
-	dev->stop_ptr = buf_end;
-	return IOST_OK;
-}
+static struct nvme_xfer xfers[CONFIG_NVME_QUEUE_DEPTH];
 
 struct nvme_blockdev nvme_blk = {
-	.blk = {
-		.async = {pump},
-		.start = start,
-	},
-	.xfer = {
-		.prp_list = (u64 *)wt_buf[WTBUF_PRP],
-		.prp_cap = 1 << PLAT_PAGE_SHIFT >> 3,
+	.ra = {
+		.blk = {
+			.async = {async_readahead_pump, async_readahead_redirect, async_readahead_hold},
+			.start = async_readahead_start,
+			.start_ring = async_readahead_start_ring,
+		},
+		.start_request = nvme_blk_start_request,
+		.wait_request = nvme_blk_wait_request,
+		.request_done = nvme_blk_request_done,
+		.window = CONFIG_READAHEAD_WINDOW,
+		.max_inflight = CONFIG_NVME_QUEUE_DEPTH,
 	},
+	.xfer = xfers,
 	.st = &st,
 };
 
 void boot_nvme() {
 	static volatile u32 *const cru = regmap_cru;
+	nvme_blk.ra.blk.async.stats = get_io_stats(BOOT_MEDIUM_NVME);
 	if ((cru[CRU_CLKGATE_CON+12] & 1 << 6) || (cru[CRU_CLKGATE_CON+20] & 3 << 10)) {
 		info("sramstage left PCIe disabled\n");
 		goto out;
@@ -282,15 +240,28 @@ void boot_nvme() {
 	xlat->ob[0].desc[2] = 0;
 	xlat->ob[0].desc[3] = 0;
 
-	switch (nvme_init(&st)) {
+	enum iost init_res = nvme_init(&st);
+	boot_timeline_add(BOOT_EVENT_NVME_INIT, init_res);
+	switch (init_res) {
 	case IOST_OK: break;
 	case IOST_INVALID: goto out;
 	default: goto shut_down_log;
 	}
 	info("[%"PRIuTS"] NVMe MMIO init complete\n", get_timestamp());
+	u16 mqes = nvme_extr_cap_mqes(st.cap);
+	if (sqs[1].size > mqes) {
+		info("controller only supports %"PRIu16" in-flight reads\n", mqes);
+		sqs[1].size = cqs[1].size = mqes;
+		sqs[1].max_cid = mqes - 1;
+		nvme_blk.ra.max_inflight = mqes;
+	}
 	if (IOST_OK != nvme_init_queues(&st, 1, 1, uncached_buf[UBUF_IDCTL])) {goto shut_down_nvme;}
 	info("[%"PRIuTS"] NVMe queue init complete\n", get_timestamp());
-	nvme_blk.xfer.prp_list_addr = plat_virt_to_phys(wt_buf[WTBUF_PRP]);
+	for_array(i, xfers) {
+		xfers[i].prp_list = (u64 *)wt_buf[WTBUF_PRP + i];
+		xfers[i].prp_list_addr = plat_virt_to_phys(wt_buf[WTBUF_PRP + i]);
+		xfers[i].prp_cap = 1 << PLAT_PAGE_SHIFT >> 3;
+	}
 	u8 read_shift = 17;
 	_Static_assert(PLAT_PAGE_SHIFT <= 17, "page size larger than transfer size");
 	u8 mdts = nvme_extr_idctl_mdts(uncached_buf[UBUF_IDCTL]);
@@ -298,7 +269,7 @@ void boot_nvme() {
 	if (mdts && mdts < read_shift - mpsmin) {
 		read_shift = mdts + mpsmin;
 	}
-	nvme_blk.xfer_shift = read_shift;
+	nvme_blk.ra.request_size = UINT32_C(1) << read_shift;
 	info("MDTS: %"PRIu32"B\n", UINT32_C(1) << read_shift);
 	u32 num_ns = nvme_extr_idctl_nn(uncached_buf[UBUF_IDCTL]);
 	if (!num_ns) {
@@ -337,13 +308,17 @@ void boot_nvme() {
 		}
 		st.lba_shift = lbaf[2];
 		nvme_blk.nsid = nsid;
-		nvme_blk.blk.block_size = 1 << st.lba_shift;
-		nvme_blk.blk.num_blocks = ns_size;
-		info("namespace %"PRIu32" has %"PRIu64" (0x%"PRIx64") %"PRIu32"-byte sectors\n", nsid, ns_size, ns_size, nvme_blk.blk.block_size);
+		nvme_blk.ra.blk.block_size = 1 << st.lba_shift;
+		nvme_blk.ra.blk.num_blocks = ns_size;
+		info("namespace %"PRIu32" has %"PRIu64" (0x%"PRIx64") %"PRIu32"-byte sectors\n", nsid, ns_size, ns_size, nvme_blk.ra.blk.block_size);
 
-		if (!wait_for_boot_cue(BOOT_MEDIUM_NVME)) {goto shut_down_nvme;}
-		switch (boot_blockdev(&nvme_blk.blk)) {
-		case IOST_OK: boot_medium_loaded(BOOT_MEDIUM_NVME); goto shut_down_nvme;
+		if (get_boot_cue() == BOOT_CUE_EXIT) {goto shut_down_nvme;}
+		switch (boot_blockdev(&nvme_blk.ra.blk, BOOT_MEDIUM_NVME)) {
+		case IOST_OK:
+			/* readahead may still be writing into the blob buffer */
+			async_readahead_drain(&nvme_blk.ra);
+			boot_medium_loaded(BOOT_MEDIUM_NVME);
+			goto shut_down_nvme;
 		case IOST_GLOBAL: goto shut_down_nvme;
 		case IOST_INVALID: infos("invalid");break;
 		case IOST_LOCAL: infos("local"); break;
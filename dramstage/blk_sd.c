@@ -3,6 +3,7 @@
 #include <stdatomic.h>
 
 #include <async.h>
+#include <boot_timeline.h>
 #include <die.h>
 #include <iost.h>
 #include <log.h>
@@ -58,10 +59,8 @@ struct dwmmc_state sdmmc_state = {
 };
 
 struct sd_blockdev {
-	struct async_blockdev blk;
+	struct async_readahead ra;
 	struct dwmmc_xfer xfer;
-	u8 *consume_ptr, *end_ptr, *next_end_ptr, *stop_ptr;
-	u32 next_lba;
 	unsigned address_shift : 4;
 	struct sd_cardinfo card;
 };
@@ -73,9 +72,9 @@ static _Bool parse_cardinfo(struct sd_blockdev *dev) {
 		return 0;
 	}
 	dev->address_shift = 0;
-	dev->blk.block_size = 512;
-	dev->blk.num_blocks = (u64)(csd[1] >> 16 | (csd[2] << 16 & 0x3f0000)) * 1024 + 1024;
-	info("SD has %"PRIu64" %"PRIu32"-byte sectors\n", dev->blk.num_blocks, dev->blk.block_size);
+	dev->ra.blk.block_size = 512;
+	dev->ra.blk.num_blocks = (u64)(csd[1] >> 16 | (csd[2] << 16 & 0x3f0000)) * 1024 + 1024;
+	info("SD has %"PRIu64" %"PRIu32"-byte sectors\n", dev->ra.blk.num_blocks, dev->ra.blk.block_size);
 	return 1;
 }
 
@@ -83,56 +82,25 @@ static _Alignas(4096) UNCACHED struct dwmmc_idmac_desc desc_buf[4096 / sizeof(st
 
 enum {REQUEST_SIZE = 1 << 19};
 
-static u8 iost_u8[NUM_IOST];
-
-static enum iost wait_xfer(struct sd_blockdev *dev) {
-	debugs("waiting for xfer\n");
-	enum iost res = dwmmc_wait_xfer(&sdmmc_state, &dev->xfer);
+static enum iost start_request(struct async_readahead *ra, u32 UNUSED slot, u64 lba, u8 *buf, u8 *buf_end) {
+	struct sd_blockdev *dev = (struct sd_blockdev *)ra;
+	enum iost res = dwmmc_start_request(&dev->xfer, (u32)lba);
 	if (res != IOST_OK) {return res;}
-	invalidate_range(dev->end_ptr, dev->next_end_ptr - dev->end_ptr);
-	dev->end_ptr = dev->next_end_ptr;
-	return IOST_OK;
+	_Bool success = dwmmc_add_phys_buffer(&dev->xfer, plat_virt_to_phys(buf), plat_virt_to_phys(buf_end));
+	(void)success;
+	assert(success);
+	return dwmmc_start_xfer(&sdmmc_state, &dev->xfer);
 }
 
-static struct async_buf pump(struct async_transfer *async, size_t consume, size_t min_size) {
-	struct sd_blockdev *dev = (struct sd_blockdev *)async;
-	assert((size_t)(dev->end_ptr - dev->consume_ptr) >= consume);
-	dev->consume_ptr += consume;
-	while ((size_t)(dev->end_ptr - dev->consume_ptr) < min_size) {
-		if (dev->end_ptr != dev->next_end_ptr) {
-			enum iost res = wait_xfer(dev);
-			if (res != IOST_OK) {return (struct async_buf) {iost_u8 + res, iost_u8};}
-		}
-		if (dev->stop_ptr == dev->end_ptr) {
-			return (struct async_buf) {dev->consume_ptr, dev->end_ptr};
-		}
-		u8 *end = dev->stop_ptr - dev->end_ptr > REQUEST_SIZE ? dev->end_ptr + REQUEST_SIZE: dev->stop_ptr;
-		debug("starting new xfer LBA 0x%08"PRIx32" buf 0x%"PRIx64"–0x%"PRIx64"\n", dev->next_lba, (u64)dev->end_ptr, (u64)end);
-		enum iost res = dwmmc_start_request(&dev->xfer, dev->next_lba);
-		if (res != IOST_OK) {return (struct async_buf) {iost_u8 + res, iost_u8};}
-		_Bool success = dwmmc_add_phys_buffer(&dev->xfer, plat_virt_to_phys(dev->end_ptr), plat_virt_to_phys(end));
-		(void)success;
-		assert(success);
-		res = dwmmc_start_xfer(&sdmmc_state, &dev->xfer);
-		if (res != IOST_OK) {return (struct async_buf) {iost_u8 + res, iost_u8};}
-		dev->next_lba += REQUEST_SIZE / dev->blk.block_size;
-		dev->next_end_ptr = end;
-	}
-	return (struct async_buf) {dev->consume_ptr, dev->end_ptr};
+static enum iost wait_request(struct async_readahead *ra, u32 UNUSED slot) {
+	struct sd_blockdev *dev = (struct sd_blockdev *)ra;
+	debugs("waiting for xfer\n");
+	return dwmmc_wait_xfer(&sdmmc_state, &dev->xfer);
 }
 
-static enum iost start(struct async_blockdev *dev_, u64 addr, u8 *buf, u8 *buf_end) {
-	struct sd_blockdev *dev = (struct sd_blockdev *)dev_;
-	if (buf_end < buf
-		|| (size_t)(buf_end - buf) % dev->blk.block_size != 0
-		|| addr >= dev->blk.num_blocks
-	) {return IOST_INVALID;}
-	enum iost res = wait_xfer(dev);
-	if (res != IOST_OK) {return res;}
-	dev->next_lba = (u32)addr;
-	dev->consume_ptr = dev->end_ptr = dev->next_end_ptr = buf;
-	dev->stop_ptr = buf_end;
-	return IOST_OK;
+static _Bool request_done(struct async_readahead *ra, u32 UNUSED slot) {
+	struct sd_blockdev *dev = (struct sd_blockdev *)ra;
+	return atomic_load_explicit(&dev->xfer.status, memory_order_acquire) < NUM_IOST;
 }
 
 void boot_sd() {
@@ -144,9 +112,18 @@ void boot_sd() {
 		goto out;
 	}
 	struct sd_blockdev blk = {
-		.blk = {
-			.async = {pump},
-			.start = start,
+		.ra = {
+			.blk = {
+				.async = {async_readahead_pump, async_readahead_redirect, async_readahead_hold, get_io_stats(BOOT_MEDIUM_SD)},
+				.start = async_readahead_start,
+				.start_ring = async_readahead_start_ring,
+			},
+			.start_request = start_request,
+			.wait_request = wait_request,
+			.request_done = request_done,
+			.window = CONFIG_READAHEAD_WINDOW,
+			.request_size = REQUEST_SIZE,
+			.max_inflight = 1,
 		},
 		.xfer = {
 			.desc = desc_buf,
@@ -154,23 +131,20 @@ void boot_sd() {
 			.desc_cap = ARRAY_SIZE(desc_buf),
 		},
 	};
-	if (!dwmmc_init_late(&sdmmc_state, &blk.card)) {goto shut_down_mshc;}
+	_Bool init_ok = dwmmc_init_late(&sdmmc_state, &blk.card);
+	boot_timeline_add(BOOT_EVENT_SD_INIT, init_ok ? IOST_OK : IOST_GLOBAL);
+	if (!init_ok) {goto shut_down_mshc;}
 	if (!parse_cardinfo(&blk)) {goto out;}
 
-	if (!wait_for_boot_cue(BOOT_MEDIUM_SD)) {
-		boot_medium_exit(BOOT_MEDIUM_SD);
-		return;
-	}
-
-	enum iost res = boot_blockdev(&blk.blk);
+	enum iost res = boot_blockdev(&blk.ra.blk, BOOT_MEDIUM_SD);
 	if (res == IOST_OK) {
 		boot_medium_loaded(BOOT_MEDIUM_SD);
 	} else if (res != IOST_GLOBAL) {
 		goto out;
 	} else {goto shut_down_mshc;}
 
-	dwmmc_wait_xfer(&sdmmc_state, &blk.xfer);
-	printf("had read %zu bytes\n", (size_t)(blk.end_ptr - blob_buffer.start));
+	async_readahead_drain(&blk.ra);
+	printf("had read %zu bytes\n", (size_t)(blk.ra.end_ptr - (blk.ra.ring.end != blk.ra.ring.start ? blk.ra.ring_stream : blob_buffer.start)));
 	goto out;
 shut_down_mshc:
 	infos("hardware in unknown state, shutting down the MSHC");
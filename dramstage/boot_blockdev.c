@@ -10,13 +10,21 @@
 #include <dump_mem.h>
 #include <byteorder.h>
 
-static _Alignas(4096) u8 partition_table_buffer[4 * 4096];
+/* the media parse their partition tables concurrently */
+static _Alignas(4096) u8 partition_table_buffers[NUM_BOOT_MEDIUM][4 * 4096];
 
-enum iost boot_blockdev(struct async_blockdev *blk) {
+_Static_assert(CONFIG_BOOT_ARBITRATION || ((BOOT_MEDIUM_SD + 1) * (u64)CONFIG_PAYLOAD_RING_SIZE <= 60 << 20
+	&& (BOOT_MEDIUM_EMMC + 1) * (u64)CONFIG_PAYLOAD_RING_SIZE <= 60 << 20
+	&& (BOOT_MEDIUM_NVME + 1) * (u64)CONFIG_PAYLOAD_RING_SIZE <= 60 << 20),
+	"payload rings don't fit into the blob buffer"
+);
+
+/* finds the payload partition to use in the GPT, returns its index (0 for A etc.) in *index_out and its LBA range in *first and *last */
+static enum iost find_payload(struct async_blockdev *blk, u8 *partition_table_buffer, size_t table_buf_size, u32 *index_out, u64 *first_out, u64 *last_out) {
 	assert(blk->block_size <= 8192 && blk->block_size >= 128);
 	assert(blk->block_size % 128 == 0);
 	enum iost res;
-	if (IOST_OK != (res = blk->start(blk, 0, partition_table_buffer, partition_table_buffer + sizeof(partition_table_buffer)))) {
+	if (IOST_OK != (res = blk->start(blk, 0, partition_table_buffer, partition_table_buffer + table_buf_size))) {
 		puts("couldn't kick off partition table read");
 		return res;
 	}
@@ -96,7 +104,7 @@ enum iost boot_blockdev(struct async_blockdev *blk) {
 			res = blk->start(blk,
 				2 + i / entries_per_block,
 				partition_table_buffer,
-				partition_table_buffer + sizeof(partition_table_buffer)
+				partition_table_buffer + table_buf_size
 			);
 			if (res != IOST_OK) {return res;}
 			buf = blk->async.pump(&blk->async, 0, 128);
@@ -142,15 +150,70 @@ enum iost boot_blockdev(struct async_blockdev *blk) {
 	u32 used_index = 0;
 	if (mask == 2 || mask == 6) {used_index = 1;}
 	if (mask == 4 || mask == 5) {used_index = 2;}
-	u64 used_first = first[used_index], used_last = last[used_index];
+	*index_out = used_index;
+	*first_out = first[used_index];
+	*last_out = last[used_index];
 	str[0] = 'A' + used_index;
 	printf("using payload %s\n", str);
-	u32 max_length = ((60 << 20) + blk->block_size - 1) / blk->block_size;
+	return IOST_OK;
+}
+
+/* reads ahead while the media before this one are tried, until CONFIG_PAYLOAD_PREFETCH bytes are buffered or the medium is cued */
+static enum iost prefetch(struct async_blockdev *blk, enum boot_medium medium) {
+	size_t have = 0;
+	while (have < CONFIG_PAYLOAD_PREFETCH) {
+		enum boot_medium cue = get_boot_cue();
+		if (cue == medium || cue == BOOT_CUE_EXIT) {break;}
+		struct async_buf buf = blk->async.pump(&blk->async, 0, have + 1);
+		if (buf.end < buf.start) {return buf.start - buf.end;}
+		/* the stream ended or the ring is full */
+		if ((size_t)(buf.end - buf.start) <= have) {break;}
+		have = buf.end - buf.start;
+	}
+	info("prefetched %zu bytes\n", have);
+	return IOST_OK;
+}
+
+enum iost boot_blockdev(struct async_blockdev *blk, enum boot_medium medium) {
+	/* the monitor may cue us while the partition table is still being parsed */
+	boot_medium_ready(medium);
+	u32 used_index;
+	u64 used_first, used_last;
+	u8 *partition_table_buffer = partition_table_buffers[medium];
+	enum iost res = find_payload(blk, partition_table_buffer, sizeof(partition_table_buffers[medium]), &used_index, &used_first, &used_last);
+	if (res != IOST_OK) {return res;}
+	boot_medium_payload_location(medium, used_index, used_first, used_last);
+	u64 max_size = blk->start_ring ? payload_stream_max : 60 << 20;
+	u32 max_length = (max_size + blk->block_size - 1) / blk->block_size;
 	if (used_last - used_first >= max_length) {
 		puts("selected payload partition is larger than the buffer, clipping");
 		used_last = used_first + max_length - 1;
 	}
-	if (IOST_OK != (res = blk->start(blk, used_first, blob_buffer.start, blob_buffer.end))) {return res;}
-	if (IOST_OK != (res = decompress_payload(&blk->async))) {return IOST_INVALID;}
+	/* stop at the end of the partition, so readahead doesn't run into unrelated data */
+	u64 payload_size = (used_last - used_first + 1) * blk->block_size;
+	u8 *empty = partition_table_buffer;
+	if (blk->start_ring) {
+		res = blk->start_ring(blk, used_first, payload_size, get_payload_ring(medium), payload_stream(medium));
+		if (res != IOST_OK) {return res;}
+		if (IOST_OK != (res = prefetch(blk, medium))) {
+			if (blk->start(blk, used_first, empty, empty) == IOST_GLOBAL) {return IOST_GLOBAL;}
+			return res;
+		}
+		if (!wait_for_boot_cue(medium)) {
+			/* end the transfer, so DMA is not left running into our ring */
+			if (blk->start(blk, used_first, empty, empty) == IOST_GLOBAL) {return IOST_GLOBAL;}
+			return IOST_INVALID;
+		}
+	} else {
+		/* blob_buffer is shared between the media, so it may only be used after the cue */
+		if (!wait_for_boot_cue(medium)) {return IOST_INVALID;}
+		res = blk->start(blk, used_first, blob_buffer.start, blob_buffer.start + payload_size);
+		if (res != IOST_OK) {return res;}
+	}
+	if (IOST_OK != (res = decompress_payload(&blk->async))) {
+		/* end the transfer, so no DMA is left running into the buffer */
+		if (blk->start(blk, used_first, empty, empty) == IOST_GLOBAL) {return IOST_GLOBAL;}
+		return IOST_INVALID;
+	}
 	return IOST_OK;
 }
@@ -2,9 +2,12 @@
 #include <rk3399/dramstage.h>
 #include <assert.h>
 
+#include <binlog.h>
+#include <boot_timeline.h>
 #include <die.h>
 #include <fdt.h>
 #include <log.h>
+#include <runqueue.h>
 
 #include <rkgpio_regs.h>
 #include <rkpll.h>
@@ -14,6 +17,7 @@
 #include <rk3399/dram_size.h>
 #include <rk3399/payload.h>
 #include <stage.h>
+#include <string.h>
 
 #include TF_A_BL_COMMON_PATH
 #include TF_A_RK_PARAMS_PATH
@@ -106,22 +110,24 @@ static void load_elf(const struct elf_header *header) {
 		u64 alignment = ph->alignment;
 		(void)alignment;
 		assert(alignment % 16 == 0);
-		const u64 words_copied = (ph->file_size + 7) >> 3;
-		const u64 words_clear = ((ph->mem_size + 7) >> 3) - words_copied;
-		const u64 *src = (const u64 *)((u64)header + ph->offset);
-		const u64 *end = (const u64 *)ph->vaddr + words_copied;
-		u64 *dest = (u64*)ph->vaddr;
-		debug("copying to %"PRIx64"–%"PRIx64"\n", dest, (u64)end);
-		while (dest < end) {*dest++ = *src++;}
-		end += words_clear;
-		debug("clearing to %"PRIx64"\n", (u64)end);
-		while (dest < end) {*dest++ = 0;}
+		assert(ph->mem_size >= ph->file_size);
+		u8 *dest = (u8 *)ph->vaddr;
+		debug("copying to %"PRIx64"–%"PRIx64"\n", ph->vaddr, ph->vaddr + ph->file_size);
+		memcpy(dest, (const u8 *)header + ph->offset, ph->file_size);
+		debug("clearing to %"PRIx64"\n", ph->vaddr + ph->mem_size);
+		memset(dest + ph->file_size, 0, ph->mem_size - ph->file_size);
 	}
 }
 
 void next_stage(u64, u64, u64, u64, u64, u64);
 
 _Noreturn void commit(struct payload_desc *payload) {
+#if CONFIG_SCHED_TRACE
+	sched_trace_dump();
+#endif
+#if CONFIG_BINLOG
+	binlog_dump();
+#endif
 	/* GPIO0B3: White and green LED on the RockPro64 and Pinebook Pro respectively, not connected on the Rock Pi 4 */
 	regmap_gpio0->port |= 1 << 11;
 	regmap_gpio0->direction |= 1 << 11;
@@ -130,6 +136,7 @@ _Noreturn void commit(struct payload_desc *payload) {
 
 	pull_entropy(0);
 
+	boot_timeline_add(BOOT_EVENT_COMMIT, 0);
 	struct fdt_addendum fdt_add = {
 		.fdt_address = fdt_out_addr,
 		.dram_start = DRAM_START + TZRAM_SIZE,
@@ -137,6 +144,7 @@ _Noreturn void commit(struct payload_desc *payload) {
 		.entropy = entropy_buffer,
 		.entropy_words = entropy_words,
 		.boot_cpu = 0,
+		.timeline = boot_timeline_get(),
 #ifdef CONFIG_DRAMSTAGE_INITCPIO
 		.initcpio_start = (u64)payload->initcpio_start,
 		.initcpio_end = (u64)payload->initcpio_end,
@@ -4,17 +4,21 @@
 #include <assert.h>
 #include <stdatomic.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include <die.h>
 #include <log.h>
 #include <async.h>
+#include <boot_timeline.h>
 #include <timer.h>
 #include <compression.h>
 #include <runqueue.h>
 #include <dump_mem.h>
 #include <iost.h>
+#include <arch/context.h>
 
-static _Alignas(16) u8 decomp_state[1 << 14];
+enum {DECOMP_STATE_SIZE = 1 << 14};
+static _Alignas(16) u8 decomp_state[DECOMP_STATE_SIZE];
 extern const struct decompressor lz4_decompressor, gzip_decompressor, zstd_decompressor;
 
 const struct format {
@@ -49,13 +53,13 @@ static const char *const decode_status_msg[NUM_DECODE_STATUS] = {
 #undef X
 };
 
-static enum iost decompress(struct async_transfer *async, u8 *out, u8 **out_end) {
+static enum iost decompress(struct async_transfer *async, u8 *out, u8 **out_end, u8 *state_buf) {
 #ifdef ASYNC_WAIT
 	{enum iost res;
 		if (IOST_OK != (res = async_wait(async))) {return res;}
 	}
 #endif
-	struct decompressor_state *state = (struct decompressor_state *)decomp_state;;
+	struct decompressor_state *state = (struct decompressor_state *)state_buf;
 	u64 start = get_timestamp();
 	struct async_buf buf = async->pump(async, 0, 1);
 	if (buf.end < buf.start) {return buf.start - buf.end;}
@@ -67,7 +71,7 @@ static enum iost decompress(struct async_transfer *async, u8 *out, u8 **out_end)
 			if (buf.end < buf.start) {return buf.start - buf.end;}
 		}
 		if (status <= COMPR_PROBE_LAST_SUCCESS) {
-			assert(sizeof(decomp_state) >= formats[i].decomp->state_size);
+			assert(DECOMP_STATE_SIZE >= formats[i].decomp->state_size);
 			info("%s probed\n", formats[i].name);
 			{const u8 *data = formats[i].decomp->init(state, buf.start, buf.end);
 				assert(data);
@@ -77,11 +81,17 @@ static enum iost decompress(struct async_transfer *async, u8 *out, u8 **out_end)
 			state->out = state->window_start = out;
 			debug("output buffer: 0x%"PRIx64"–0x%"PRIx64"\n", (u64)out, (u64)*out_end);
 			state->out_end = *out_end;
+			/* checksum the output while waiting for input instead of on the decode path */
+			state->checksum.deferred = 1;
+			u8 *checked = out;
 			while (state->decode) {
 				if (!buf.start) {return IOST_INVALID;}
+				/* at SCHED_PRIO_HIGH this only lets in the I/O threads every CONFIG_SCHED_MAX_STREAK rounds, see sched_unqueue */
 				sched_yield();
 				size_t res = state->decode(state, buf.start, buf.end);
 				if (res == DECODE_NEED_MORE_DATA) {
+					checksum_update(&state->checksum, checked, state->out - checked);
+					checked = state->out;
 					size_t min_size = buf.end - buf.start + 1;
 					buf = async->pump(async, 0, min_size);
 					if (buf.end < buf.start) {return buf.start - buf.end;}
@@ -95,6 +105,11 @@ static enum iost decompress(struct async_transfer *async, u8 *out, u8 **out_end)
 				info("decompression failed, status: %zu (%s)\n", res, decode_status_msg[res]);
 				return IOST_INVALID;
 			}
+			checksum_update(&state->checksum, checked, state->out - checked);
+			if (!checksum_verify(&state->checksum)) {
+				info("content checksum mismatch: expected %08"PRIx32", computed %08"PRIx32"\n", state->checksum.expected, checksum_value(&state->checksum));
+				return IOST_INVALID;
+			}
 			info("decompressed %zu bytes in %zu μs\n", state->out - out, (get_timestamp() - start) / TICKS_PER_MICROSECOND);
 			*out_end = state->out;
 			return IOST_OK;
@@ -107,18 +122,401 @@ static enum iost decompress(struct async_transfer *async, u8 *out, u8 **out_end)
 	return IOST_INVALID;
 }
 
-enum iost decompress_payload(struct async_transfer *async) {
-	struct payload_desc *payload = get_payload_desc();
-	payload->elf_end -= LZCOMMON_BLOCK;
+/* finds the end of the frame at the start of the stream by walking its block headers, leaving it unconsumed.
+ * sets *size to 0 if the frame can only be delimited by decoding it. */
+static enum iost delimit_frame(struct async_transfer *async, size_t *size) {
+	*size = 0;
+	struct async_buf buf = async->pump(async, 0, 1);
+	if (buf.end < buf.start) {return buf.start - buf.end;}
+	for_array(i, formats) {
+		size_t UNUSED probed_size;
+		enum compr_probe_status status;
+		while ((status = formats[i].decomp->probe(buf.start, buf.end, &probed_size)) == COMPR_PROBE_NOT_ENOUGH_DATA) {
+			size_t min_size = buf.end - buf.start + 1;
+			buf = async->pump(async, 0, min_size);
+			if (buf.end < buf.start) {return buf.start - buf.end;}
+			if ((size_t)(buf.end - buf.start) < min_size) {return IOST_OK;}
+		}
+		if (status > COMPR_PROBE_LAST_SUCCESS) {continue;}
+		if (!formats[i].decomp->frame_size) {return IOST_OK;}
+		while (1) {
+			size_t res = formats[i].decomp->frame_size(buf.start, buf.end);
+			if (res >= NUM_DECODE_STATUS) {
+				*size = res - NUM_DECODE_STATUS;
+				return IOST_OK;
+			}
+			if (res != DECODE_NEED_MORE_DATA) {return IOST_OK;}
+			size_t min_size = buf.end - buf.start + 1;
+			buf = async->pump(async, 0, min_size);
+			if (buf.end < buf.start) {return buf.start - buf.end;}
+			/* truncated stream: let the decoder report it */
+			if ((size_t)(buf.end - buf.start) < min_size) {return IOST_OK;}
+		}
+	}
+	return IOST_OK;
+}
+
+/* finds a chunk index at the start of the stream. sets *size to its size, or to 0 if there is none */
+static enum iost probe_chunk_index(struct async_transfer *async, size_t *size) {
+	*size = 0;
+	struct async_buf buf = async->pump(async, 0, 1);
+	if (buf.end < buf.start) {return buf.start - buf.end;}
+	enum compr_probe_status status;
+	while ((status = chunk_index_probe(buf.start, buf.end, size)) == COMPR_PROBE_NOT_ENOUGH_DATA) {
+		size_t min_size = buf.end - buf.start + 1;
+		buf = async->pump(async, 0, min_size);
+		if (buf.end < buf.start) {return buf.start - buf.end;}
+		if ((size_t)(buf.end - buf.start) < min_size) {break;}
+	}
+	if (status == COMPR_PROBE_SIZE_KNOWN) {return IOST_OK;}
+	*size = 0;
+	if (status == COMPR_PROBE_RESERVED_FEATURE) {
+		infos("malformed chunk index\n");
+		return IOST_INVALID;
+	}
+	return IOST_OK;
+}
+
+/* finds a stored frame at the start of the stream. sets *data_offset and *size to the position and size of its data, or *data_offset to 0 if there is none */
+static enum iost probe_stored(struct async_transfer *async, size_t *data_offset, size_t *size) {
+	*data_offset = 0;
+	struct async_buf buf = async->pump(async, 0, 1);
+	if (buf.end < buf.start) {return buf.start - buf.end;}
+	enum compr_probe_status status;
+	while ((status = stored_frame_probe(buf.start, buf.end, data_offset, size)) == COMPR_PROBE_NOT_ENOUGH_DATA) {
+		size_t min_size = buf.end - buf.start + 1;
+		buf = async->pump(async, 0, min_size);
+		if (buf.end < buf.start) {return buf.start - buf.end;}
+		if ((size_t)(buf.end - buf.start) < min_size) {break;}
+	}
+	if (status == COMPR_PROBE_SIZE_KNOWN) {return IOST_OK;}
+	*data_offset = 0;
+	if (status == COMPR_PROBE_RESERVED_FEATURE) {
+		infos("malformed stored frame\n");
+		return IOST_INVALID;
+	}
+	return IOST_OK;
+}
+
+/* copies the next `size` bytes of the stream to `dest` as they come in */
+static enum iost copy_stream(struct async_transfer *async, u8 *dest, size_t size) {
+	while (size) {
+		struct async_buf buf = async->pump(async, 0, 1);
+		if (buf.end < buf.start) {return buf.start - buf.end;}
+		size_t len = buf.end - buf.start;
+		if (!len) {return IOST_INVALID;}
+		if (len > size) {len = size;}
+		memcpy(dest, buf.start, len);
+		dest += len;
+		size -= len;
+		buf = async->pump(async, len, 0);
+		if (buf.end < buf.start) {return buf.start - buf.end;}
+	}
+	return IOST_OK;
+}
+
+/* loads the data of a stored frame. whatever the transfer can redirect is DMA'd straight to `out`, the rest (what was already read ahead, partial blocks at the edges, or everything if the medium has no scatter support) is copied */
+static enum iost load_stored(struct async_transfer *async, size_t data_offset, size_t size, u8 *out, u8 **out_end) {
+	if (size > (size_t)(*out_end - out)) {
+		info("stored component (%zu bytes) does not fit its buffer\n", size);
+		return IOST_INVALID;
+	}
+	u64 start_time = get_timestamp();
+	struct async_buf buf = async->pump(async, 0, data_offset);
+	if (buf.end < buf.start) {return buf.start - buf.end;}
+	if ((size_t)(buf.end - buf.start) < data_offset) {return IOST_INVALID;}
+	buf = async->pump(async, data_offset, 0);
+	if (buf.end < buf.start) {return buf.start - buf.end;}
+	u8 *start = buf.start, *end = start + size;
+	struct async_buf redirected = {end, end};
+	if (async->redirect) {
+		redirected = async->redirect(async, start, end, out);
+		if (redirected.start == redirected.end) {redirected.start = redirected.end = end;}
+	}
 	enum iost res;
-	if (IOST_OK != (res = decompress(async, payload->elf_start, &payload->elf_end))) {return res;}
-	payload->fdt_end -= LZCOMMON_BLOCK;
-	if (IOST_OK != (res = decompress(async, (u8 *)fdt_addr, &payload->fdt_end))) {return res;}
-	payload->kernel_end -= LZCOMMON_BLOCK;
-	if (IOST_OK != (res = decompress(async, (u8 *)payload_addr, &payload->kernel_end))) {return res;}
+	if (IOST_OK != (res = copy_stream(async, out, redirected.start - start))) {return res;}
+	size_t direct = redirected.end - redirected.start;
+	if (direct) {
+		buf = async->pump(async, 0, direct);
+		if (buf.end < buf.start) {return buf.start - buf.end;}
+		if ((size_t)(buf.end - buf.start) < direct) {return IOST_INVALID;}
+		buf = async->pump(async, direct, 0);
+		if (buf.end < buf.start) {return buf.start - buf.end;}
+	}
+	if (IOST_OK != (res = copy_stream(async, out + (redirected.end - start), end - redirected.end))) {return res;}
+	info("loaded %zu stored bytes (%zu DMA'd directly) in %zu μs\n", size, direct, (get_timestamp() - start_time) / TICKS_PER_MICROSECOND);
+	*out_end = out + size;
+	return IOST_OK;
+}
+
+/* a unit of work for the decompression workers: a whole payload component or one chunk of an indexed component */
+struct decomp_item {
+	const u8 *in, *in_end;
+	u8 *out, *out_end;
+	/* if set, out_end is written back here when the item is done */
+	u8 **report_end;
+	u32 in_size;
+	/* chunks must decompress to exactly out_end - out bytes */
+	_Bool exact_size;
+	/* the next item's output starts at out_end, so the decoder scratch space overlaps it */
+	_Bool has_next;
+	_Atomic(u8) state;
+	enum iost res;
+	u8 head[2 * LZCOMMON_BLOCK];
+};
+enum {ITEM_FREE, ITEM_PENDING, ITEM_RUNNING, ITEM_DONE};
+/* chunks get LZCOMMON_BLOCK of slack before out_end and may write LZCOMMON_BLOCK beyond that */
+enum {CHUNK_OVERRUN = 2 * LZCOMMON_BLOCK, MAX_DECOMP_ITEMS = 64};
+_Static_assert(sizeof(((struct decomp_item *)0)->head) == CHUNK_OVERRUN, "chunk head buffer does not cover the overrun");
+
+struct decomp_worker {
+	struct thread thread;
+	struct decomp_item *item;
+	_Alignas(16) u8 state[DECOMP_STATE_SIZE];
+};
+
+static struct decomp_item items[MAX_DECOMP_ITEMS];
+static u32 num_items;
+static struct decomp_worker workers[NUM_CPU];
+_Static_assert(VSTACK_DECOMP0 + NUM_CPU <= NUM_VSTACK, "not enough decompression vstacks");
+
+static void run_item(struct decomp_worker *worker) {
+	struct decomp_item *item = worker->item;
+	struct async_dummy async = {
+		.async = {async_pump_dummy},
+		.buf = {(u8 *)item->in, (u8 *)item->in_end},
+	};
+	u8 *end = item->exact_size ? item->out_end + LZCOMMON_BLOCK : item->out_end;
+	item->res = decompress(&async.async, item->out, &end, worker->state);
+	if (item->res == IOST_OK && item->exact_size && end != item->out_end) {
+		info("chunk decompressed to %zu bytes, index says %zu\n", end - item->out, item->out_end - item->out);
+		item->res = IOST_INVALID;
+	}
+	item->out_end = end;
+	/* no neighbour was running, so the head is intact right now */
+	for_array(i, item->head) {item->head[i] = item->out[i];}
+	atomic_store_explicit(&item->state, ITEM_DONE, memory_order_release);
+}
+
+/* adjacent chunks must not run at the same time, since the earlier one scribbles over the head of the later one, which it may still need as match source */
+static _Bool neighbours_idle(u32 i) {
+	if (i > 0 && items[i - 1].has_next && atomic_load_explicit(&items[i - 1].state, memory_order_acquire) == ITEM_RUNNING) {return 0;}
+	if (items[i].has_next && atomic_load_explicit(&items[i + 1].state, memory_order_acquire) == ITEM_RUNNING) {return 0;}
+	return 1;
+}
+
+static void retire(struct decomp_item *item) {
+	struct decomp_item *next = item + 1;
+	/* if the next chunk already finished, our scratch writes have clobbered its head. otherwise it will overwrite them itself */
+	if (item->has_next && atomic_load_explicit(&next->state, memory_order_acquire) == ITEM_DONE) {
+		for_array(i, next->head) {next->out[i] = next->head[i];}
+	}
+}
+
+/* retires finished items and hands pending ones to idle workers. returns whether all work is done */
+static _Bool dispatch(u32 cpus, _Bool start_new) {
+	_Bool idle = 1;
+	for_range(k, 0, NUM_CPU) {
+		/* prefer the secondary CPUs, CPU0 also has to drive the I/O */
+		u32 cpu = (k + 1) % NUM_CPU;
+		struct decomp_worker *worker = workers + cpu;
+		if (worker->item) {
+			if ((atomic_load_explicit(&worker->thread.status, memory_order_acquire) & 0xf) != THREAD_DEAD) {
+				idle = 0;
+				continue;
+			}
+			retire(worker->item);
+			worker->item = 0;
+		}
+		if (!start_new || (~cpus & 1 << cpu)) {continue;}
+		for_range(i, 0, num_items) {
+			if (atomic_load_explicit(&items[i].state, memory_order_relaxed) != ITEM_PENDING || !neighbours_idle(i)) {continue;}
+			atomic_store_explicit(&items[i].state, ITEM_RUNNING, memory_order_relaxed);
+			worker->item = items + i;
+			worker->thread = THREAD_START_STATE(VSTACK_BASE(VSTACK_DECOMP0 + cpu), run_item, (u64)worker);
+			worker->thread.runnable.priority = SCHED_PRIO_HIGH;
+#if CONFIG_SCHED_TRACE
+			sched_trace_name(&worker->thread.runnable, "decompress_worker");
+#endif
+			sched_queue_on_cpu(cpu, &worker->thread.runnable);
+			idle = 0;
+			break;
+		}
+	}
+	if (start_new) {
+		for_range(i, 0, num_items) {
+			if (atomic_load_explicit(&items[i].state, memory_order_relaxed) == ITEM_PENDING) {return 0;}
+		}
+	}
+	return idle;
+}
+
+/* on transfers that recycle consumed space, holds the input of the first item that is not done. returns whether anything is held */
+static _Bool update_hold(struct async_transfer *async) {
+	if (!async->hold) {return 0;}
+	for_range(i, 0, num_items) {
+		u8 state = atomic_load_explicit(&items[i].state, memory_order_acquire);
+		if (state == ITEM_PENDING || state == ITEM_RUNNING) {
+			async->hold(async, items[i].in);
+			return 1;
+		}
+	}
+	async->hold(async, 0);
+	return 0;
+}
+
+/* wraps the payload transfer: if the input held for the items leaves no room in a ring buffer, the pump waits for them to finish */
+struct payload_stream {
+	struct async_transfer async;
+	struct async_transfer *inner;
+	u32 cpus;
+};
+
+static struct async_buf stream_pump(struct async_transfer *async, size_t consume, size_t min_size) {
+	struct payload_stream *stream = (struct payload_stream *)async;
+	struct async_buf buf = stream->inner->pump(stream->inner, consume, min_size);
+	while (buf.end >= buf.start && (size_t)(buf.end - buf.start) < min_size && update_hold(stream->inner)) {
+		dispatch(stream->cpus, 1);
+		if (update_hold(stream->inner)) {usleep(100);}
+		buf = stream->inner->pump(stream->inner, 0, min_size);
+	}
+	return buf;
+}
+
+static struct async_buf stream_redirect(struct async_transfer *async, u8 *start, u8 *end, u8 *dest) {
+	struct async_transfer *inner = ((struct payload_stream *)async)->inner;
+	return inner->redirect(inner, start, end, dest);
+}
+
+/* waits for the input of the item to be loaded, then queues it */
+static enum iost queue_item(struct payload_stream *stream, struct decomp_item *item) {
+	struct async_transfer *async = &stream->async;
+	struct async_buf buf = async->pump(async, 0, item->in_size);
+	if (buf.end < buf.start) {return buf.start - buf.end;}
+	if ((size_t)(buf.end - buf.start) < item->in_size) {
+		info("frame of %"PRIu32" bytes does not fit the load buffer\n", item->in_size);
+		return IOST_INVALID;
+	}
+	item->in = buf.start;
+	item->in_end = buf.start + item->in_size;
+	item->res = IOST_OK;
+	atomic_store_explicit(&item->state, ITEM_PENDING, memory_order_relaxed);
+	update_hold(stream->inner);
+	dispatch(stream->cpus, 1);
+	buf = async->pump(async, item->in_size, 0);
+	if (buf.end < buf.start) {return buf.start - buf.end;}
+	return IOST_OK;
+}
+
+static enum iost load_chunks(struct payload_stream *stream, size_t index_size, u8 *out, u8 **out_end) {
+	struct async_transfer *async = &stream->async;
+	struct async_buf buf = async->pump(async, 0, index_size);
+	if (buf.end < buf.start) {return buf.start - buf.end;}
+	if ((size_t)(buf.end - buf.start) < index_size) {return IOST_INVALID;}
+	u32 num_chunks = chunk_index_num_chunks(buf.start);
+	if (num_chunks > MAX_DECOMP_ITEMS - num_items) {
+		info("%"PRIu32" chunks are too many\n", num_chunks);
+		return IOST_INVALID;
+	}
+	u64 total = 0;
+	for_range(c, 0, num_chunks) {
+		struct chunk_index_entry entry = chunk_index_entry(buf.start, c);
+		if (c + 1 < num_chunks && entry.decompressed_size < CHUNK_OVERRUN) {
+			info("chunk %"PRIu32" is too small\n", c);
+			return IOST_INVALID;
+		}
+		total += entry.decompressed_size;
+	}
+	if (total + LZCOMMON_BLOCK > (u64)(*out_end - out)) {
+		info("chunked component (%"PRIu64" bytes) does not fit its buffer\n", total);
+		return IOST_INVALID;
+	}
+	info("%"PRIu32" chunks, %"PRIu64" bytes\n", num_chunks, total);
+	u32 first = num_items;
+	u8 *chunk_out = out;
+	for_range(c, 0, num_chunks) {
+		struct chunk_index_entry entry = chunk_index_entry(buf.start, c);
+		struct decomp_item *item = items + num_items++;
+		item->in_size = entry.compressed_size;
+		item->out = chunk_out;
+		item->out_end = chunk_out += entry.decompressed_size;
+		item->report_end = 0;
+		item->exact_size = 1;
+		item->has_next = c + 1 < num_chunks;
+	}
+	*out_end = out + total;
+	buf = async->pump(async, index_size, 0);
+	if (buf.end < buf.start) {return buf.start - buf.end;}
+	for_range(i, first, num_items) {
+		enum iost res = queue_item(stream, items + i);
+		if (res != IOST_OK) {return res;}
+	}
+	return IOST_OK;
+}
+
+static enum iost load_payload(struct async_transfer *inner) {
+	struct payload_desc *payload = get_payload_desc();
+	const struct {u8 *out, **out_end;} components[] = {
+		{payload->elf_start, &payload->elf_end},
+		{(u8 *)fdt_addr, &payload->fdt_end},
+		{(u8 *)payload_addr, &payload->kernel_end},
 #ifdef CONFIG_DRAMSTAGE_INITCPIO
-	payload->initcpio_end -= LZCOMMON_BLOCK;
-	if (IOST_OK != (res = decompress(async, (u8 *)initcpio_addr, &payload->initcpio_end))) {return res;}
+		{(u8 *)initcpio_addr, &payload->initcpio_end},
 #endif
+	};
+	num_items = 0;
+	for_array(i, items) {atomic_store_explicit(&items[i].state, ITEM_FREE, memory_order_relaxed);}
+	u32 cpus = secondary_cpus_online() | 1;
+	struct payload_stream stream = {
+		.async = {stream_pump, inner->redirect ? stream_redirect : 0},
+		.inner = inner,
+		.cpus = cpus,
+	};
+	struct async_transfer *async = &stream.async;
+	enum iost res = IOST_OK;
+	for_array(i, components) {
+		u8 *out = components[i].out, **out_end = components[i].out_end;
+		*out_end -= LZCOMMON_BLOCK;
+		size_t size, data_offset;
+		if (IOST_OK != (res = probe_stored(async, &data_offset, &size))) {break;}
+		if (data_offset) {
+			if (IOST_OK != (res = load_stored(async, data_offset, size, out, out_end))) {break;}
+			continue;
+		}
+		if (IOST_OK != (res = probe_chunk_index(async, &size))) {break;}
+		if (size) {
+			if (IOST_OK != (res = load_chunks(&stream, size, out, out_end))) {break;}
+			continue;
+		}
+		if (cpus != 1 && IOST_OK != (res = delimit_frame(async, &size))) {break;}
+		if (!size) {
+			/* no secondary CPU or no way to find the end of the frame: decode it here */
+			if (IOST_OK != (res = decompress(async, out, out_end, decomp_state))) {break;}
+			continue;
+		}
+		if (num_items == MAX_DECOMP_ITEMS) {res = IOST_INVALID; break;}
+		struct decomp_item *item = items + num_items++;
+		item->in_size = size;
+		item->out = out;
+		item->out_end = *out_end;
+		item->report_end = out_end;
+		item->exact_size = item->has_next = 0;
+		if (IOST_OK != (res = queue_item(&stream, item))) {break;}
+	}
+	/* the workers use blob_buffer and the output buffers, so they have to be finished before returning, even on error */
+	while (!dispatch(cpus, res == IOST_OK)) {usleep(100);}
+	update_hold(inner);
+	if (res != IOST_OK) {return res;}
+	for_range(i, 0, num_items) {
+		if (items[i].res != IOST_OK) {return items[i].res;}
+		if (items[i].report_end) {*items[i].report_end = items[i].out_end;}
+	}
 	return IOST_OK;
 }
+
+enum iost decompress_payload(struct async_transfer *inner) {
+	boot_timeline_add(BOOT_EVENT_DECOMPRESS_START, 0);
+	enum iost res = load_payload(inner);
+	boot_timeline_add(BOOT_EVENT_DECOMPRESS_END, res);
+	return res;
+}
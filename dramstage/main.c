@@ -5,11 +5,13 @@
 #include <inttypes.h>
 
 #include <async.h>
+#include <boot_timeline.h>
 #include <iost.h>
 #include <runqueue.h>
 
 #include <irq.h>
 #include <mmu.h>
+#include <plat/sched.h>
 #include <arch/context.h>
 
 #include <dwmmc.h>
@@ -53,6 +55,8 @@ extern struct sdhci_state emmc_state;
 extern struct async_transfer spi1_async, sdmmc_async;
 extern struct rkspi_xfer_state spi1_state;
 extern struct dwmmc_state sdmmc_state;
+/* falling edges seen on the override button (GPIO0_A5) */
+static _Atomic(u32) override_presses = 0;
 
 void plat_handler_fiq() {
 	u64 grp0_intid;
@@ -69,12 +73,20 @@ void plat_handler_fiq() {
 		rkspi_handle_interrupt(&spi1_state, regmap_spi1);
 		dsb_sy();
 		break;
+	case 39: case 40:	/* DMAC_PERI */
+		spi1_handle_dma_interrupt();
+		dsb_sy();
+		break;
 #endif
 #if CONFIG_SD
 	case 97:
 		dwmmc_irq(&sdmmc_state);
 		break;
 #endif
+	case 46:	/* GPIO0 */
+		regmap_gpio0->eoi = regmap_gpio0->interrupt_status;
+		atomic_fetch_add_explicit(&override_presses, 1, memory_order_relaxed);
+		break;
 	case 101:	/* stimer0 */
 		regmap_stimer0[0].interrupt_status = 1;
 		pull_entropy(1);
@@ -83,6 +95,7 @@ void plat_handler_fiq() {
 #else
 		dsb_st();	/* apparently the interrupt clear isn't fast enough, wait for completion */
 #endif
+		sched_expire_timers(get_timestamp());
 #if CONFIG_EMMC
 		sdhci_wake_threads(&emmc_state);
 #endif
@@ -111,6 +124,8 @@ void plat_handler_irq() {
 
 static struct payload_desc payload_descriptor;
 
+void plat_timer_set_deadline(timestamp_t deadline) {rktimer_set_deadline(regmap_stimer0, deadline);}
+
 struct payload_desc *get_payload_desc() {
 	struct payload_desc *payload = &payload_descriptor;
 	payload->elf_start = (u8 *)elf_addr;
@@ -123,13 +138,26 @@ struct payload_desc *get_payload_desc() {
 #if CONFIG_DRAMSTAGE_INITCPIO
 	payload->initcpio_start = (u8 *)initcpio_addr;
 	payload->initcpio_end = (u8 *)(DRAM_START + dram_size(regmap_pmugrf));
+#if CONFIG_BOOT_ARBITRATION
+	/* the other block devices may still be loading into their rings, the last one's is the lowest */
+	payload->initcpio_end = get_payload_ring(NUM_BLOCK_MEDIUM - 1).start;
+#endif
 #endif
 	return payload;
 }
 
-static struct sched_runqueue runqueue = {.head = 0, .tail = &runqueue.head};
-
-struct sched_runqueue *get_runqueue() {return &runqueue;}
+struct async_buf get_payload_ring(enum boot_medium medium) {
+	assert(medium < NUM_BLOCK_MEDIUM);
+#if CONFIG_BOOT_ARBITRATION
+	/* the top of 4 GiB configurations is shadowed by MMIO */
+	u64 dram_end = DRAM_START + dram_size(regmap_pmugrf);
+	if (dram_end > 0xf8000000) {dram_end = 0xf8000000;}
+	u8 *end = (u8 *)dram_end - medium * (u64)CONFIG_PAYLOAD_RING_SIZE;
+#else
+	u8 *end = blob_buffer.start + (medium + 1) * (u64)CONFIG_PAYLOAD_RING_SIZE;
+#endif
+	return (struct async_buf) {end - CONFIG_PAYLOAD_RING_SIZE, end};
+}
 
 _Static_assert(32 >= 3 * NUM_BOOT_MEDIUM, "not enough bits for boot medium");
 static const size_t available_boot_media = 0
@@ -183,21 +211,84 @@ void boot_medium_loaded(enum boot_medium medium) {
 	sched_queue_list(CURRENT_RUNQUEUE, &boot_monitors);
 }
 
-_Bool wait_for_boot_cue(enum boot_medium medium) {
+void boot_medium_ready(enum boot_medium medium) {
 	atomic_fetch_or_explicit(&boot_state, 2 << 4*medium, memory_order_release);
 	sched_queue_list(CURRENT_RUNQUEUE, &boot_monitors);
+}
+
+static struct boot_hint payload_locations[NUM_BOOT_MEDIUM] = {};
+
+void boot_medium_payload_location(enum boot_medium medium, u8 partition, u64 first_lba, u64 last_lba) {
+	payload_locations[medium].partition = partition;
+	payload_locations[medium].first_lba = first_lba;
+	payload_locations[medium].last_lba = last_lba;
+}
+
+static struct async_stats io_stats[NUM_BOOT_MEDIUM] = {};
+
+struct async_stats *get_io_stats(enum boot_medium medium) {return io_stats + medium;}
+
+static void report_io_stats() {
+	puts("medium\t      KiB  requests   wait μs  cache μs");
+	for_range(i, 0, NUM_BOOT_MEDIUM) {
+		const struct async_stats *st = io_stats + i;
+		if (!st->requests && !st->bytes) {continue;}
+		u64 wait_us = st->wait_ticks / TICKS_PER_MICROSECOND, cache_us = st->cache_ticks / TICKS_PER_MICROSECOND;
+		printf("%s\t%9"PRIu64"%10"PRIu32"%10"PRIu64"%10"PRIu64"\n", boot_medium_names[i], st->bytes >> 10, st->requests, wait_us, cache_us);
+		printf("  latency histogram (64 μs << i):");
+		for_array(b, st->latency) {printf(" %"PRIu32, st->latency[b]);}
+		puts("");
+		boot_timeline_add(BOOT_EVENT_IO_MEDIUM, i);
+		boot_timeline_add(BOOT_EVENT_IO_KIB, st->bytes >> 10);
+		boot_timeline_add(BOOT_EVENT_IO_REQUESTS, st->requests);
+		boot_timeline_add(BOOT_EVENT_IO_WAIT_US, wait_us);
+		boot_timeline_add(BOOT_EVENT_IO_CACHE_US, cache_us);
+	}
+}
+
+#if CONFIG_BOOT_HINT
+/* set in boot_state once boot_spi has read the hint */
+static const u32 hint_read_bit = 1 << 4*NUM_BOOT_MEDIUM;
+_Static_assert(4 * NUM_BOOT_MEDIUM < 32, "no bit left for the boot hint");
+static struct boot_hint boot_hint = {.medium = NUM_BOOT_MEDIUM};
+
+void boot_hint_read(const struct boot_hint *hint) {
+	if (hint) {boot_hint = *hint;}
+	atomic_fetch_or_explicit(&boot_state, hint_read_bit, memory_order_release);
+	sched_queue_list(CURRENT_RUNQUEUE, &boot_monitors);
+}
+
+static void update_boot_hint(u32 state, enum boot_medium medium) {
+	struct boot_hint hint = payload_locations[medium];
+	hint.medium = medium;
+	if (hint.medium == boot_hint.medium && hint.partition == boot_hint.partition && hint.first_lba == boot_hint.first_lba && hint.last_lba == boot_hint.last_lba) {return;}
+	/* the SPI controller is ours once boot_spi is done */
+	monitor_boot_state(state, 1 << 4*BOOT_MEDIUM_SPI, 0);
+	printf("updating boot hint to %s\n", boot_medium_names[medium]);
+	if (!spi_write_boot_hint(&hint)) {printf("could not write the boot hint, skipping it\n");}
+}
+#endif
+
+enum boot_medium get_boot_cue() {
+	return atomic_load_explicit(&current_boot_cue, memory_order_acquire);
+}
+
+_Bool wait_for_boot_cue(enum boot_medium medium) {
+	boot_medium_ready(medium);
 	while (1) {
 		u32 curr = atomic_load_explicit(&current_boot_cue, memory_order_acquire);
 		if (curr == BOOT_CUE_EXIT) {
 			return 0;
 		} else if (curr == medium) {
+			/* this thread now feeds the payload decompression, which is on the critical path */
+			sched_set_priority(SCHED_PRIO_HIGH);
 			return 1;
 		}
 		call_cc_ptr2_int2(sched_finish_u32, &current_boot_cue, &boot_cue_waiters, ~(u32)0, curr);
 	}
 }
 
-static u64 _Alignas(4096) UNINITIALIZED pagetable_frames[20][512];
+static u64 _Alignas(4096) UNINITIALIZED pagetable_frames[24][512];
 u64 (*const pagetables)[512] = pagetable_frames;
 const size_t num_pagetables = ARRAY_SIZE(pagetable_frames);
 
@@ -215,17 +306,40 @@ static void boot_monitor() {
 #endif
 		goto out;
 	}
+	/* count presses of the override button from here on, instead of sampling it at a fixed time */
+	regmap_gpio0->interrupt_enable &= ~32;
+	regmap_gpio0->debounce |= 32;
+	regmap_gpio0->interrupt_type |= 32;	/* edge-triggered */
+	regmap_gpio0->interrupt_polarity &= ~32;	/* falling edge, the button is active-low */
+	regmap_gpio0->interrupt_mask &= ~32;
+	regmap_gpio0->eoi = 32;
+	regmap_gpio0->interrupt_enable |= 32;
 	u32 state = atomic_load_explicit(&boot_state, memory_order_acquire);
+	/* the available media in the order they are cued */
+	enum boot_medium order[NUM_BOOT_MEDIUM];
+	u32 num_media = 0;
+#if CONFIG_BOOT_HINT
+	state = monitor_boot_state(state, hint_read_bit, 0);
+	if (boot_hint.medium < NUM_BOOT_MEDIUM && available_boot_media & 1 << 4*boot_hint.medium) {
+		printf("boot hint: %s\n", boot_medium_names[boot_hint.medium]);
+		order[num_media++] = boot_hint.medium;
+	}
+#endif
+	for_range(medium, 0, NUM_BOOT_MEDIUM) {
+		if (available_boot_media & 1 << 4*medium && !(num_media && order[0] == medium)) {order[num_media++] = medium;}
+	}
 	_Bool payload_loaded = 0;
-	for_range(boot_medium, 0, NUM_BOOT_MEDIUM) {
+	enum boot_medium boot_medium = BOOT_CUE_NONE;
+	for_range(i, 0, num_media) {
+		boot_medium = order[i];
 		u32 exit_bit = 1 << (4*boot_medium);
-		if (~available_boot_media & exit_bit) {continue;}
 		u32 ready_bit = exit_bit << 1;
 		state = monitor_boot_state(state, ready_bit | exit_bit, 0);
 		if (state & exit_bit) {
 			printf("%s failed, going on to next\n", boot_medium_names[boot_medium]);
 			continue;
 		}
+		u32 presses = atomic_load_explicit(&override_presses, memory_order_relaxed);
 		atomic_store_explicit(&current_boot_cue, boot_medium, memory_order_release);
 		sched_queue_list(CURRENT_RUNQUEUE, &boot_cue_waiters);
 		printf("cued %s\n", boot_medium_names[boot_medium]);
@@ -237,11 +351,11 @@ static void boot_monitor() {
 		if (state & loaded_bit) {
 			u64 xfer_end = get_timestamp();
 			printf("[%"PRIuTS"] payload loaded in %"PRIuTS" μs\n", xfer_end, (xfer_end - xfer_start) / CYCLES_PER_MICROSECOND);
-			/* leave the user at least 500 ms to let go for each payload  */
-			while (get_timestamp() - xfer_start < USECS(500000)) {usleep(100);}
 			u32 gpio_bits = regmap_gpio0->read;
 			debug("GPIO0: %"PRIx32"\n", gpio_bits);
-			if ((~gpio_bits & 32) && available_boot_media >> 1 >> boot_medium != 0) {
+			/* skip this payload if the button was pressed since the cue or is still held down */
+			_Bool overridden = (~gpio_bits & 32) || atomic_load_explicit(&override_presses, memory_order_relaxed) != presses;
+			if (overridden && i + 1 < num_media) {
 				printf("boot overridden\n");
 				continue;
 			}
@@ -250,11 +364,15 @@ static void boot_monitor() {
 		}
 		printf("boot medium failed, going on to next\n");
 	}
+	regmap_gpio0->interrupt_enable &= ~32;
 	if (!payload_loaded) {
 		die("no payload available\n");
 	}
 	atomic_store_explicit(&current_boot_cue, BOOT_CUE_EXIT, memory_order_release);
 	sched_queue_list(CURRENT_RUNQUEUE, &boot_cue_waiters);
+#if CONFIG_BOOT_HINT
+	update_boot_hint(state, boot_medium);
+#endif
 
 out:
 	while (atomic_load_explicit(&rk3399_detected_board, memory_order_acquire) == BOARD_UNKNOWN) {
@@ -278,8 +396,31 @@ struct thread threads[] = {
 	THREAD_START_STATE(VSTACK_BASE(VSTACK_SPI), boot_spi, ),
 #endif
 };
+#if CONFIG_SCHED_TRACE
+static const char *const thread_names[] = {
+	"boot_monitor", "rk3399_probe_board",
+#if CONFIG_SD
+	"boot_sd",
+#endif
+#if CONFIG_EMMC
+	"boot_emmc",
+#endif
+#if CONFIG_NVME
+	"boot_nvme",
+#endif
+#if CONFIG_SPI
+	"boot_spi",
+#endif
+};
+_Static_assert(ARRAY_SIZE(thread_names) == ARRAY_SIZE(threads), "thread names out of sync");
+#endif
+
+/* same size as the SRAM copy, so continuing it never reads past the end of that */
+static _Alignas(16) u8 boot_timeline_buf[BOOT_TIMELINE_SRAM_SIZE];
 
 _Noreturn void main() {
+	boot_timeline_init(boot_timeline_buf, sizeof(boot_timeline_buf), (const struct boot_timeline *)BOOT_TIMELINE_SRAM_ADDR);
+	boot_timeline_add(BOOT_EVENT_DRAMSTAGE_START, 0);
 	puts("dramstage");
 
 	/* set DRAM as Non-Secure; needed for DMA */
@@ -295,6 +436,7 @@ _Noreturn void main() {
 		u32 flags;
 	} intids[] = {
 		{43, 0x80, 1, IGROUP_0 | INTR_LEVEL},	/* emmc */
+		{46, 0x80, 1, IGROUP_0 | INTR_LEVEL},	/* GPIO0 */
 		//{85, 0x80, 1, IGROUP_0 | INTR_LEVEL},	/* spi */
 		{97, 0x80, 1, IGROUP_0 | INTR_LEVEL},	/* sd */
 		{101, 0x80, 1, IGROUP_0 | INTR_LEVEL},	/* stimer0 */
@@ -308,16 +450,20 @@ _Noreturn void main() {
 		mmu_map_range(limit, limit + (VSTACK_DEPTH - 1), (u64)&vstack_frames[i][0], MEM_TYPE_NORMAL);
 	}
 	dsb_ishst();
+	start_secondary_cpus();
 	for_array(i, threads) {
+#if CONFIG_SCHED_TRACE
+		sched_trace_name(&threads[i].runnable, thread_names[i]);
+#endif
 		sched_queue_single(CURRENT_RUNQUEUE, (struct sched_runnable *)(threads + i));
 	}
 
 	while (1) {
 		irq_mask();
-		struct sched_runnable *r = sched_unqueue(get_runqueue());
+		struct sched_runnable *r = sched_unqueue_this_cpu();
 		if (r) {
 			irq_unmask();
-			arch_sched_run(r);
+			sched_run(r);
 		} else  {
 			bool quit = true;
 			for_array(i, threads) {
@@ -330,7 +476,7 @@ _Noreturn void main() {
 				irq_unmask();
 				break;
 			}
-			aarch64_wfi();
+			if (!plat_drain_console()) {aarch64_wfi();}
 			irq_unmask();
 		}
 	}
@@ -340,6 +486,8 @@ _Noreturn void main() {
 	}
 	gicv2_wait_disabled(regmap_gic500d);
 	gicv3_per_cpu_teardown(regmap_gic500r);
+	stop_secondary_cpus();
 
+	report_io_stats();
 	commit(payload);
 }
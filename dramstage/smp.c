@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include <rk3399/dramstage.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+
+#include <cache.h>
+#include <log.h>
+#include <runqueue.h>
+#include <timer.h>
+#include <arch/context.h>
+
+#include <rk3399.h>
+#include <stage.h>
+
+/* zero-initialized runqueues are valid, sched_unqueue fixes up the tail pointer */
+static struct sched_runqueue runqueues[NUM_CPU];
+
+static u32 current_cpu() {
+	u64 mpidr;
+	__asm__("mrs %0, MPIDR_EL1" : "=r"(mpidr));
+	return mpidr & 0xff;
+}
+
+struct sched_runqueue *get_runqueue() {
+	return runqueues + current_cpu();
+}
+
+struct sched_runnable *sched_unqueue_this_cpu() {
+	return sched_unqueue_steal(runqueues, NUM_CPU, current_cpu());
+}
+
+struct percpu {
+	u64 stack_top;	/* loaded by reset_entry, must be first */
+	u32 cpu;
+};
+static const struct percpu percpu[NUM_CPU] = {
+	{VSTACK_BASE(VSTACK_CPU0), 0},
+	{VSTACK_BASE(VSTACK_CPU1), 1},
+	{VSTACK_BASE(VSTACK_CPU2), 2},
+	{VSTACK_BASE(VSTACK_CPU3), 3},
+};
+const struct {u64 mpidr; const struct percpu *cpu;} percpu_index[] = {
+	{0x80000001, percpu + 1},
+	{0x80000002, percpu + 2},
+	{0x80000003, percpu + 3},
+	{0, 0}
+};
+
+static const u32 secondary_pd_mask = 0xe;	/* PD_A53_L1–3 */
+static _Atomic(u32) cpus_online = 0;
+static _Atomic(u32) secondary_exit = 0;
+
+u32 secondary_cpus_online() {
+	return atomic_load_explicit(&cpus_online, memory_order_acquire);
+}
+
+void sched_queue_on_cpu(u32 cpu, struct sched_runnable *runnable) {
+	sched_queue_single(&runqueues[cpu].fresh, runnable);
+}
+
+_Noreturn void secondary_cpu_main(const struct percpu *cpu) {
+	__asm__ volatile("msr TPIDR_EL3, xzr");
+	atomic_fetch_or_explicit(&cpus_online, 1 << cpu->cpu, memory_order_release);
+	while (1) {
+		/* no GIC or stimer setup here, so whatever runs (or is stolen) here is never preempted, see sched_unqueue_steal */
+		struct sched_runnable *r = sched_unqueue_steal(runqueues, NUM_CPU, cpu->cpu);
+		if (r) {
+			sched_run(r);
+		} else if (atomic_load_explicit(&secondary_exit, memory_order_acquire)) {
+			break;
+		} else if (!plat_drain_console()) {
+			__asm__ volatile("wfe");
+		}
+	}
+	atomic_fetch_and_explicit(&cpus_online, ~(u32)(1 << cpu->cpu), memory_order_release);
+	cortex_a53_exit(0);
+	__builtin_unreachable();
+}
+
+void start_secondary_cpus() {
+	/* the cluster reset vector must be 64 KiB aligned, so put a trampoline at the start of PMU SRAM. commit overwrites this later when loading BL31 */
+	volatile u32 *trampoline = (volatile u32 *)0xff3b0000;
+	trampoline[0] = 0x58000040;	/* ldr x0, #8 */
+	trampoline[1] = 0xd61f0000;	/* br x0 */
+	*(volatile u64 *)(trampoline + 2) = (u64)reset_entry;
+	flush_range((void *)trampoline, 16);
+	regmap_pmusgrf[PMUSGRF_SOC_CON0 + 1] = 0xffff0000 | 0xff3b;	/* cluster L reset vector [31:16] */
+	dsb_sy();
+
+	static volatile u32 *const pmu = regmap_pmu;
+	pmu[PMU_PWRDN_CON] &= ~secondary_pd_mask;
+	while (pmu[PMU_PWRDN_ST] & secondary_pd_mask) {__asm__("yield");}
+
+	timestamp_t start = get_timestamp();
+	u32 online;
+	while ((online = secondary_cpus_online()) != secondary_pd_mask && get_timestamp() - start < USECS(10000)) {
+		__asm__("yield");
+	}
+	info("[%"PRIuTS"] secondary CPUs online: 0x%"PRIx32"\n", get_timestamp(), online);
+}
+
+void stop_secondary_cpus() {
+	atomic_store_explicit(&secondary_exit, 1, memory_order_release);
+	__asm__ volatile("dsb ish;sev" : : : "memory");
+	while (secondary_cpus_online()) {__asm__("yield");}
+	static volatile u32 *const pmu = regmap_pmu;
+	/* wait until they have flushed their L1D and entered WFI in cortex_a53_exit (the idle loop uses WFE). PMU_CORE_PWR_ST[7:4] are the STANDBYWFI signals of the A53s */
+	while ((pmu[PMU_CORE_PWR_ST] >> 4 & secondary_pd_mask) != secondary_pd_mask) {__asm__("yield");}
+	pmu[PMU_PWRDN_CON] |= secondary_pd_mask;
+	while ((pmu[PMU_PWRDN_ST] & secondary_pd_mask) != secondary_pd_mask) {__asm__("yield");}
+	infos("secondary CPUs powered down\n");
+}
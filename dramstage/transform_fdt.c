@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <stdbool.h>
 
+#include <boot_timeline.h>
 #include <fdt.h>
 #include <log.h>
 #include <die.h>
@@ -12,7 +13,10 @@
 	X(INITRD_START, "linux,initrd-start")\
 	X(INITRD_END, "linux,initrd-end")\
 	X(KASLR_SEED, "kaslr-seed")\
-	X(RNG_SEED, "rng-seed")
+	X(RNG_SEED, "rng-seed")\
+	X(TIMER_FREQUENCY, "levinboot,timer-frequency")\
+	X(BOOT_EVENTS, "levinboot,boot-events")\
+	X(BOOT_TIMELINE, "levinboot,boot-timeline")
 
 enum {
 #define X(name, str) INSSTR_##name,
@@ -66,6 +70,32 @@ static u32 *insert_chosen_props(u32 *out, u32 *out_end, const struct fdt_addendu
 			*out++ = info->entropy[i];
 		}
 	}
+	const struct boot_timeline *tl = info->timeline;
+	if (tl) {
+		/* the records are <event arg timestamp-hi timestamp-lo>, with event indexing into the string list in levinboot,boot-events and the timestamp counting at levinboot,timer-frequency */
+		u32 names_words = (boot_event_names_size + 3) / 4;
+		if ((size_t)(out_end - out) < 13 + names_words + 4 * (size_t)tl->count) {return 0;}
+		*out++ = be32(3);
+		*out++ = be32(4);
+		*out++ = be32(string_offset + INSSTR_OFF_TIMER_FREQUENCY);
+		*out++ = be32(TICKS_PER_MICROSECOND * 1000000);
+		*out++ = be32(3);
+		*out++ = be32(boot_event_names_size);
+		*out++ = be32(string_offset + INSSTR_OFF_BOOT_EVENTS);
+		out[names_words - 1] = 0;
+		memcpy(out, boot_event_names, boot_event_names_size);
+		out += names_words;
+		*out++ = be32(3);
+		*out++ = be32(16 * tl->count);
+		*out++ = be32(string_offset + INSSTR_OFF_BOOT_TIMELINE);
+		for_range(i, 0, tl->count) {
+			const struct boot_timeline_record *rec = tl->records + i;
+			*out++ = be32(rec->event);
+			*out++ = be32(rec->arg);
+			*out++ = be32(rec->timestamp >> 32);
+			*out++ = be32((u32)rec->timestamp);
+		}
+	}
 	return out;
 }
 
@@ -215,8 +245,9 @@ bool transform_fdt(struct fdt_header *out_header, u32 *out_end, const struct fdt
 					if (size_cells > 4) {return false;}
 				}
 			} else if (in_chosen) {
-				char replaced_props[][24] = {
-					"linux,initrd-start", "linux,initrd-end", "kaslr-seed", "rng-seed"
+				char replaced_props[][32] = {
+					"linux,initrd-start", "linux,initrd-end", "kaslr-seed", "rng-seed",
+					"levinboot,timer-frequency", "levinboot,boot-events", "levinboot,boot-timeline"
 				};
 				for_array(i, replaced_props) {
 					if (0 == strncmp(str + offset, replaced_props[i], string_size - offset)) {
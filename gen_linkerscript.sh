@@ -11,7 +11,9 @@ MEMORY {
 }
 ENTRY(entry_point)
 END
-sections="/DISCARD/ : {*(.note*)}"
+# binlog format strings (see include/binlog.h) are only kept in the ELF, with addresses starting from 0
+sections="/DISCARD/ : {*(.note*)}
+	.binlog 0 (INFO) : {*(.binlog)}"
 while test $# -gt 0; do
 	case "$1" in
 		0x*) addr="$1"
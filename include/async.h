@@ -1,11 +1,31 @@
 /* SPDX-License-Identifier: CC0-1.0 */
 #pragma once
 #include <defs.h>
+#include <plat.h>
 
 struct async_buf {u8 *start, *end;};
 
+enum {ASYNC_LATENCY_BUCKETS = 12};
+/* I/O statistics kept by a pump, for tuning request sizes. times are in timer ticks */
+struct async_stats {
+	u64 bytes;
+	u32 requests;
+	/* time the consumer spent waiting for the device (in pump or when draining), and doing cache maintenance for DMA */
+	timestamp_t wait_ticks, cache_ticks;
+	/* request latencies as seen by the consumer: bucket 0 counts those under 64 μs, bucket i those in [2^(i-1), 2^i) × 64 μs, the last one everything longer */
+	u32 latency[ASYNC_LATENCY_BUCKETS];
+};
+
 struct async_transfer {
 	struct async_buf (*pump)(struct async_transfer *async, size_t consume, size_t min_size);
+	/* optional scatter read: asks for the not yet consumed stream range [start, end) to be transferred to dest instead of the buffer.
+	 * returns the subrange that will be redirected, which may be empty (e. g. if it was already requested or is not aligned suitably for DMA).
+	 * the consumer still pumps and consumes the redirected range as usual, but must not read it from the buffer; its data is in place at dest + (pos - start) once pumped. */
+	struct async_buf (*redirect)(struct async_transfer *async, u8 *start, u8 *end, u8 *dest);
+	/* optional, for transfers that recycle consumed buffer space: keeps the stream from `ptr` on from being overwritten even once it is consumed, until the next call. null releases the hold. `ptr` must not be behind an earlier hold or the consumer at the time of the call */
+	void (*hold)(struct async_transfer *async, const u8 *ptr);
+	/* optional, accumulates over all transfers */
+	struct async_stats *stats;
 };
 
 struct async_dummy {
@@ -24,4 +44,45 @@ struct async_blockdev {
 	u32 block_size;
 	u64 num_blocks;
 	enum iost (*start)(struct async_blockdev *, u64 addr, u8 *buf, u8 *buf_end);
+	/* optional: reads `size` bytes from `addr` through a ring buffer, see async_readahead_start_ring */
+	enum iost (*start_ring)(struct async_blockdev *, u64 addr, u64 size, struct async_buf ring, u8 *stream);
+};
+
+enum {ASYNC_MAX_INFLIGHT = 16};
+/* readahead core shared by the block drivers: requests of up to request_size bytes are
+ * started in order as long as fewer than max_inflight are in flight and the data ahead of
+ * the consumer stays within window; completions are retired in submission order.
+ * Drivers only provide the request primitives, slot numbers go round-robin in [0, max_inflight). */
+struct async_readahead {
+	struct async_blockdev blk;
+	enum iost (*start_request)(struct async_readahead *ra, u32 slot, u64 lba, u8 *buf, u8 *buf_end);
+	enum iost (*wait_request)(struct async_readahead *ra, u32 slot);
+	/* nonblocking completion check, may be null if completions can only be waited for */
+	_Bool (*request_done)(struct async_readahead *ra, u32 slot);
+	u8 *consume_ptr, *end_ptr, *next_end_ptr, *stop_ptr;
+	/* stream range that is DMA'd to redirect_dest instead, see async_transfer::redirect. requests never straddle its edges */
+	struct async_buf redirect;
+	u8 *redirect_dest;
+	/* ring mode: the stream is mapped at consecutive virtual addresses, backed by the (identity-mapped) ring buffer.
+	 * space is recycled in ASYNC_RING_SEGMENT steps behind the consumer and the hold, by remapping it ahead. [map_start, map_start + ring size) is mapped, as far as the stream goes */
+	struct async_buf ring;
+	u8 *ring_stream, *map_start, *hold_ptr;
+	/* start times of the requests in flight, by slot */
+	timestamp_t started[ASYNC_MAX_INFLIGHT];
+	u64 next_lba;
+	size_t window;
+	u32 request_size;
+	u8 max_inflight, head, inflight;
 };
+
+enum {ASYNC_RING_SEGMENT = 2 << 20};
+
+struct async_buf async_readahead_pump(struct async_transfer *async, size_t consume, size_t min_size);
+struct async_buf async_readahead_redirect(struct async_transfer *async, u8 *start, u8 *end, u8 *dest);
+void async_readahead_hold(struct async_transfer *async, const u8 *ptr);
+enum iost async_readahead_start(struct async_blockdev *blk, u64 addr, u8 *buf, u8 *buf_end);
+/* starts a transfer of `size` bytes that can be larger than the buffer: the data is read into `ring` (at least two ASYNC_RING_SEGMENTs, aligned to them) and mapped at `stream` (likewise aligned, with `size` bytes of unused address space behind it, rounded up to a segment) as the consumer moves on.
+ * the consumer can't have more than the ring size minus ASYNC_RING_SEGMENT ahead of it or held. the mapping is removed when the next transfer starts */
+enum iost async_readahead_start_ring(struct async_blockdev *blk, u64 addr, u64 size, struct async_buf ring, u8 *stream);
+/* waits for all requests still in flight, returns the first error */
+enum iost async_readahead_drain(struct async_readahead *ra);
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#pragma once
+#include <defs.h>
+#include <stdatomic.h>
+
+/* binary log records: instead of formatting on the target, the log macros of modules built with BINLOG_MSG (see log.h) store the format string ID and raw argument words in a memory ring.
+ * the format strings go into the .binlog section, which the linker script makes non-allocated, so they stay in the ELF for tools/binlogdecode but are not part of the binary. their address in it is the ID */
+
+enum {BINLOG_RECORD_WORDS = 8, BINLOG_HEAD_ARGS = 6, BINLOG_CONT_ARGS = 7, BINLOG_MAX_ARGS = BINLOG_HEAD_ARGS + BINLOG_CONT_ARGS};
+/* top byte of the first word of each record. a head record is
+ * BINLOG_HEAD << 56 | CPU << 40 | number of arguments << 32 | format ID, the timestamp and up to BINLOG_HEAD_ARGS arguments.
+ * if there are more, a continuation record (BINLOG_CONT << 56 and the remaining arguments) follows */
+enum {BINLOG_HEAD = 0xb1, BINLOG_CONT = 0xb2};
+#define BINLOG_MAGIC UINT64_C(0x474f4c4e4942424c)	/* "LBBINLOG" */
+
+/* at the start of the ring, followed by num_records records. pos counts all records ever written, the ring holds the last num_records of them */
+struct binlog_header {
+	u64 magic;
+	u32 num_records, timer_hz;
+	_Atomic(u64) pos;
+	u64 reserved[5];
+};
+_Static_assert(sizeof(struct binlog_header) == BINLOG_RECORD_WORDS * 8, "binlog header should be the size of a record");
+
+void binlog_write(const char *fmt, u32 num_args, const u64 *args);
+/* prints the ring in the form tools/binlogdecode reads from a console log */
+void binlog_dump();
+
+#define BINLOG_EMIT(fmt, n, args) do {\
+	static const char __attribute__((section(".binlog"))) binlog_fmt[] = fmt;\
+	binlog_write(binlog_fmt, n, args);\
+} while (0)
+#define BINLOG_0(fmt) BINLOG_EMIT(fmt, 0, 0)
+#define BINLOG_1(fmt, a) BINLOG_EMIT(fmt, 1, ((const u64[]) {(u64)(a)}))
+#define BINLOG_2(fmt, a, b) BINLOG_EMIT(fmt, 2, ((const u64[]) {(u64)(a), (u64)(b)}))
+#define BINLOG_3(fmt, a, b, c) BINLOG_EMIT(fmt, 3, ((const u64[]) {(u64)(a), (u64)(b), (u64)(c)}))
+#define BINLOG_4(fmt, a, b, c, d) BINLOG_EMIT(fmt, 4, ((const u64[]) {(u64)(a), (u64)(b), (u64)(c), (u64)(d)}))
+#define BINLOG_5(fmt, a, b, c, d, e) BINLOG_EMIT(fmt, 5, ((const u64[]) {(u64)(a), (u64)(b), (u64)(c), (u64)(d), (u64)(e)}))
+#define BINLOG_6(fmt, a, b, c, d, e, f) BINLOG_EMIT(fmt, 6, ((const u64[]) {(u64)(a), (u64)(b), (u64)(c), (u64)(d), (u64)(e), (u64)(f)}))
+#define BINLOG_7(fmt, a, b, c, d, e, f, g) BINLOG_EMIT(fmt, 7, ((const u64[]) {(u64)(a), (u64)(b), (u64)(c), (u64)(d), (u64)(e), (u64)(f), (u64)(g)}))
+#define BINLOG_8(fmt, a, b, c, d, e, f, g, h) BINLOG_EMIT(fmt, 8, ((const u64[]) {(u64)(a), (u64)(b), (u64)(c), (u64)(d), (u64)(e), (u64)(f), (u64)(g), (u64)(h)}))
+#define BINLOG_9(fmt, a, b, c, d, e, f, g, h, i) BINLOG_EMIT(fmt, 9, ((const u64[]) {(u64)(a), (u64)(b), (u64)(c), (u64)(d), (u64)(e), (u64)(f), (u64)(g), (u64)(h), (u64)(i)}))
+#define BINLOG_10(fmt, a, b, c, d, e, f, g, h, i, j) BINLOG_EMIT(fmt, 10, ((const u64[]) {(u64)(a), (u64)(b), (u64)(c), (u64)(d), (u64)(e), (u64)(f), (u64)(g), (u64)(h), (u64)(i), (u64)(j)}))
+#define BINLOG_SELECT(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, name, ...) name
+/* takes a format string literal and up to 10 integer or pointer arguments */
+#define BINLOG(...) BINLOG_SELECT(__VA_ARGS__, BINLOG_10, BINLOG_9, BINLOG_8, BINLOG_7, BINLOG_6, BINLOG_5, BINLOG_4, BINLOG_3, BINLOG_2, BINLOG_1, BINLOG_0)(__VA_ARGS__)
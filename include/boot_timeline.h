@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#pragma once
+#include <defs.h>
+#include <plat.h>
+
+/* events recorded on the boot timeline. the IDs are exported to the OS (see transform_fdt), so only append to this */
+#define DEFINE_BOOT_EVENT(X)\
+	X(SRAMSTAGE_START)\
+	X(DRAM_TRAINED)\
+	X(DRAM_READY)\
+	X(SRAMSTAGE_END)\
+	X(DRAMSTAGE_START)\
+	X(SD_INIT)	/* arg: IOST_* result */\
+	X(EMMC_INIT)	/* arg: IOST_* result */\
+	X(NVME_INIT)	/* arg: IOST_* result */\
+	X(DECOMPRESS_START)\
+	X(DECOMPRESS_END)	/* arg: IOST_* result */\
+	X(COMMIT)\
+	X(IO_MEDIUM)	/* arg: boot medium the following IO_* records describe */\
+	X(IO_KIB)	/* arg: KiB transferred */\
+	X(IO_REQUESTS)\
+	X(IO_WAIT_US)	/* arg: μs spent waiting for the device */\
+	X(IO_CACHE_US)	/* arg: μs spent on cache maintenance */
+
+enum boot_event {
+#define X(name) BOOT_EVENT_##name,
+	DEFINE_BOOT_EVENT(X)
+#undef X
+	NUM_BOOT_EVENT
+};
+
+struct boot_timeline_record {
+	timestamp_t timestamp;
+	u32 event, arg;
+};
+
+enum {BOOT_TIMELINE_MAGIC = 0x4c4d4954};	/* "TIML" */
+struct boot_timeline {
+	u32 magic, count, capacity, padding;
+	struct boot_timeline_record records[];
+};
+
+extern const char boot_event_names[];
+extern const size_t boot_event_names_size;
+
+/* makes the timeline in the `size` bytes at `buf` the current one. if `prev` is a valid timeline (e. g. left behind by the previous stage), its records are copied over, otherwise the timeline starts empty */
+void boot_timeline_init(void *buf, size_t size, const struct boot_timeline *prev);
+/* returns the current timeline, or 0 if boot_timeline_init was not called */
+const struct boot_timeline *boot_timeline_get();
+/* appends a record with the current timestamp. records that don't fit are dropped */
+void boot_timeline_add(enum boot_event event, u32 arg);
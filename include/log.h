@@ -17,6 +17,22 @@
 	#define info(...) fprintf(stderr, __VA_ARGS__)
 	#define infos(...) fputs(__VA_ARGS__,  stderr)
 	#endif
+#elif defined(BINLOG_MSG)
+	/* messages go to the binary log instead of the console, see binlog.h */
+	#include <binlog.h>
+	#ifdef SPEW_MSG
+	#define spew(...) BINLOG(__VA_ARGS__)
+	#define spews(...) BINLOG("%s", __VA_ARGS__)
+	#endif
+	#ifdef DEBUG_MSG
+	#define debug(...) BINLOG(__VA_ARGS__)
+	#define debugs(...) BINLOG("%s", __VA_ARGS__)
+	#endif
+
+	#ifndef NO_INFO_MSG
+	#define info(...) BINLOG(__VA_ARGS__)
+	#define infos(...) BINLOG("%s", __VA_ARGS__)
+	#endif
 #else
 	#ifdef SPEW_MSG
 	#define spew(...) printf(__VA_ARGS__)
@@ -2,6 +2,7 @@
 #pragma once
 #include <defs.h>
 #include <plat.h>
+#include <async.h>
 
 enum {
 	NVME_CREATING = 0,
@@ -63,3 +64,15 @@ enum iost nvme_reset_xfer(struct nvme_xfer *xfer);
 _Bool nvme_add_phys_buffer(struct nvme_xfer *xfer, phys_addr_t start, phys_addr_t end);
 _Bool nvme_emit_read(struct nvme_state *st, struct nvme_sq *sq, struct nvme_xfer *xfer, u32 nsid, u64 lba);
 enum iost nvme_read_wait(struct nvme_state *st, u16 sqid, struct nvme_xfer *xfer, u32 nsid, u64 lba);
+
+/* block device reading from a single namespace through I/O queue 1, with one transfer (and PRP list) per readahead slot */
+struct nvme_blockdev {
+	struct async_readahead ra;
+	struct nvme_state *st;
+	struct nvme_xfer *xfer;
+	u32 nsid;
+};
+
+enum iost nvme_blk_start_request(struct async_readahead *ra, u32 slot, u64 lba, u8 *buf, u8 *buf_end);
+enum iost nvme_blk_wait_request(struct async_readahead *ra, u32 slot);
+_Bool nvme_blk_request_done(struct async_readahead *ra, u32 slot);
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#pragma once
+#include <defs.h>
+#include <iost.h>
+
+struct pl330_regs;
+
+/* upper bound for the size of the program written by pl330_prog_periph_to_mem */
+#define PL330_PROG_SIZE(bursts, bursts_per_event) (33 + 16 * (((bursts) / (bursts_per_event) + 255) / 256))
+
+/* writes a channel program to `prog` that loads `bursts` bursts (as configured in `ccr`) from `src` on request of peripheral `periph`, stores them to `dst` onwards and then ends.
+ * after every `bursts_per_event` (at most 256) bursts and after the last one, it waits for the stores to complete and signals `event`. returns the end of the program */
+u8 *pl330_prog_periph_to_mem(u8 *prog, u32 ccr, u32 src, u32 dst, u8 periph, u32 bursts, u16 bursts_per_event, u8 event);
+/* starts channel `chan` at `prog`, which must be in memory visible to the DMAC. the security state is that of the manager thread, so `ccr` should have PL330_CCR_*_NS set iff pl330_nonsecure() */
+enum iost pl330_start(volatile struct pl330_regs *dmac, u8 chan, const u8 *prog);
+/* stops channel `chan` if it is still running */
+void pl330_kill(volatile struct pl330_regs *dmac, u8 chan);
+_Bool pl330_nonsecure(volatile struct pl330_regs *dmac);
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#pragma once
+#include <defs.h>
+
+struct pl330_regs {
+	u32 dsr, dpc;
+	u32 pad0[6];
+	u32 inten, int_event_ris, intmis, intclr;
+	u32 fsrd, fsrc, ftrd;
+	u32 pad1;
+	u32 ftr[8];
+	u32 pad2[40];
+	struct {u32 csr, cpc;} chan_status[8];
+	u32 pad3[176];
+	struct {
+		u32 sar, dar, ccr, lc0, lc1;
+		u32 pad[3];
+	} chan[8];
+	u32 pad4[512];
+	u32 dbgstatus, dbgcmd, dbginst0, dbginst1;
+	u32 pad5[60];
+	u32 cr[5], crd;
+};
+CHECK_OFFSET(pl330_regs, inten, 0x20);
+CHECK_OFFSET(pl330_regs, fsrc, 0x34);
+CHECK_OFFSET(pl330_regs, ftr, 0x40);
+CHECK_OFFSET(pl330_regs, chan_status, 0x100);
+CHECK_OFFSET(pl330_regs, chan, 0x400);
+CHECK_OFFSET(pl330_regs, dbgstatus, 0xd00);
+CHECK_OFFSET(pl330_regs, cr, 0xe00);
+
+enum {
+	PL330_DSR_DNS = 1 << 9,
+	PL330_DBGSTATUS_BUSY = 1,
+	PL330_CSR_STATUS_MASK = 15,
+	PL330_CSR_STOPPED = 0,
+	PL330_CSR_WFP = 7,
+	PL330_CSR_FAULTING = 15,
+};
+
+enum {
+	PL330_CCR_SRC_INC = 1,
+	PL330_CCR_SRC_PRIV = 1 << 8,
+	PL330_CCR_SRC_NS = 1 << 9,
+	PL330_CCR_DST_INC = 1 << 14,
+	PL330_CCR_DST_PRIV = 1 << 22,
+	PL330_CCR_DST_NS = 1 << 23,
+};
+#define PL330_CCR_SRC_BURST(size_shift, len) ((u32)(size_shift) << 1 | (u32)((len) - 1) << 4)
+#define PL330_CCR_DST_BURST(size_shift, len) ((u32)(size_shift) << 15 | (u32)((len) - 1) << 18)
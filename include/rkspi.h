@@ -3,18 +3,38 @@
 #include <defs.h>
 #include <async.h>
 #include <runqueue.h>
+#include <plat.h>
 
 struct rkspi_xfer_state {
 	u16 this_xfer_items;
 	_Atomic(void *) buf;
 	void *end;
+	/* DMA mode: end of the running SPI transfer, which is restarted once the DMA controller has stored all of it */
+	void *segment_end;
 	struct sched_runnable_list waiters;
+	/* cycle accounting for the interrupt handlers */
+	u32 interrupts;
+	timestamp_t handler_ticks;
 };
 
+/* DMA transfers: the controller issues burst requests for RKSPI_DMA_BURST FIFO entries (halfwords), each SPI transfer is at most RKSPI_DMA_SEGMENT bytes */
+enum {RKSPI_DMA_BURST = 16, RKSPI_DMA_SEGMENT = 0x10000};
+
 struct rkspi_regs;
 void rkspi_recv_fast(volatile struct rkspi_regs *spi, u8 *buf, u32 buf_size);
 void rkspi_read_flash_poll(volatile struct rkspi_regs *spi, u8 *buf, size_t buf_size, u32 addr);
 void rkspi_handle_interrupt(struct rkspi_xfer_state *state, volatile struct rkspi_regs *spi);
 void rkspi_start_rx_xfer(struct rkspi_xfer_state *state, volatile struct rkspi_regs *spi, size_t bytes);
+/* starts an RX transfer of up to RKSPI_DMA_SEGMENT bytes (a multiple of the burst size) with DMA requests enabled */
+void rkspi_start_rx_dma(struct rkspi_xfer_state *state, volatile struct rkspi_regs *spi, size_t bytes);
+/* publishes that DMA has stored the data up to `pos` and continues with the next segment if needed */
+void rkspi_dma_progress(struct rkspi_xfer_state *state, volatile struct rkspi_regs *spi, void *pos);
+/* transmits the bytes from `buf` to `end` as one command (chip select held low throughout) */
+void rkspi_tx_cmd(volatile struct rkspi_regs *spi, const u8 *buf, const u8 *end);
+/* polls the flash status register until the write-in-progress bit is clear. returns 0 if it is still set after `timeout` */
+_Bool rkspi_flash_wait_ready(volatile struct rkspi_regs *spi, timestamp_t timeout);
+void rkspi_read_sfdp(volatile struct rkspi_regs *spi, u32 addr, u8 *buf, size_t size);
+/* returns the flash size in bytes according to its SFDP basic parameter table, 0 if it has none (or there is no flash) */
+u64 rkspi_flash_size(volatile struct rkspi_regs *spi);
 void rkspi_tx_cmd4_dummy1(volatile struct rkspi_regs *spi, u32 cmd);
 void rkspi_tx_fast_read_cmd(volatile struct rkspi_regs *spi, u32 addr);
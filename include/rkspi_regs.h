@@ -50,6 +50,11 @@ enum {
 	RKSPI_TX_EMPTY_INTR = 1,
 };
 
+enum {
+	RKSPI_DMA_RX = 1,
+	RKSPI_DMA_TX = 2,
+};
+
 enum {RKSPI_MAX_RECV = 0xfffe};
 
 #define RKSPI_PHASE(n) ((n) << 6)
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: CC0-1.0 */
 #pragma once
 #include <defs.h>
+#include <timer.h>
 
 struct rktimer_regs {
 	u32 load_count0;
@@ -19,3 +20,21 @@ enum {
 	RKTIMER_STOP_MODE = 2,
 	RKTIMER_INT_EN = 4,
 };
+
+/* interrupt period while no earlier deadline is set, so preemption and polling still happen regularly */
+enum {RKTIMER_TICK = 240000};
+
+/* (re)starts the timer so it interrupts at `deadline` or one tick from now, whichever is earlier. the timer must run on the same clock as get_timestamp */
+HEADER_FUNC void rktimer_set_deadline(volatile struct rktimer_regs *timer, timestamp_t deadline) {
+	timestamp_t now = get_timestamp();
+	u32 ticks = RKTIMER_TICK;
+	if (deadline <= now) {
+		ticks = 1;
+	} else if (deadline - now < ticks) {
+		ticks = deadline - now;
+	}
+	timer->control = 0;
+	timer->load_count0 = ticks;
+	timer->load_count1 = 0;
+	timer->control = RKTIMER_ENABLE | RKTIMER_INT_EN;
+}
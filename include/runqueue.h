@@ -1,9 +1,18 @@
 /* SPDX-License-Identifier: CC0-1.0 */
 #pragma once
 #include <defs.h>
+#include <plat.h>
+
+enum {
+	SCHED_PRIO_NORMAL = 0,
+	/* for threads on the critical path, like the decompression of the cued payload */
+	SCHED_PRIO_HIGH,
+	NUM_SCHED_PRIO
+};
 
 struct sched_runnable {
 	struct sched_runnable *next;
+	u8 priority;
 };
 
 /* the entries in a runnable_list are usually stored in reverse, because adding at the beginning is simple to do atomically */
@@ -13,10 +22,13 @@ struct sched_runnable_list {
 
 static struct sched_runnable_list UNUSED *const CURRENT_RUNQUEUE = 0;
 
+/* the non-atomic part is one FIFO per priority. zero-initialized runqueues are valid */
 struct sched_runqueue {
 	struct sched_runnable_list fresh;
-	struct sched_runnable *head;
-	struct sched_runnable **tail;
+	struct sched_runnable *head[NUM_SCHED_PRIO];
+	struct sched_runnable **tail[NUM_SCHED_PRIO];
+	/* number of consecutive picks that passed over lower-priority entries */
+	u8 streak;
 };
 
 void sched_queue_single(struct sched_runnable_list *, struct sched_runnable *);
@@ -25,10 +37,26 @@ void sched_queue_many(struct sched_runnable_list *, struct sched_runnable *first
 /** atomically takes from src (which must not be CURRENT_RUNQUEUE) and then atomically adds the contents to dest (which may be CURRENT_RUNQUEUE) */
 void sched_queue_list(struct sched_runnable_list *dest, struct sched_runnable_list *src);
 
-/// Tries to pop a thread off the runqueue.
+/// Tries to pop a thread off the runqueue, preferring higher priorities.
+/// After CONFIG_SCHED_MAX_STREAK picks in a row that passed over lower-priority threads, the oldest of those runs once, so they make progress.
 /// Returns null if none found.
 /// Caller must own the non-atomic parts of the runqueue
 struct sched_runnable *sched_unqueue(struct sched_runqueue *rq);
+/// Like sched_unqueue on `runqueues[self]`, but if that is empty, takes over the fresh list of the next non-empty one of the other runqueues.
+/// Lock-free, but the stolen entries lose the CPU affinity they were queued with.
+/// Preemption is only requested from the platform timer interrupt, so on CPUs that don't take it (the secondaries in dramstage have no GIC or stimer setup), a stolen thread runs until it blocks or yields, and CTX_STATUS_PREEMPT_REQ_BIT has no effect on it.
+/// Any thread can be stolen, including the boot medium threads and their streaming decompression, so none may rely on preemption for correctness, only for fairness on the CPU that takes the timer interrupt.
+/// Caller must own the non-atomic parts of `runqueues[self]`
+struct sched_runnable *sched_unqueue_steal(struct sched_runqueue *runqueues, u32 num_runqueues, u32 self);
+
+/// arch_sched_run plus the CONFIG_SCHED_TRACE bookkeeping, for the CPU main loops
+void sched_run(struct sched_runnable *);
+#if CONFIG_SCHED_TRACE
+/// labels the thread in the trace dump. names must not contain spaces
+void sched_trace_name(const struct sched_runnable *, const char *name);
+/// prints per-thread run and wait times and the event ring as `sched-trace:` lines, for tools/schedtrace
+void sched_trace_dump();
+#endif
 
 /// handler for thread preemption
 /// called by architecture code when thread state has been saved
@@ -36,6 +64,8 @@ void sched_thread_preempted(struct sched_runnable *);
 
 /// takes the current thread off-CPU, while keeping it runnable
 void sched_yield();
+/// like sched_yield, but the thread comes back with the given SCHED_PRIO_* priority
+void sched_set_priority(u8 priority);
 
 /// takes the current thread off-CPU and queues it on `list` if `*var & mask == expected`
 void sched_wait_u16(struct sched_runnable_list *list, _Atomic(u16) *var, u16 mask, u16 expected);
@@ -45,7 +75,10 @@ void sched_finish_u32(struct sched_runnable *continuation, volatile void *reg, v
 void sched_finish_u8(struct sched_runnable *continuation, volatile void *reg, volatile void *list_, ureg_t clear, ureg_t set);
 void sched_finish_u8ptr(struct sched_runnable *continuation, volatile void *reg, volatile void *list_, ureg_t val);
 
+/// takes the current thread off-CPU for at least `usecs` microseconds. it is not scheduled again until the platform timer interrupt after the deadline calls sched_expire_timers
 void usleep(u32 usecs);
+/// queues the sleepers whose deadline has passed on the current runqueue and sets the platform timer for the next one. must be called from the timer interrupt
+void sched_expire_timers(timestamp_t now);
 
 // === architecture-level functions
 void call_cc(void (*callback)(struct sched_runnable *));
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include <binlog.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <timer.h>
+
+#ifndef CONFIG_BINLOG_RECORDS
+#define CONFIG_BINLOG_RECORDS 4096
+#endif
+
+/* records are one cache line each, so CPUs logging concurrently don't write to the same lines */
+static _Alignas(64) struct {
+	struct binlog_header header;
+	u64 records[CONFIG_BINLOG_RECORDS][BINLOG_RECORD_WORDS];
+} binlog;
+
+static u32 current_cpu() {
+	u64 mpidr;
+	__asm__("mrs %0, MPIDR_EL1" : "=r"(mpidr));
+	return mpidr & 0xff;
+}
+
+void binlog_write(const char *fmt, u32 num_args, const u64 *args) {
+	/* initialized on first use, so the ring stays in .bss */
+	if (!binlog.header.magic) {
+		binlog.header.num_records = CONFIG_BINLOG_RECORDS;
+		binlog.header.timer_hz = TICKS_PER_MICROSECOND * 1000000;
+		binlog.header.magic = BINLOG_MAGIC;
+	}
+	u32 num_records = num_args <= BINLOG_HEAD_ARGS ? 1 : 2;
+	u64 pos = atomic_fetch_add_explicit(&binlog.header.pos, num_records, memory_order_relaxed);
+	u64 *rec = binlog.records[pos % CONFIG_BINLOG_RECORDS];
+	rec[0] = (u64)BINLOG_HEAD << 56 | (u64)current_cpu() << 40 | (u64)num_args << 32 | (u32)(uintptr_t)fmt;
+	rec[1] = get_timestamp();
+	u32 head_args = num_args < BINLOG_HEAD_ARGS ? num_args : BINLOG_HEAD_ARGS;
+	for_range(i, 0, head_args) {rec[2 + i] = args[i];}
+	if (num_records == 1) {return;}
+	rec = binlog.records[(pos + 1) % CONFIG_BINLOG_RECORDS];
+	rec[0] = (u64)BINLOG_CONT << 56;
+	for_range(i, BINLOG_HEAD_ARGS, num_args) {rec[1 + i - BINLOG_HEAD_ARGS] = args[i];}
+}
+
+void binlog_dump() {
+	u64 pos = atomic_load_explicit(&binlog.header.pos, memory_order_relaxed);
+	u64 first = pos > CONFIG_BINLOG_RECORDS ? pos - CONFIG_BINLOG_RECORDS : 0;
+	printf("binlog: begin %"PRIu64" %"PRIu64" %"PRIu32"\n", first, pos, (u32)(TICKS_PER_MICROSECOND * 1000000));
+	for (u64 i = first; i < pos; ++i) {
+		const u64 *rec = binlog.records[i % CONFIG_BINLOG_RECORDS];
+		for (u32 j = 0; j < BINLOG_RECORD_WORDS; j += 4) {
+			printf("binlog: %016"PRIx64" %016"PRIx64" %016"PRIx64" %016"PRIx64"\n", rec[j], rec[j + 1], rec[j + 2], rec[j + 3]);
+		}
+	}
+	puts("binlog: end");
+}
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include <boot_timeline.h>
+#include <string.h>
+
+#include <irq.h>
+#include <timer.h>
+
+const char boot_event_names[] =
+#define X(name) #name "\0"
+	DEFINE_BOOT_EVENT(X)
+#undef X
+;
+const size_t boot_event_names_size = sizeof(boot_event_names) - 1;
+
+static struct boot_timeline *timeline = 0;
+static irq_lock_t timeline_lock = IRQ_LOCK_INIT;
+
+void boot_timeline_init(void *buf, size_t size, const struct boot_timeline *prev) {
+	struct boot_timeline *tl = buf;
+	tl->magic = BOOT_TIMELINE_MAGIC;
+	tl->capacity = (size - sizeof(*tl)) / sizeof(tl->records[0]);
+	tl->count = 0;
+	tl->padding = 0;
+	if (prev && prev->magic == BOOT_TIMELINE_MAGIC && prev->count <= prev->capacity) {
+		tl->count = prev->count < tl->capacity ? prev->count : tl->capacity;
+		memcpy(tl->records, prev->records, tl->count * sizeof(tl->records[0]));
+	}
+	timeline = tl;
+}
+
+const struct boot_timeline *boot_timeline_get() {
+	return timeline;
+}
+
+void boot_timeline_add(enum boot_event event, u32 arg) {
+	irq_save_t irq = irq_lock(&timeline_lock);
+	struct boot_timeline *tl = timeline;
+	if (tl && tl->count < tl->capacity) {
+		tl->records[tl->count++] = (struct boot_timeline_record) {
+			.timestamp = get_timestamp(),
+			.event = event,
+			.arg = arg,
+		};
+	}
+	irq_unlock(&timeline_lock, irq);
+}
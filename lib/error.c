@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: CC0-1.0 */
 #include <stdlib.h>
+#include <stdio.h>
 
 #include <die.h>
 #include <iost.h>
@@ -25,7 +26,11 @@ FORCE_USED  _Noreturn void NO_ASAN __stack_chk_fail() {
 	halt_and_catch_fire();
 }
 
-_Noreturn void plat_panic() {halt_and_catch_fire();}
+_Noreturn void plat_panic() {
+	/* the console may be buffered, make sure the last words get out */
+	fflush(stdout);
+	halt_and_catch_fire();
+}
 
 _Noreturn void halt_and_catch_fire() {
 	while (1) {
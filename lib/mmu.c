@@ -9,6 +9,7 @@
 #include <inttypes.h>
 #include <plat.h>
 #include <uart.h>
+#include <irq.h>
 
 #ifdef DEBUG_MSG
 #define PRINT_MAPPINGS 1
@@ -169,11 +170,16 @@ static void map_range(u64 *pt, u64 first, u64 last, u64 paddr, u64 flags) {
 	mmu_multimap(pt, map);
 }
 
+/* boot medium threads map their payload streams concurrently and may be preempted */
+static irq_lock_t map_lock = IRQ_LOCK_INIT;
+
 void mmu_map_range(u64 first, u64 last, u64 paddr, u64 flags) {
+	irq_save_t irq = irq_lock(&map_lock);
 	map_range(pagetables[0], first, last, paddr, flags);
 #ifdef SPEW_MSG
 	dump_page_tables(console_uart);
 #endif
+	irq_unlock(&map_lock, irq);
 }
 
 static u64 unmap_one(u64 *pt, u64 first, u64 last) {
@@ -216,5 +222,9 @@ static u64 unmap_one(u64 *pt, u64 first, u64 last) {
 
 void mmu_unmap_range(u64 first, u64 last) {
 	assert(last > first);
+	irq_save_t irq = irq_lock(&map_lock);
 	while ((first = unmap_one(pagetables[0], first, last)) < last) {first += 1;}
+	irq_unlock(&map_lock, irq);
+	/* the invalidations have to be complete before the range can be remapped */
+	__asm__ volatile("dsb ish; isb" : : : "memory");
 }
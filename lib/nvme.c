@@ -269,7 +269,7 @@ enum iost nvme_init_queues(struct nvme_state *st, u16 num_iocq, u16 num_iosq, u8
 	memset(cmd, 0, sizeof(*cmd));
 	cmd->opc = NVME_ADMIN_CREATE_IOSQ;
 	cmd->dptr[0] = to_le64(plat_virt_to_phys(st->sq[1].buf));
-	cmd->dw10 = to_le32(1 | 3 << 16);
+	cmd->dw10 = to_le32(1 | (u32)st->sq[1].size << 16);
 	cmd->dw11 = to_le32(1 << 16 | 1);
 	res = wait_single_command(st, 0);
 	if (res != IOST_OK) {return res;}
@@ -14,7 +14,7 @@ enum iost nvme_reset_xfer(struct nvme_xfer *xfer) {
 	u16 status = atomic_load_explicit(&xfer->req.status, memory_order_acquire);
 	do {
 		if (status == NVME_SUBMITTED) {return IOST_TRANSIENT;}
-	} while (atomic_compare_exchange_weak_explicit(&xfer->req.status, &status, NVME_CREATING, memory_order_acquire, memory_order_acquire));
+	} while (!atomic_compare_exchange_weak_explicit(&xfer->req.status, &status, NVME_CREATING, memory_order_acquire, memory_order_acquire));
 	xfer->prp_size = 0;
 	xfer->first_prp_entry = xfer->last_prp_entry = 0;
 	return IOST_OK;
@@ -106,3 +106,31 @@ enum iost nvme_read_wait(struct nvme_state *st, u16 sqid, struct nvme_xfer *xfer
 	info("read finished after %"PRIuTS" μs\n", (get_timestamp() - t_submit) / TICKS_PER_MICROSECOND);
 	return IOST_OK;
 }
+
+enum iost nvme_blk_start_request(struct async_readahead *ra, u32 slot, u64 lba, u8 *buf, u8 *buf_end) {
+	struct nvme_blockdev *dev = (struct nvme_blockdev *)ra;
+	struct nvme_xfer *xfer = dev->xfer + slot;
+	enum iost res = nvme_reset_xfer(xfer);
+	if (res != IOST_OK) {return res;}
+	_Bool success = nvme_add_phys_buffer(xfer, plat_virt_to_phys(buf), plat_virt_to_phys(buf_end));
+	(void)success;
+	assert(success);
+	if (!nvme_emit_read(dev->st, dev->st->sq + 1, xfer, dev->nsid, lba)) {return IOST_INVALID;}
+	if (!nvme_submit_single_command(dev->st, 1, &xfer->req)) {return IOST_TRANSIENT;}
+	return IOST_OK;
+}
+
+enum iost nvme_blk_wait_request(struct async_readahead *ra, u32 slot) {
+	struct nvme_blockdev *dev = (struct nvme_blockdev *)ra;
+	return nvme_wait_req(dev->st, &dev->xfer[slot].req);
+}
+
+_Bool nvme_blk_request_done(struct async_readahead *ra, u32 slot) {
+	struct nvme_blockdev *dev = (struct nvme_blockdev *)ra;
+	while (1) {switch (nvme_process_cqe(dev->st, dev->st->sq[1].cq)) {
+	case IOST_OK: continue;
+	case IOST_TRANSIENT: break;
+	default: return 1;	/* let nvme_wait_req report the error */
+	} break;}
+	return atomic_load_explicit(&dev->xfer[slot].req.status, memory_order_acquire) != NVME_SUBMITTED;
+}
@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include <pl330.h>
+#include <pl330_regs.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <aarch64.h>
+#include <die.h>
+#include <log.h>
+#include <timer.h>
+
+enum {
+	DMAEND = 0x00,
+	DMAKILL = 0x01,
+	DMAST = 0x08,
+	DMAWMB = 0x13,
+	DMALP = 0x20,
+	DMALDPB = 0x27,
+	DMALPEND = 0x28,
+	DMAWFPB = 0x32,
+	DMASEV = 0x34,
+	DMAFLUSHP = 0x35,
+	DMAGO = 0xa0,
+	DMAMOV = 0xbc,
+};
+enum {DMAMOV_SAR = 0, DMAMOV_CCR = 1, DMAMOV_DAR = 2};
+enum {DMALP_LC1 = 1 << 1};
+enum {DMALPEND_FINITE = 1 << 4, DMALPEND_LC1 = 1 << 2};
+
+static u8 *emit_mov(u8 *ptr, u8 reg, u32 val) {
+	*ptr++ = DMAMOV;
+	*ptr++ = reg;
+	for_range(i, 0, 4) {*ptr++ = val >> (8 * i);}
+	return ptr;
+}
+
+/* emits a loop over `bursts` bursts from `periph`, followed by a write barrier and `event` */
+static u8 *emit_block(u8 *ptr, u8 periph, u16 bursts, u8 event) {
+	*ptr++ = DMALP;
+	*ptr++ = bursts - 1;
+	u8 *inner = ptr;
+	*ptr++ = DMAWFPB;
+	*ptr++ = periph << 3;
+	*ptr++ = DMALDPB;
+	*ptr++ = periph << 3;
+	*ptr++ = DMAST;
+	*ptr = DMALPEND | DMALPEND_FINITE;
+	ptr[1] = ptr - inner;
+	ptr += 2;
+	*ptr++ = DMAWMB;
+	*ptr++ = DMASEV;
+	*ptr++ = event << 3;
+	return ptr;
+}
+
+u8 *pl330_prog_periph_to_mem(u8 *prog, u32 ccr, u32 src, u32 dst, u8 periph, u32 bursts, u16 bursts_per_event, u8 event) {
+	assert(bursts > 0 && bursts_per_event > 0 && bursts_per_event <= 256 && periph < 32 && event < 32);
+	u8 *ptr = prog;
+	ptr = emit_mov(ptr, DMAMOV_CCR, ccr);
+	ptr = emit_mov(ptr, DMAMOV_SAR, src);
+	ptr = emit_mov(ptr, DMAMOV_DAR, dst);
+	*ptr++ = DMAFLUSHP;
+	*ptr++ = periph << 3;
+	/* the loop counters only go up to 256, so the full blocks are done in groups of up to 256 */
+	for (u32 blocks = bursts / bursts_per_event; blocks;) {
+		u32 group = blocks > 256 ? 256 : blocks;
+		if (group > 1) {
+			*ptr++ = DMALP | DMALP_LC1;
+			*ptr++ = group - 1;
+		}
+		u8 *outer = ptr;
+		ptr = emit_block(ptr, periph, bursts_per_event, event);
+		if (group > 1) {
+			*ptr = DMALPEND | DMALPEND_FINITE | DMALPEND_LC1;
+			ptr[1] = ptr - outer;
+			ptr += 2;
+		}
+		blocks -= group;
+	}
+	if (bursts % bursts_per_event) {ptr = emit_block(ptr, periph, bursts % bursts_per_event, event);}
+	*ptr++ = DMAEND;
+	assert(ptr - prog <= PL330_PROG_SIZE(bursts, bursts_per_event));
+	return ptr;
+}
+
+_Bool pl330_nonsecure(volatile struct pl330_regs *dmac) {
+	return !!(dmac->dsr & PL330_DSR_DNS);
+}
+
+/* runs an instruction on the manager thread or (if `thread` is nonzero) channel `thread - 1` through the debug interface */
+static void execute(volatile struct pl330_regs *dmac, u8 thread, u8 op0, u8 op1, u32 imm) {
+	timestamp_t start = get_timestamp();
+	while (dmac->dbgstatus & PL330_DBGSTATUS_BUSY) {
+		if (get_timestamp() - start > USECS(1000)) {die("PL330 debug interface stuck\n");}
+		__asm__ volatile("yield");
+	}
+	dmac->dbginst0 = (u32)op1 << 24 | (u32)op0 << 16 | (thread ? (u32)(thread - 1) << 8 | 1 : 0);
+	dmac->dbginst1 = imm;
+	dmac->dbgcmd = 0;
+}
+
+enum iost pl330_start(volatile struct pl330_regs *dmac, u8 chan, const u8 *prog) {
+	assert(chan < 8 && (u64)prog < 0x100000000);
+	u32 csr = dmac->chan_status[chan].csr;
+	if ((csr & PL330_CSR_STATUS_MASK) != PL330_CSR_STOPPED) {
+		info("PL330 channel %"PRIu8" busy (CSR=0x%"PRIx32")\n", chan, csr);
+		return IOST_TRANSIENT;
+	}
+	dsb_st();	/* program must be visible before the channel fetches it */
+	execute(dmac, 0, DMAGO | pl330_nonsecure(dmac) << 1, chan, (u32)(u64)prog);
+	return IOST_OK;
+}
+
+void pl330_kill(volatile struct pl330_regs *dmac, u8 chan) {
+	assert(chan < 8);
+	/* a channel that reached its DMAEND has stopped by itself */
+	if ((dmac->chan_status[chan].csr & PL330_CSR_STATUS_MASK) == PL330_CSR_STOPPED) {return;}
+	execute(dmac, chan + 1, DMAKILL, 0, 0);
+	timestamp_t start = get_timestamp();
+	while ((dmac->chan_status[chan].csr & PL330_CSR_STATUS_MASK) != PL330_CSR_STOPPED) {
+		if (get_timestamp() - start > USECS(1000)) {die("PL330 channel %"PRIu8" did not stop\n", chan);}
+		__asm__ volatile("yield");
+	}
+}
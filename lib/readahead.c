@@ -0,0 +1,231 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include <async.h>
+#include <assert.h>
+#include <inttypes.h>
+
+#include <log.h>
+#include <iost.h>
+#include <cache.h>
+#include <plat.h>
+#include <mmu.h>
+#include <timer.h>
+
+static u8 iost_u8[NUM_IOST];
+
+static void count_latency(struct async_stats *stats, timestamp_t ticks) {
+	u32 bucket = 0;
+	for (timestamp_t limit = USECS(64); bucket < ASYNC_LATENCY_BUCKETS - 1 && ticks >= limit; limit *= 2) {bucket += 1;}
+	stats->latency[bucket] += 1;
+}
+
+static u32 next_slot(struct async_readahead *ra, u32 slot) {
+	return slot + 1 == ra->max_inflight ? 0 : slot + 1;
+}
+
+static size_t ring_size(struct async_readahead *ra) {
+	return ra->ring.end - ra->ring.start;
+}
+
+static _Bool redirected(struct async_readahead *ra, u8 *ptr) {
+	return ptr >= ra->redirect.start && ptr < ra->redirect.end;
+}
+
+/* requests end at request_size, the end of the stream, the edges of the redirected range and ring segment boundaries.
+ * these are all fixed while the request is in flight, so retire_request can recompute it */
+static u8 *request_end(struct async_readahead *ra, u8 *start) {
+	u8 *end = (size_t)(ra->stop_ptr - start) > ra->request_size ? start + ra->request_size : ra->stop_ptr;
+	if (start < ra->redirect.start && end > ra->redirect.start) {end = ra->redirect.start;}
+	if (start < ra->redirect.end && end > ra->redirect.end) {end = ra->redirect.end;}
+	if (ring_size(ra) && !redirected(ra, start)) {
+		u8 *segment_end = start + (ASYNC_RING_SEGMENT - (size_t)(start - ra->ring_stream) % ASYNC_RING_SEGMENT);
+		if (end > segment_end) {end = segment_end;}
+	}
+	return end;
+}
+
+static u8 *ring_slot(struct async_readahead *ra, u8 *ptr) {
+	return ra->ring.start + (size_t)(ptr - ra->ring_stream) % ring_size(ra);
+}
+
+/* where the data for a stream position is DMA'd to */
+static u8 *dma_ptr(struct async_readahead *ra, u8 *ptr) {
+	if (redirected(ra, ptr)) {return ra->redirect_dest + (ptr - ra->redirect.start);}
+	if (ring_size(ra)) {return ring_slot(ra, ptr);}
+	return ptr;
+}
+
+/* whether the next request would overwrite ring space that is still in use */
+static _Bool ring_full(struct async_readahead *ra) {
+	return ring_size(ra) && !redirected(ra, ra->next_end_ptr) && ra->next_end_ptr >= ra->map_start + ring_size(ra);
+}
+
+/* the end of the ring mapping when it starts at `start`: it does not extend past the segment containing the end of the stream */
+static u8 *ring_map_end(struct async_readahead *ra, u8 *start) {
+	u8 *limit = ra->stop_ptr + (ASYNC_RING_SEGMENT - 1 - (size_t)(ra->stop_ptr - ra->ring_stream + ASYNC_RING_SEGMENT - 1) % ASYNC_RING_SEGMENT);
+	return (size_t)(limit - start) > ring_size(ra) ? start + ring_size(ra) : limit;
+}
+
+static void ring_map(struct async_readahead *ra, u8 *start, u8 *end) {
+	for (u8 *segment = start; segment < end; segment += ASYNC_RING_SEGMENT) {
+		mmu_map_range((u64)segment, (u64)segment + (ASYNC_RING_SEGMENT - 1), (u64)ring_slot(ra, segment), MEM_TYPE_NORMAL);
+	}
+	mmu_flush();
+}
+
+/* recycles the segments behind the consumer and the hold */
+static void ring_advance(struct async_readahead *ra) {
+	if (!ring_size(ra)) {return;}
+	u8 *tail = ra->hold_ptr && ra->hold_ptr < ra->consume_ptr ? ra->hold_ptr : ra->consume_ptr;
+	tail -= (size_t)(tail - ra->ring_stream) % ASYNC_RING_SEGMENT;
+	if (tail <= ra->map_start) {return;}
+	u8 *old_end = ring_map_end(ra, ra->map_start), *unmap_end = tail < old_end ? tail : old_end;
+	if (unmap_end > ra->map_start) {mmu_unmap_range((u64)ra->map_start, (u64)unmap_end - 1);}
+	ring_map(ra, tail > old_end ? tail : old_end, ring_map_end(ra, tail));
+	ra->map_start = tail;
+}
+
+static enum iost start_request(struct async_readahead *ra) {
+	u32 slot = ra->head + ra->inflight;
+	if (slot >= ra->max_inflight) {slot -= ra->max_inflight;}
+	u8 *start = ra->next_end_ptr;
+	u8 *end = request_end(ra, start);
+	u8 *dma = dma_ptr(ra, start);
+	debug("starting request %"PRIu32" LBA 0x%08"PRIx64" buf 0x%"PRIx64"–0x%"PRIx64"\n", slot, ra->next_lba, (u64)dma, (u64)(dma + (end - start)));
+	/* we will invalidate later, but this prevents any previous
+	 * cache contents from overwriting DMA'd-in data */
+	timestamp_t flush_start = get_timestamp();
+	flush_range(dma, end - start);
+	timestamp_t now = get_timestamp();
+	if (ra->blk.async.stats) {ra->blk.async.stats->cache_ticks += now - flush_start;}
+	enum iost res = ra->start_request(ra, slot, ra->next_lba, dma, dma + (end - start));
+	if (res != IOST_OK) {return res;}
+	ra->started[slot] = now;
+	ra->next_lba += (size_t)(end - start) / ra->blk.block_size;
+	ra->next_end_ptr = end;
+	ra->inflight += 1;
+	return IOST_OK;
+}
+
+static enum iost retire_request(struct async_readahead *ra) {
+	assert(ra->inflight);
+	struct async_stats *stats = ra->blk.async.stats;
+	timestamp_t wait_start = get_timestamp();
+	enum iost res = ra->wait_request(ra, ra->head);
+	timestamp_t done = get_timestamp();
+	if (stats) {
+		stats->wait_ticks += done - wait_start;
+		stats->requests += 1;
+		/* completions found by request_done are only noticed when the consumer pumps, so this is an upper bound */
+		count_latency(stats, done - ra->started[ra->head]);
+	}
+	ra->head = next_slot(ra, ra->head);
+	ra->inflight -= 1;
+	if (res != IOST_OK) {return res;}
+	u8 *end = request_end(ra, ra->end_ptr);
+	invalidate_range(dma_ptr(ra, ra->end_ptr), end - ra->end_ptr);
+	if (stats) {
+		stats->bytes += end - ra->end_ptr;
+		stats->cache_ticks += get_timestamp() - done;
+	}
+	ra->end_ptr = end;
+	return IOST_OK;
+}
+
+struct async_buf async_readahead_pump(struct async_transfer *async, size_t consume, size_t min_size) {
+	struct async_readahead *ra = (struct async_readahead *)async;
+	assert((size_t)(ra->end_ptr - ra->consume_ptr) >= consume);
+	ra->consume_ptr += consume;
+	ring_advance(ra);
+	while (1) {
+		while (ra->inflight && ra->request_done && ra->request_done(ra, ra->head)) {
+			enum iost res = retire_request(ra);
+			if (res != IOST_OK) {return (struct async_buf) {iost_u8 + res, iost_u8};}
+		}
+		_Bool enough = (size_t)(ra->end_ptr - ra->consume_ptr) >= min_size;
+		while (ra->inflight < ra->max_inflight && ra->next_end_ptr != ra->stop_ptr && !ring_full(ra)) {
+			/* the window counts from the end of what the consumer asked for; beyond it, only start requests if the consumer would stall otherwise */
+			if ((size_t)(ra->next_end_ptr - ra->consume_ptr) >= ra->window + min_size && (enough || ra->inflight)) {break;}
+			enum iost res = start_request(ra);
+			if (res != IOST_OK) {return (struct async_buf) {iost_u8 + res, iost_u8};}
+		}
+		if (enough || !ra->inflight) {break;}
+		enum iost res = retire_request(ra);
+		if (res != IOST_OK) {return (struct async_buf) {iost_u8 + res, iost_u8};}
+	}
+	return (struct async_buf) {ra->consume_ptr, ra->end_ptr};
+}
+
+enum iost async_readahead_drain(struct async_readahead *ra) {
+	enum iost res = IOST_OK;
+	while (ra->inflight) {
+		enum iost res2 = retire_request(ra);
+		if (res == IOST_OK) {res = res2;}
+	}
+	return res;
+}
+
+struct async_buf async_readahead_redirect(struct async_transfer *async, u8 *start, u8 *end, u8 *dest) {
+	struct async_readahead *ra = (struct async_readahead *)async;
+	struct async_buf none = {ra->next_end_ptr, ra->next_end_ptr};
+	/* the previous redirect may still have requests in flight */
+	if (ra->consume_ptr < ra->redirect.end) {return none;}
+	if (end > ra->stop_ptr) {end = ra->stop_ptr;}
+	u8 *first = start > ra->next_end_ptr ? start : ra->next_end_ptr;
+	/* only whole blocks can be redirected. stop_ptr is at a block boundary of the stream */
+	first += (size_t)(ra->stop_ptr - first) % ra->blk.block_size;
+	if (end <= first) {return none;}
+	end -= (ra->blk.block_size - (size_t)(ra->stop_ptr - end) % ra->blk.block_size) % ra->blk.block_size;
+	u8 *first_dest = dest + (first - start);
+	if (end <= first || (uintptr_t)first_dest % MAX_CACHELINE_SIZE) {return none;}
+	ra->redirect = (struct async_buf) {first, end};
+	ra->redirect_dest = first_dest;
+	debug("redirecting 0x%"PRIx64"–0x%"PRIx64" to 0x%"PRIx64"\n", (u64)first, (u64)end, (u64)first_dest);
+	return ra->redirect;
+}
+
+void async_readahead_hold(struct async_transfer *async, const u8 *ptr) {
+	struct async_readahead *ra = (struct async_readahead *)async;
+	assert(!ptr || !ring_size(ra) || ptr >= ra->map_start);
+	ra->hold_ptr = (u8 *)ptr;
+	ring_advance(ra);
+}
+
+enum iost async_readahead_start(struct async_blockdev *blk, u64 addr, u8 *buf, u8 *buf_end) {
+	struct async_readahead *ra = (struct async_readahead *)blk;
+	if (buf_end < buf
+		|| (size_t)(buf_end - buf) % ra->blk.block_size != 0
+		|| addr >= ra->blk.num_blocks
+	) {return IOST_INVALID;}
+	assert(ra->max_inflight && ra->max_inflight <= ASYNC_MAX_INFLIGHT && ra->request_size % ra->blk.block_size == 0);
+	/* requests left over from an aborted transfer would overwrite the new buffer */
+	enum iost res = async_readahead_drain(ra);
+	/* even if that failed, so the stream addresses can be used by the next ring transfer */
+	if (ring_size(ra)) {
+		u8 *map_end = ring_map_end(ra, ra->map_start);
+		if (map_end > ra->map_start) {mmu_unmap_range((u64)ra->map_start, (u64)map_end - 1);}
+		ra->ring.end = ra->ring.start;
+	}
+	if (res == IOST_GLOBAL) {return IOST_GLOBAL;}
+	ra->next_lba = addr;
+	ra->consume_ptr = ra->end_ptr = ra->next_end_ptr = buf;
+	ra->stop_ptr = buf_end;
+	ra->redirect = (struct async_buf) {buf, buf};
+	ra->hold_ptr = 0;
+	return IOST_OK;
+}
+
+enum iost async_readahead_start_ring(struct async_blockdev *blk, u64 addr, u64 size, struct async_buf ring, u8 *stream) {
+	struct async_readahead *ra = (struct async_readahead *)blk;
+	if ((size_t)(ring.end - ring.start) < 2 * ASYNC_RING_SEGMENT
+		|| (uintptr_t)ring.start % ASYNC_RING_SEGMENT != 0
+		|| (size_t)(ring.end - ring.start) % ASYNC_RING_SEGMENT != 0
+		|| (uintptr_t)stream % ASYNC_RING_SEGMENT != 0
+		|| size > UINTPTR_MAX - (uintptr_t)stream
+	) {return IOST_INVALID;}
+	enum iost res = async_readahead_start(blk, addr, stream, stream + size);
+	if (res != IOST_OK) {return res;}
+	ra->ring = ring;
+	ra->ring_stream = ra->map_start = stream;
+	ring_map(ra, stream, ring_map_end(ra, stream));
+	return IOST_OK;
+}
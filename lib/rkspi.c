@@ -78,6 +78,8 @@ void rkspi_start_rx_xfer(struct rkspi_xfer_state *state, volatile struct rkspi_r
 }
 
 void rkspi_handle_interrupt(struct rkspi_xfer_state *state, volatile struct rkspi_regs *spi) {
+	timestamp_t start = get_timestamp();
+	state->interrupts += 1;
 	if (!(spi->intr_status & RKSPI_RX_FULL_INTR)) {
 		die("unexpected SPI interrupt status %"PRIx32"\n", spi->intr_status);
 	}
@@ -90,12 +92,93 @@ void rkspi_handle_interrupt(struct rkspi_xfer_state *state, volatile struct rksp
 	atomic_store_explicit(&state->buf, (void *)buf, memory_order_release);
 	//TODO spew("pos=0x%zx, this_xfer=%"PRIu16"\n", pos, state->this_xfer_items);
 	sched_queue_list(CURRENT_RUNQUEUE, &state->waiters);
-	if ((state->this_xfer_items -= read_items) == 0) {
-		if (end <= buf) {return;}
+	if ((state->this_xfer_items -= read_items) == 0 && buf < end) {
 		spi->enable = 0;
 		debugs("starting next transfer\n");
 		rkspi_start_rx_xfer(state, spi, (size_t)(end - buf) * 2);
 	}
+	state->handler_ticks += get_timestamp() - start;
+}
+
+void rkspi_start_rx_dma(struct rkspi_xfer_state *state, volatile struct rkspi_regs *spi, size_t bytes) {
+	if (bytes > RKSPI_DMA_SEGMENT) {bytes = RKSPI_DMA_SEGMENT;}
+	assert(bytes % (2 * RKSPI_DMA_BURST) == 0);
+	debug("starting %zu-byte DMA RX transfer\n", bytes);
+	state->segment_end = (u8 *)atomic_load_explicit(&state->buf, memory_order_relaxed) + bytes;
+	spi->dma_rx_level = RKSPI_DMA_BURST - 1;
+	spi->dma_ctrl = RKSPI_DMA_RX;
+	spi->ctrl1 = bytes - 1;
+	spi->enable = 1;
+}
+
+void rkspi_dma_progress(struct rkspi_xfer_state *state, volatile struct rkspi_regs *spi, void *pos) {
+	assert(pos <= state->segment_end);
+	atomic_store_explicit(&state->buf, pos, memory_order_release);
+	sched_queue_list(CURRENT_RUNQUEUE, &state->waiters);
+	if (pos == state->segment_end && pos < state->end) {
+		spi->enable = 0;
+		rkspi_start_rx_dma(state, spi, (u8 *)state->end - (u8 *)pos);
+	}
+}
+
+void rkspi_tx_cmd(volatile struct rkspi_regs *spi, const u8 *buf, const u8 *end) {
+	spi->slave_enable = 1;
+	spi->ctrl0 = rkspi_mode_base | RKSPI_XFM_TX | RKSPI_BHT_APB_8BIT;
+	spi->enable = 1;
+	u32 fifo_left = 32;
+	while (buf < end) {
+		if (!fifo_left) {
+			fifo_left = 32 - spi->tx_fifo_level;
+		}
+		spi->tx = *buf++;
+		fifo_left -= 1;
+	}
+	while (spi->status & 1) {__asm__ volatile("yield");}
+	spi->enable = 0;
+	spi->slave_enable = 0;
+}
+
+_Bool rkspi_flash_wait_ready(volatile struct rkspi_regs *spi, timestamp_t timeout) {
+	timestamp_t start = get_timestamp();
+	_Bool ready = 0;
+	spi->slave_enable = 1;
+	spi->ctrl0 = rkspi_mode_base | RKSPI_XFM_TR | RKSPI_BHT_APB_8BIT;
+	spi->enable = 1;
+	spi->tx = 5;
+	spi->tx = 0xff;
+	while (spi->rx_fifo_level < 2) {__asm__("yield");}
+	spi->rx;
+	/* a missing or floating chip reads as 0xff, i. e. always busy */
+	while (!(ready = !(spi->rx & 1)) && get_timestamp() - start <= timeout) {
+		spi->tx = 0xff;
+		while (!spi->rx_fifo_level) {__asm__("yield");}
+	}
+	spi->enable = 0;
+	spi->slave_enable = 0;
+	return ready;
+}
+
+void rkspi_read_sfdp(volatile struct rkspi_regs *spi, u32 addr, u8 *buf, size_t size) {
+	assert(!(addr >> 24));
+	spi->slave_enable = 1;
+	rkspi_tx_cmd4_dummy1(spi, 0x5a << 24 | addr);
+	rkspi_recv_fast(spi, buf, size);
+	spi->slave_enable = 0;
+}
+
+u64 rkspi_flash_size(volatile struct rkspi_regs *spi) {
+	u8 _Alignas(2) sfdp[16];
+	rkspi_read_sfdp(spi, 0, sfdp, 16);
+	if (sfdp[0] != 'S' || sfdp[1] != 'F' || sfdp[2] != 'D' || sfdp[3] != 'P') {return 0;}
+	/* the first parameter header is for the JEDEC basic flash parameter table, whose second DWORD is the density */
+	u8 id = sfdp[8], length = sfdp[11];
+	u32 ptp = sfdp[12] | (u32)sfdp[13] << 8 | (u32)sfdp[14] << 16;
+	if (id != 0 || length < 2) {return 0;}
+	rkspi_read_sfdp(spi, ptp, sfdp, 8);
+	u32 density = sfdp[4] | (u32)sfdp[5] << 8 | (u32)sfdp[6] << 16 | (u32)sfdp[7] << 24;
+	if (!(density >> 31)) {return ((u64)density + 1) / 8;}
+	density &= 0x7fffffff;
+	return density >= 3 && density < 64 ? (u64)1 << (density - 3) : 0;
 }
 
 void rkspi_read_flash_poll(volatile struct rkspi_regs *spi, u8 *buf, size_t buf_size, u32 addr) {
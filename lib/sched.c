@@ -11,16 +11,168 @@
 _Static_assert(ATOMIC_POINTER_LOCK_FREE == 2, "atomic pointers are not lock-free");
 _Static_assert(sizeof(void *) == sizeof(_Atomic(void*)), "atomic pointers have different size");
 
+/* where threads go off-CPU, for the trace */
+enum {
+	SITE_PREEMPT,
+	SITE_YIELD,
+	SITE_PRIORITY,
+	SITE_SLEEP,
+	SITE_FINISH_U32,
+	SITE_FINISH_U8,
+	SITE_FINISH_U8PTR,
+	SITE_FINISH_U16,
+	NUM_SITE
+};
+enum {TRACE_DISPATCH = 'd', TRACE_PARK = 'p', TRACE_WAKE = 'w', TRACE_EXIT = 'x'};
+
+#if CONFIG_SCHED_TRACE
+#ifndef CONFIG_SCHED_TRACE_SIZE
+#define CONFIG_SCHED_TRACE_SIZE 4096
+#endif
+#ifndef CONFIG_SCHED_TRACE_THREADS
+#define CONFIG_SCHED_TRACE_THREADS 16
+#endif
+
+static const char *const site_names[NUM_SITE] = {
+	[SITE_PREEMPT] = "preempt",
+	[SITE_YIELD] = "sched_yield",
+	[SITE_PRIORITY] = "sched_set_priority",
+	[SITE_SLEEP] = "usleep",
+	[SITE_FINISH_U32] = "sched_finish_u32",
+	[SITE_FINISH_U8] = "sched_finish_u8",
+	[SITE_FINISH_U8PTR] = "sched_finish_u8ptr",
+	[SITE_FINISH_U16] = "sched_wait_u16",
+};
+
+static struct trace_event {
+	timestamp_t timestamp;
+	const struct sched_runnable *runnable;
+	u8 kind, cpu, site;
+} trace_ring[CONFIG_SCHED_TRACE_SIZE];
+static u32 trace_pos = 0;
+
+static struct thread_stats {
+	const struct sched_runnable *runnable;
+	const char *name;
+	/* dispatch time while running, park time while waiting */
+	timestamp_t since;
+	u64 run_ticks;
+	u64 wait_ticks[NUM_SITE];
+	u32 waits[NUM_SITE];
+	u32 dispatches;
+	u8 site, cpu;
+	enum {STATS_NEW = 0, STATS_RUNNING, STATS_WAITING} state;
+} thread_stats[CONFIG_SCHED_TRACE_THREADS];
+static irq_lock_t trace_lock = IRQ_LOCK_INIT;
+
+/* returns 0 if the table is full. must be called with trace_lock held */
+static struct thread_stats *find_stats(const struct sched_runnable *runnable) {
+	for_array(i, thread_stats) {
+		struct thread_stats *st = thread_stats + i;
+		if (st->runnable == runnable) {return st;}
+		if (!st->runnable) {
+			st->runnable = runnable;
+			return st;
+		}
+	}
+	return 0;
+}
+
+static void trace(u8 kind, const struct sched_runnable *runnable, u8 site) {
+	u64 mpidr;
+	__asm__("mrs %0, MPIDR_EL1" : "=r"(mpidr));
+	irq_save_t irq = irq_lock(&trace_lock);
+	timestamp_t now = get_timestamp();
+	struct thread_stats *st = find_stats(runnable);
+	if (kind == TRACE_EXIT) {
+		/* sched_run can't tell whether the thread parked or exited. if it parked, it was already accounted, and may even be running on another CPU by now */
+		if (!st || st->state != STATS_RUNNING || st->cpu != (mpidr & 0xff)) {
+			irq_unlock(&trace_lock, irq);
+			return;
+		}
+		st->run_ticks += now - st->since;
+		st->state = STATS_NEW;
+	} else if (st && kind == TRACE_DISPATCH) {
+		if (st->state == STATS_WAITING) {
+			st->wait_ticks[st->site] += now - st->since;
+			st->waits[st->site] += 1;
+		}
+		st->since = now;
+		st->dispatches += 1;
+		st->cpu = mpidr & 0xff;
+		st->state = STATS_RUNNING;
+	} else if (st && kind == TRACE_PARK) {
+		if (st->state == STATS_RUNNING) {st->run_ticks += now - st->since;}
+		st->since = now;
+		st->site = site;
+		st->state = STATS_WAITING;
+	}
+	trace_ring[trace_pos++ % CONFIG_SCHED_TRACE_SIZE] = (struct trace_event) {
+		.timestamp = now,
+		.runnable = runnable,
+		.kind = kind,
+		.cpu = mpidr & 0xff,
+		.site = site,
+	};
+	irq_unlock(&trace_lock, irq);
+}
+
+void sched_trace_name(const struct sched_runnable *runnable, const char *name) {
+	irq_save_t irq = irq_lock(&trace_lock);
+	struct thread_stats *st = find_stats(runnable);
+	if (st) {st->name = name;}
+	irq_unlock(&trace_lock, irq);
+}
+
+void sched_trace_dump() {
+	irq_save_t irq = irq_lock(&trace_lock);
+	printf("sched-trace: begin %u %"PRIu32" %u\n", (unsigned)TICKS_PER_MICROSECOND, trace_pos, (unsigned)CONFIG_SCHED_TRACE_SIZE);
+	for_array(i, site_names) {printf("sched-trace: site %u %s\n", (unsigned)i, site_names[i]);}
+	for_array(i, thread_stats) {
+		const struct thread_stats *st = thread_stats + i;
+		if (!st->runnable) {break;}
+		printf("sched-trace: thread %"PRIxPTR" %s %"PRIu64" %"PRIu32"\n", (uintptr_t)st->runnable, st->name ? st->name : "-", st->run_ticks, st->dispatches);
+		for_array(s, st->waits) {
+			if (!st->waits[s]) {continue;}
+			printf("sched-trace: wait %"PRIxPTR" %u %"PRIu64" %"PRIu32"\n", (uintptr_t)st->runnable, (unsigned)s, st->wait_ticks[s], st->waits[s]);
+		}
+	}
+	u32 first = trace_pos > CONFIG_SCHED_TRACE_SIZE ? trace_pos - CONFIG_SCHED_TRACE_SIZE : 0;
+	for_range(i, first, trace_pos) {
+		const struct trace_event *ev = trace_ring + i % CONFIG_SCHED_TRACE_SIZE;
+		printf("sched-trace: event %"PRIuTS" %u %c %"PRIxPTR" %u\n", ev->timestamp, (unsigned)ev->cpu, ev->kind, (uintptr_t)ev->runnable, (unsigned)ev->site);
+	}
+	puts("sched-trace: end");
+	irq_unlock(&trace_lock, irq);
+}
+#else
+static inline void trace(u8 UNUSED kind, const struct sched_runnable UNUSED *runnable, u8 UNUSED site) {}
+#endif
+
+void sched_run(struct sched_runnable *runnable) {
+	trace(TRACE_DISPATCH, runnable, 0);
+	arch_sched_run(runnable);
+	trace(TRACE_EXIT, runnable, 0);
+}
+
 void sched_queue_many(struct sched_runnable_list *list, struct sched_runnable *first, struct sched_runnable *last) {
 	if (list == CURRENT_RUNQUEUE) {
 		irq_save_t irq = irq_save_mask();
 		list = &get_runqueue()->fresh;
 		irq_restore(irq);
 	}
+#if CONFIG_SCHED_TRACE
+	for (struct sched_runnable *r = first; 1; r = r->next) {
+		trace(TRACE_WAKE, r, 0);
+		if (r == last) {break;}
+	}
+#endif
 	struct sched_runnable *next = atomic_load_explicit(&list->head, memory_order_acquire);
 	do {
 		last->next = next;
 	} while(!atomic_compare_exchange_weak_explicit(&list->head, &next, first, memory_order_release, memory_order_acquire));
+	/* idle CPUs wait in WFE, wake them so they can pick up (or steal) the work */
+	__asm__ volatile("dsb ishst;sev" : : : "memory");
 }
 
 void sched_queue_single(struct sched_runnable_list *list, struct sched_runnable *runnable) {
@@ -36,12 +188,13 @@ void sched_queue_list(struct sched_runnable_list *dest, struct sched_runnable_li
 	sched_queue_many(dest, head, last);
 }
 
+#ifndef CONFIG_SCHED_MAX_STREAK
+#define CONFIG_SCHED_MAX_STREAK 16
+#endif
+
 struct sched_runnable *sched_unqueue(struct sched_runqueue *rq) {
 	struct sched_runnable *fresh = atomic_exchange_explicit(&rq->fresh.head, 0, memory_order_acquire);
-	if (fresh) {	/* add fresh entries in reverse order */
-		struct sched_runnable **old_tail = rq->tail;
-		if (!rq->tail) {old_tail = &rq->head;}
-		rq->tail = &fresh->next;
+	if (fresh) {	/* reverse the fresh entries, then append them to their FIFOs in order */
 		struct sched_runnable *next = 0;
 		do {
 			struct sched_runnable *tmp = fresh->next;
@@ -49,19 +202,61 @@ struct sched_runnable *sched_unqueue(struct sched_runqueue *rq) {
 			next = fresh;
 			fresh = tmp;
 		} while (fresh);
-		*old_tail = next;
+		while (next) {
+			struct sched_runnable *r = next;
+			next = r->next;
+			r->next = 0;
+			u8 prio = r->priority < NUM_SCHED_PRIO ? r->priority : NUM_SCHED_PRIO - 1;
+			if (!rq->tail[prio]) {rq->tail[prio] = &rq->head[prio];}
+			*rq->tail[prio] = r;
+			rq->tail[prio] = &r->next;
+		}
+	}
+	u32 prio = NUM_SCHED_PRIO;
+	while (prio && !rq->head[prio - 1]) {prio -= 1;}
+	if (!prio) {return 0;}
+	prio -= 1;
+	u32 lower = prio;
+	while (lower && !rq->head[lower - 1]) {lower -= 1;}
+	if (!lower) {
+		rq->streak = 0;
+	} else if (++rq->streak > CONFIG_SCHED_MAX_STREAK) {
+		rq->streak = 0;
+		prio = lower - 1;
 	}
-	struct sched_runnable *res = rq->head;
-	if (!res) {return 0;}
-	if (!(rq->head = res->next)){rq->tail = &rq->head;}
+	struct sched_runnable *res = rq->head[prio];
+	if (!(rq->head[prio] = res->next)) {rq->tail[prio] = &rq->head[prio];}
 	return res;
 }
 
+struct sched_runnable *sched_unqueue_steal(struct sched_runqueue *runqueues, u32 num_runqueues, u32 self) {
+	struct sched_runqueue *rq = runqueues + self;
+	struct sched_runnable *res = sched_unqueue(rq);
+	if (res) {return res;}
+	for_range(i, 1, num_runqueues) {
+		struct sched_runqueue *victim = runqueues + (self + i) % num_runqueues;
+		/* taking the whole list is ABA-safe, unlike popping single entries off it */
+		struct sched_runnable *stolen = atomic_exchange_explicit(&victim->fresh.head, 0, memory_order_acquire);
+		if (!stolen) {continue;}
+		struct sched_runnable *last = stolen;
+		while (last->next) {last = last->next;}
+		/* no need to wake anyone, we are about to run it */
+		struct sched_runnable *next = atomic_load_explicit(&rq->fresh.head, memory_order_relaxed);
+		do {
+			last->next = next;
+		} while(!atomic_compare_exchange_weak_explicit(&rq->fresh.head, &next, stolen, memory_order_relaxed, memory_order_relaxed));
+		return sched_unqueue(rq);
+	}
+	return 0;
+}
+
 void sched_thread_preempted(struct sched_runnable *thread) {
+	trace(TRACE_PARK, thread, SITE_PREEMPT);
 	sched_queue_single(CURRENT_RUNQUEUE, thread);
 }
 
 static void yield_finish(struct sched_runnable *continuation) {
+	trace(TRACE_PARK, continuation, SITE_YIELD);
 	sched_queue_single(CURRENT_RUNQUEUE, continuation);
 }
 
@@ -69,8 +264,19 @@ void sched_yield() {
 	call_cc(yield_finish);
 }
 
+static void priority_finish(struct sched_runnable *continuation, volatile void UNUSED *a, volatile void UNUSED *b, ureg_t priority) {
+	trace(TRACE_PARK, continuation, SITE_PRIORITY);
+	continuation->priority = priority;
+	sched_queue_single(CURRENT_RUNQUEUE, continuation);
+}
+
+void sched_set_priority(u8 priority) {
+	call_cc_ptr2_int1(priority_finish, 0, 0, priority);
+}
+
 void sched_finish_u32(struct sched_runnable *continuation, volatile void *reg, volatile void *list_, ureg_t mask, ureg_t expected) {
 	struct sched_runnable_list *list = (struct sched_runnable_list *)list_;
+	trace(TRACE_PARK, continuation, SITE_FINISH_U32);
 	sched_queue_single(list, continuation);
 	/* in the critical case where the notifier just dequeued before we enqueued, we are already synchronized by the dequeue-enqueue, so relaxed is OK */
 	u32 val = atomic_load_explicit((volatile _Atomic(u32) *)reg, memory_order_relaxed);
@@ -81,6 +287,7 @@ void sched_finish_u32(struct sched_runnable *continuation, volatile void *reg, v
 
 void sched_finish_u8(struct sched_runnable *continuation, volatile void *reg, volatile void *list_, ureg_t mask, ureg_t expected) {
 	struct sched_runnable_list *list = (struct sched_runnable_list *)list_;
+	trace(TRACE_PARK, continuation, SITE_FINISH_U8);
 	sched_queue_single(list, continuation);
 	/* in the critical case where the notifier just dequeued before we enqueued, we are already synchronized by the dequeue-enqueue, so relaxed is OK */
 	u8 val = atomic_load_explicit((volatile _Atomic(u8) *)reg, memory_order_relaxed);
@@ -91,6 +298,7 @@ void sched_finish_u8(struct sched_runnable *continuation, volatile void *reg, vo
 
 void sched_finish_u8ptr(struct sched_runnable *continuation, volatile void *ptr, volatile void *list_, ureg_t expected) {
 	struct sched_runnable_list *list = (struct sched_runnable_list *)list_;
+	trace(TRACE_PARK, continuation, SITE_FINISH_U8PTR);
 	sched_queue_single(list, continuation);
 	/* in the critical case where the notifier just dequeued before we enqueued, we are already synchronized by the dequeue-enqueue, so relaxed is OK */
 	u8 *val = atomic_load_explicit((volatile _Atomic(u8 *) *)ptr, memory_order_relaxed);
@@ -102,6 +310,7 @@ void sched_finish_u8ptr(struct sched_runnable *continuation, volatile void *ptr,
 
 static void finish_u16(struct sched_runnable *continuation, volatile void *reg, volatile void *list_, ureg_t mask, ureg_t expected) {
 	struct sched_runnable_list *list = (struct sched_runnable_list *)list_;
+	trace(TRACE_PARK, continuation, SITE_FINISH_U16);
 	sched_queue_single(list, continuation);
 	/* in the critical case where the notifier just dequeued before we enqueued, we are already synchronized by the dequeue-enqueue, so relaxed is OK */
 	u8 val = atomic_load_explicit((volatile _Atomic(u16) *)reg, memory_order_relaxed);
@@ -116,10 +325,62 @@ void sched_wait_u8(struct sched_runnable_list *list, _Atomic(u8) *var, u8 mask,
 	call_cc_ptr2_int2(sched_finish_u8, var, list, mask, expected);
 }
 
-/* TODO: make a proper interrupt-driven timer infrastructure */
+#ifndef CONFIG_SCHED_MAX_SLEEPERS
+#define CONFIG_SCHED_MAX_SLEEPERS 32
+#endif
+
+/* min-heap of sleeping threads, ordered by deadline */
+static struct sleeper {
+	timestamp_t deadline;
+	struct sched_runnable *runnable;
+} sleepers[CONFIG_SCHED_MAX_SLEEPERS];
+static u32 num_sleepers = 0;
+static irq_lock_t sleepers_lock = IRQ_LOCK_INIT;
+
+static void sleep_finish(struct sched_runnable *continuation, volatile void UNUSED *a, volatile void UNUSED *b, ureg_t deadline, ureg_t UNUSED d) {
+	trace(TRACE_PARK, continuation, SITE_SLEEP);
+	irq_save_t irq = irq_lock(&sleepers_lock);
+	if (num_sleepers >= CONFIG_SCHED_MAX_SLEEPERS) {
+		/* fall back to polling, usleep checks the deadline again */
+		irq_unlock(&sleepers_lock, irq);
+		sched_queue_single(CURRENT_RUNQUEUE, continuation);
+		return;
+	}
+	u32 pos = num_sleepers++;
+	while (pos) {
+		u32 parent = (pos - 1) / 2;
+		if (sleepers[parent].deadline <= deadline) {break;}
+		sleepers[pos] = sleepers[parent];
+		pos = parent;
+	}
+	sleepers[pos] = (struct sleeper) {.deadline = deadline, .runnable = continuation};
+	if (!pos) {plat_timer_set_deadline(deadline);}
+	irq_unlock(&sleepers_lock, irq);
+}
+
 void usleep(u32 usecs) {
-	timestamp_t start = get_timestamp();
-	while (get_timestamp() - start < (timestamp_t)usecs*TICKS_PER_MICROSECOND) {
-		sched_yield();
+	timestamp_t deadline = get_timestamp() + (timestamp_t)usecs*TICKS_PER_MICROSECOND;
+	while (get_timestamp() < deadline) {
+		call_cc_ptr2_int2(sleep_finish, 0, 0, deadline, 0);
+	}
+}
+
+void sched_expire_timers(timestamp_t now) {
+	irq_save_t irq = irq_lock(&sleepers_lock);
+	while (num_sleepers && sleepers[0].deadline <= now) {
+		sched_queue_single(CURRENT_RUNQUEUE, sleepers[0].runnable);
+		struct sleeper last = sleepers[--num_sleepers];
+		u32 pos = 0;
+		while (1) {
+			u32 child = 2 * pos + 1;
+			if (child >= num_sleepers) {break;}
+			if (child + 1 < num_sleepers && sleepers[child + 1].deadline < sleepers[child].deadline) {child += 1;}
+			if (last.deadline <= sleepers[child].deadline) {break;}
+			sleepers[pos] = sleepers[child];
+			pos = child;
+		}
+		sleepers[pos] = last;
 	}
+	plat_timer_set_deadline(num_sleepers ? sleepers[0].deadline : ~(timestamp_t)0);
+	irq_unlock(&sleepers_lock, irq);
 }
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: CC0-1.0 */
 #include <uart.h>
 #include <stdio.h>
+#include <string.h>
 #include <arch.h>
 #include <irq.h>
 #include <plat.h>
@@ -8,11 +9,92 @@
 HEADER_FUNC uint32_t mmio_r32(volatile uint32_t *reg) {return *reg;}
 HEADER_FUNC void mmio_w32(volatile uint32_t *reg, uint32_t val) {*reg = val;}
 
+static const size_t depth = CONFIG_CONSOLE_FIFO_DEPTH;
+
+#if CONFIG_CONSOLE_RING_SIZE
+_Static_assert((CONFIG_CONSOLE_RING_SIZE & (CONFIG_CONSOLE_RING_SIZE - 1)) == 0, "console ring size must be a power of 2");
+/* writers reserve space by advancing `reserved`, copy their text and then advance `committed` in reservation order.
+ * whoever holds `draining` moves committed text into the FIFO and advances `drained`. all positions are free-running */
+static char ring[CONFIG_CONSOLE_RING_SIZE];
+static _Atomic(size_t) reserved = 0, committed = 0, drained = 0;
+static atomic_flag draining = ATOMIC_FLAG_INIT;
+
+/* the caller must have IRQs masked, so an interrupt handler can't spin on a drain it interrupted */
+static _Bool drain() {
+	if (atomic_flag_test_and_set_explicit(&draining, memory_order_acquire)) {return 1;}
+	size_t pos = atomic_load_explicit(&drained, memory_order_relaxed);
+	size_t end = atomic_load_explicit(&committed, memory_order_acquire);
+	size_t space = depth - mmio_r32(&console_uart->tx_level);
+	if (end - pos > space) {end = pos + space;}
+	for (; pos != end; ++pos) {
+		mmio_w32(&console_uart->tx, ring[pos % CONFIG_CONSOLE_RING_SIZE]);
+	}
+	atomic_store_explicit(&drained, pos, memory_order_release);
+	atomic_flag_clear_explicit(&draining, memory_order_release);
+	return pos != atomic_load_explicit(&reserved, memory_order_relaxed);
+}
+
+_Bool plat_drain_console() {
+	irq_save_t irq = irq_save_mask();
+	_Bool pending = drain();
+	irq_restore(irq);
+	return pending;
+}
+
+static void write_ring(const char *str, size_t len) {
+	size_t start = atomic_load_explicit(&reserved, memory_order_relaxed);
+	while (1) {
+		if (start + len - atomic_load_explicit(&drained, memory_order_acquire) > CONFIG_CONSOLE_RING_SIZE) {
+			/* full: wait for the UART like an unbuffered console would */
+			drain();
+			arch_relax_cpu();
+			start = atomic_load_explicit(&reserved, memory_order_relaxed);
+			continue;
+		}
+		if (atomic_compare_exchange_weak_explicit(&reserved, &start, start + len, memory_order_relaxed, memory_order_relaxed)) {break;}
+	}
+	size_t offset = start % CONFIG_CONSOLE_RING_SIZE, first = CONFIG_CONSOLE_RING_SIZE - offset;
+	if (first > len) {first = len;}
+	memcpy(ring + offset, str, first);
+	memcpy(ring, str + first, len - first);
+	/* commits are ordered, so this only waits for writers that are copying right now */
+	while (atomic_load_explicit(&committed, memory_order_relaxed) != start) {arch_relax_cpu();}
+	atomic_store_explicit(&committed, start + len, memory_order_release);
+}
+
+void plat_write_console(const char *str, size_t len) {
+	irq_save_t irq = irq_save_mask();
+	while (len) {
+		/* larger writes are split, so they can't exceed the ring */
+		size_t this_round = len <= CONFIG_CONSOLE_RING_SIZE / 4 ? len : CONFIG_CONSOLE_RING_SIZE / 4;
+		write_ring(str, this_round);
+		str += this_round;
+		len -= this_round;
+	}
+	drain();
+	irq_restore(irq);
+}
+
+int fflush(FILE UNUSED *f) {
+	irq_save_t irq = irq_save_mask();
+	size_t end = atomic_load_explicit(&reserved, memory_order_relaxed);
+	while ((intptr_t)(end - atomic_load_explicit(&drained, memory_order_acquire)) > 0) {
+		drain();
+		arch_relax_cpu();
+	}
+	while (mmio_r32(&console_uart->tx_level)) {
+		arch_relax_cpu();
+	}
+	irq_restore(irq);
+	return 0;
+}
+#else
 static irq_lock_t console_lock = IRQ_LOCK_INIT;
 
+_Bool plat_drain_console() {return 0;}
+
 void plat_write_console(const char *str, size_t len) {
 	irq_save_t irq = irq_lock(&console_lock);
-	static const size_t depth = CONFIG_CONSOLE_FIFO_DEPTH;
 	while (len) {
 		size_t this_round = len <= depth ? len : depth;
 		while (mmio_r32(&console_uart->tx_level) > depth - this_round) {
@@ -34,4 +116,4 @@ int fflush(FILE UNUSED *f) {
 	irq_unlock(&console_lock, irq);
 	return 0;
 }
-
+#endif
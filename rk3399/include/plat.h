@@ -14,6 +14,8 @@ static const phys_addr_t PLAT_INVALID_PHYS_ADDR = 0xffffffff;
 
 extern volatile struct uart *const console_uart;
 void plat_write_console(const char *str, size_t len);
+/* moves buffered console output into the UART FIFO, without waiting. returns whether output is still pending, so idle loops know to call it again instead of sleeping */
+_Bool plat_drain_console();
 
 _Noreturn void plat_panic();
 
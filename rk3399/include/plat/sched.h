@@ -1,5 +1,8 @@
 /* SPDX-License-Identifier: CC0-1.0 */
 #pragma once
+#include <plat.h>
 
 struct sched_runqueue;
 struct sched_runqueue *get_runqueue();
+/* makes the platform timer interrupt at `deadline` (or earlier) and call sched_expire_timers. called with the sleeper queue locked */
+void plat_timer_set_deadline(timestamp_t deadline);
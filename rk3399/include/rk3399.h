@@ -54,6 +54,7 @@ enum {
 	PMU_BUS_IDLE_REQ = 0x60 >> 2,
 	PMU_BUS_IDLE_ST = 0x64 >> 2,
 	PMU_BUS_IDLE_ACK = 0x64 >> 2,
+	PMU_CORE_PWR_ST = 0x7c >> 2,
 	PMU_DDR_SREF_ST = 0x98 >> 2,
 	PMU_NOC_AUTO_ENA = 0xd8 >> 2,
 };
@@ -73,3 +74,7 @@ enum {
 };
 
 enum {CYCLES_PER_MICROSECOND = TICKS_PER_MICROSECOND};
+
+/* the upper half of PMU SRAM carries the boot timeline from sramstage to dramstage, the lower half has the secondary CPU trampoline */
+#define BOOT_TIMELINE_SRAM_ADDR UINT64_C(0xff3b1000)
+#define BOOT_TIMELINE_SRAM_SIZE 0x1000
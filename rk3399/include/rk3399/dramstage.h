@@ -20,21 +20,24 @@ void boot_sd();
 void boot_emmc();
 void boot_spi();
 void boot_nvme();
+/* called from the IRQ handler on PL330 (DMAC_PERI) interrupts during SPI DMA reads */
+void spi1_handle_dma_interrupt();
 
 extern u32 entropy_buffer[];
 extern u16 entropy_words;
 void pull_entropy(_Bool keep_running);
 
 /* access to these is only allowed by the currently cued boot medium thread */
+struct async_buf;
 struct async_transfer;
 struct async_blockdev;
 struct payload_desc;
 struct payload_desc *get_payload_desc();
 enum iost decompress_payload(struct async_transfer *async);
-enum iost boot_blockdev(struct async_blockdev *blk);
 
 /* boot commit functions: only run after all boot medium threads have finished running */
 struct fdt_header;
+struct boot_timeline;
 
 struct fdt_addendum {
 	u64 fdt_address;
@@ -42,6 +45,8 @@ struct fdt_addendum {
 	u32 *entropy;
 	size_t entropy_words;
 	u32 boot_cpu;
+	/* published in /chosen if nonzero */
+	const struct boot_timeline *timeline;
 };
 
 _Bool transform_fdt(struct fdt_header *out_header, u32 *out_end, const struct fdt_header *header, const char *in_end, struct fdt_addendum *info);
@@ -56,13 +61,55 @@ enum boot_medium {
 	NUM_BOOT_MEDIUM,
 	BOOT_CUE_NONE = NUM_BOOT_MEDIUM,
 	BOOT_CUE_EXIT,
+	/* the block devices come first, only they stream their payload through a ring (see get_payload_ring) */
+	NUM_BLOCK_MEDIUM = BOOT_MEDIUM_SPI,
 };
 _Static_assert(4 * NUM_BOOT_MEDIUM <= 32, "boot state does not fit into 32 bits");
+_Static_assert(BOOT_MEDIUM_SPI == NUM_BOOT_MEDIUM - 1, "SPI must be the last boot medium");
+/* lets the boot monitor cue the medium, without waiting for it */
+void boot_medium_ready(enum boot_medium);
+/* returns the current cue: a boot medium, BOOT_CUE_NONE or BOOT_CUE_EXIT */
+enum boot_medium get_boot_cue();
 _Bool wait_for_boot_cue(enum boot_medium);
+/* only valid for block devices, i. e. `medium` < NUM_BLOCK_MEDIUM */
+struct async_buf get_payload_ring(enum boot_medium);
+struct async_stats;
+/* the I/O statistics of a boot medium, for its async_transfer to point to. printed and added to the boot timeline before commit */
+struct async_stats *get_io_stats(enum boot_medium);
+/* parses the GPT, prefetches the payload partition until the medium is cued and then loads the payload from it. returns IOST_INVALID if the medium isn't cued */
+enum iost boot_blockdev(struct async_blockdev *blk, enum boot_medium medium);
 void boot_medium_loaded(enum boot_medium);
 void boot_medium_exit(enum boot_medium);
 
-#define DEFINE_VSTACK(X) X(CPU0) X(MONITOR) X(BOARD_PROBE) DEFINE_BOOT_MEDIUM(X)
+/* the medium and payload partition (index and LBA range) that were booted from last time */
+struct boot_hint {
+	u8 medium, partition;
+	u8 padding[6];
+	u64 first_lba, last_lba;
+};
+/* called by boot media threads to record where they found their payload */
+void boot_medium_payload_location(enum boot_medium medium, u8 partition, u64 first_lba, u64 last_lba);
+#if CONFIG_BOOT_HINT
+/* called by boot_spi before it waits for its cue, with 0 if no valid hint was found. the boot monitor waits for this before cueing anything */
+void boot_hint_read(const struct boot_hint *hint);
+/* persists the hint in SPI flash. only call after boot_spi has exited. returns 0 if the flash can't hold the hint or timed out */
+_Bool spi_write_boot_hint(const struct boot_hint *hint);
+#endif
+
+/* secondary CPUs: only the Cortex-A53 cluster is brought up, reset_entry does not know how to initialize the A72s */
+enum {NUM_CPU = 4};
+struct sched_runnable;
+void start_secondary_cpus();
+void stop_secondary_cpus();
+/* bit mask of secondary CPUs that are running their scheduler loop */
+u32 secondary_cpus_online();
+/* queues `runnable` on the given CPU. idle CPUs steal work from the others, so this is a preference, not a guarantee */
+void sched_queue_on_cpu(u32 cpu, struct sched_runnable *runnable);
+/* takes the next runnable for the calling CPU from its own runqueue or, if that is empty, from another CPU's */
+struct sched_runnable *sched_unqueue_this_cpu();
+
+#define DEFINE_VSTACK(X) X(CPU0) X(CPU1) X(CPU2) X(CPU3) X(MONITOR) X(BOARD_PROBE) DEFINE_BOOT_MEDIUM(X)\
+	X(DECOMP0) X(DECOMP1) X(DECOMP2) X(DECOMP3)
 #define VSTACK_DEPTH UINT64_C(0x3000)
 
 #define DEFINE_REGMAP(MMIO)\
@@ -86,6 +133,7 @@ void boot_medium_exit(enum boot_medium);
 	MMIO(GPIO3, gpio3, 0xff788000, struct rkgpio_regs)\
 	MMIO(GPIO4, gpio4, 0xff790000, struct rkgpio_regs)\
 	MMIO(UART, uart, 0xff1a0000, struct uart)\
+	MMIO(DMAC_PERI, dmac_peri, 0xff6e0000, struct pl330_regs)\
 	MMIO(CRU, cru, 0xff760000, u32)\
 	MMIO(PMU, pmu, 0xff310000, u32)\
 	MMIO(PMUCRU, pmucru, 0xff750000, u32)\
@@ -16,3 +16,34 @@ static const u64 blob_addr = 0x04400000;
 static const u64 initcpio_addr = 0x08000000;
 
 static const struct async_buf blob_buffer = {(u8 *)blob_addr, (u8 *)initcpio_addr};
+
+/* block devices stream the payload through a ring buffer instead (see get_payload_ring), mapped at consecutive addresses from payload_stream_addr (see async_readahead_start_ring).
+ * every block device has its own ring and stream addresses, so they can prefetch while waiting for their cue.
+ * normally the rings are in blob_buffer. in arbitration mode (CONFIG_BOOT_ARBITRATION), they are larger and taken from the end of DRAM, so the media can load their whole payload concurrently, and the SPI payload can be loaded into blob_buffer before it is cued */
+#ifndef CONFIG_BOOT_ARBITRATION
+#define CONFIG_BOOT_ARBITRATION 0
+#endif
+#ifndef CONFIG_PAYLOAD_RING_SIZE
+#if CONFIG_BOOT_ARBITRATION
+#define CONFIG_PAYLOAD_RING_SIZE (64 << 20)
+#else
+#define CONFIG_PAYLOAD_RING_SIZE (16 << 20)
+#endif
+#endif
+static const u64 payload_stream_addr = 0x100000000, payload_stream_max = 0x80000000;
+HEADER_FUNC u8 *payload_stream(u32 medium) {
+	return (u8 *)(payload_stream_addr + medium * payload_stream_max);
+}
+/* how much of the payload partition a block device reads ahead before it is cued */
+#ifndef CONFIG_PAYLOAD_PREFETCH
+#if CONFIG_BOOT_ARBITRATION
+#define CONFIG_PAYLOAD_PREFETCH SIZE_MAX	/* as far as the ring goes */
+#else
+#define CONFIG_PAYLOAD_PREFETCH (4 << 20)
+#endif
+#endif
+
+/* how far block device readahead may run ahead of the decompressor in blob_buffer */
+#ifndef CONFIG_READAHEAD_WINDOW
+#define CONFIG_READAHEAD_WINDOW (4 << 20)
+#endif
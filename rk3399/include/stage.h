@@ -17,3 +17,5 @@ static inline u32 compute_crc32c(u64 *start, u64 *end, u32 seed) {
 
 void main();
 _Noreturn void secondary_cpu_main();
+void reset_entry();
+void cortex_a53_exit(_Bool reset);
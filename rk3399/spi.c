@@ -3,6 +3,7 @@
 #include <rk3399/payload.h>
 #include <inttypes.h>
 #include <stdatomic.h>
+#include <string.h>
 
 #include <aarch64.h>
 #include <rk3399.h>
@@ -18,10 +19,30 @@
 #include <dump_mem.h>
 #include <cache.h>
 #include <iost.h>
+#include <timer.h>
+#include <pl330.h>
+#include <pl330_regs.h>
+#include <checksum.h>
+
+#ifndef CONFIG_SPI_DMA
+#define CONFIG_SPI_DMA 1
+#endif
 
 static const u16 spi1_intr = 85;
 struct rkspi_xfer_state spi1_state = {};
 
+/* DMAC_PERI request line of the SPI1 RX FIFO, the physical address of that FIFO, and the interrupts of the DMAC */
+static const u8 spi1_rx_periph = 13;
+static const u32 spi1_rx_fifo = 0xff1d0800;
+static const u16 dmac_peri_intids[2] = {39, 40};
+/* channel and event number */
+static const u8 dma_chan = 0;
+/* the DMA channel signals progress at this granularity and at the end of the read; the SPI transfers have to be restarted by the CPU every RKSPI_DMA_SEGMENT bytes anyway */
+enum {DMA_BLOCK = 8192, DMA_BURST_BYTES = 2 * RKSPI_DMA_BURST, DMA_MAX_SIZE = 16 << 20};
+_Static_assert(RKSPI_DMA_SEGMENT % DMA_BLOCK == 0, "DMA blocks must not straddle SPI transfers");
+static UNCACHED _Alignas(64) u8 dma_prog[PL330_PROG_SIZE(DMA_MAX_SIZE / DMA_BURST_BYTES, DMA_BLOCK / DMA_BURST_BYTES)];
+static u8 *dma_buf;
+
 static void start_irq_flash_read(u32 addr, u8 *buf, u8 *end) {
 	volatile struct rkspi_regs *spi = regmap_spi1;
 	size_t total_bytes = end - buf;
@@ -50,57 +71,248 @@ static void rkspi_end_irq_flash_read() {
 	gicv2_wait_disabled(regmap_gic500d);
 }
 
+static _Bool start_dma_flash_read(u32 addr, u8 *buf, u8 *end) {
+	volatile struct rkspi_regs *spi = regmap_spi1;
+	volatile struct pl330_regs *dmac = regmap_dmac_peri;
+	end -= (size_t)(end - buf) % DMA_BURST_BYTES;
+	assert((u64)end <= 0x100000000 && end - buf <= DMA_MAX_SIZE);
+	/* no dirty lines may be evicted over the data stored by the DMAC */
+	invalidate_range(buf, end - buf);
+	u32 ccr = PL330_CCR_SRC_BURST(1, RKSPI_DMA_BURST) | PL330_CCR_DST_BURST(1, RKSPI_DMA_BURST) | PL330_CCR_DST_INC | PL330_CCR_SRC_PRIV | PL330_CCR_DST_PRIV;
+	if (pl330_nonsecure(dmac)) {ccr |= PL330_CCR_SRC_NS | PL330_CCR_DST_NS;}
+	pl330_prog_periph_to_mem(dma_prog, ccr, spi1_rx_fifo, (u32)(u64)buf, spi1_rx_periph, (end - buf) / DMA_BURST_BYTES, DMA_BLOCK / DMA_BURST_BYTES, dma_chan);
+	dmac->intclr = 1 << dma_chan;
+	dmac->inten |= 1 << dma_chan;
+	dma_buf = buf;
+	spi1_state.end = end;
+	atomic_store_explicit(&spi1_state.buf, buf, memory_order_release);
+	for_array(i, dmac_peri_intids) {
+		gicv2_setup_spi(regmap_gic500d, dmac_peri_intids[i], 0x80, 1, IGROUP_0 | INTR_LEVEL);
+	}
+	/* the channel waits for the first burst request, so it can be started before the SPI transfer */
+	if (IOST_OK != pl330_start(dmac, dma_chan, dma_prog)) {
+		for_array(i, dmac_peri_intids) {gicv2_disable_spi(regmap_gic500d, dmac_peri_intids[i]);}
+		gicv2_wait_disabled(regmap_gic500d);
+		dmac->inten &= ~(u32)(1 << dma_chan);
+		return 0;
+	}
+	spi->intr_mask = 0;
+	spi->slave_enable = 1; dsb_st();
+	rkspi_tx_fast_read_cmd(spi, addr);
+	spi->ctrl0 = rkspi_mode_base | RKSPI_XFM_RX | RKSPI_BHT_APB_16BIT;
+	rkspi_start_rx_dma(&spi1_state, spi, end - buf);
+	return 1;
+}
+
+/* returns the end of the data that the DMA channel has completely stored */
+static u8 *dma_progress(volatile struct pl330_regs *dmac) {
+	u32 base = (u32)(u64)dma_buf, total = (u8 *)spi1_state.end - dma_buf;
+	while (1) {
+		if (dmac->fsrc & 1 << dma_chan) {
+			die("DMAC_PERI channel fault, FTR=0x%"PRIx32" CPC=0x%"PRIx32"\n", dmac->ftr[dma_chan], dmac->chan_status[dma_chan].cpc);
+		}
+		u32 dar = dmac->chan[dma_chan].dar, done = dar - base;
+		u32 status = dmac->chan_status[dma_chan].csr & PL330_CSR_STATUS_MASK;
+		/* the program ends with a write barrier after the last (possibly partial) block, so all of it is stored once the channel has stopped */
+		if (status == PL330_CSR_STOPPED) {return dma_buf + (dmac->chan[dma_chan].dar - base);}
+		/* everything before the block DAR is in has passed the write barrier. on a block boundary, the barrier for the block before is only known to be done once the channel waits for the next burst */
+		if (done < total && (done % DMA_BLOCK || (status == PL330_CSR_WFP && dmac->chan[dma_chan].dar == dar))) {
+			return dma_buf + (done - done % DMA_BLOCK);
+		}
+		__asm__ volatile("yield");
+	}
+}
+
+void spi1_handle_dma_interrupt() {
+	timestamp_t start = get_timestamp();
+	volatile struct pl330_regs *dmac = regmap_dmac_peri;
+	spi1_state.interrupts += 1;
+	if (dmac->fsrd) {die("DMAC_PERI manager fault, FTRD=0x%"PRIx32"\n", dmac->ftrd);}
+	u32 intmis = dmac->intmis;
+	if (!(intmis & 1 << dma_chan) && !(dmac->fsrc & 1 << dma_chan)) {
+		die("unexpected DMAC_PERI interrupt status 0x%"PRIx32"\n", intmis);
+	}
+	dmac->intclr = 1 << dma_chan;
+	/* events are flags, so this may cover several blocks */
+	u8 *pos = dma_progress(dmac);
+	if (pos > (u8 *)atomic_load_explicit(&spi1_state.buf, memory_order_relaxed)) {
+		rkspi_dma_progress(&spi1_state, regmap_spi1, pos);
+	}
+	spi1_state.handler_ticks += get_timestamp() - start;
+}
+
+static void end_dma_flash_read() {
+	volatile struct rkspi_regs *spi = regmap_spi1;
+	volatile struct pl330_regs *dmac = regmap_dmac_peri;
+	pl330_kill(dmac, dma_chan);
+	dmac->inten &= ~(u32)(1 << dma_chan);
+	dmac->intclr = 1 << dma_chan;
+	spi->enable = 0;
+	spi->slave_enable = 0;
+	spi->dma_ctrl = 0;
+	dsb_st();
+	for_array(i, dmac_peri_intids) {gicv2_disable_spi(regmap_gic500d, dmac_peri_intids[i]);}
+	gicv2_wait_disabled(regmap_gic500d);
+}
+
 static struct async_buf pump(struct async_transfer *async_, size_t consume, size_t min_size) {
 	struct async_dummy *async = (struct async_dummy *)async_;
 	async->buf.start += consume;
 	u8 *old_end = async->buf.end;
+	timestamp_t wait_start = get_timestamp();
 	while (1) {
 		u8 *ptr = async->buf.end =atomic_load_explicit(&spi1_state.buf, memory_order_acquire);
 		if ((size_t)(ptr - async->buf.start) >= min_size || ptr == spi1_state.end) {break;}
 		spew("idle pos=0x%zx rxlvl=%"PRIu32", rxthreshold=%"PRIu32"\n", spi1_state.pos, spi->rx_fifo_level, spi->rx_fifo_threshold);
 		call_cc_ptr2_int1(sched_finish_u8ptr, &spi1_state.buf, &spi1_state.waiters, (ureg_t)ptr);
 	}
+	timestamp_t invalidate_start = get_timestamp();
 	invalidate_range(old_end, async->buf.end - old_end);
+	/* the flash is read in one long request, so there are no latencies to record */
+	async_->stats->bytes += async->buf.end - old_end;
+	async_->stats->wait_ticks += invalidate_start - wait_start;
+	async_->stats->cache_ticks += get_timestamp() - invalidate_start;
 	return async->buf;
 }
 
+static volatile u32 *const cru = regmap_cru;
+
+static void spi1_clock_enable() {
+	cru[CRU_CLKGATE_CON+23] = SET_BITS16(1, 0) << 11;
+	/* clk_spi1 = CPLL/8 = 100 MHz */
+	cru[CRU_CLKSEL_CON+59] = SET_BITS16(1, 0) << 15 | SET_BITS16(7, 7) << 8;
+	dsb_st();
+	cru[CRU_CLKGATE_CON+9] = SET_BITS16(1, 0) << 13;
+	regmap_spi1->baud = 2;
+}
+
+static void spi1_clock_disable() {
+	cru[CRU_CLKGATE_CON+9] = SET_BITS16(1, 1) << 13;
+}
+
+#if CONFIG_BOOT_HINT
+#ifndef CONFIG_BOOT_HINT_ADDR
+#define CONFIG_BOOT_HINT_ADDR 0xfff000	/* the last 4 KiB sector of 16 MiB flash */
+#endif
+struct boot_hint_record {
+	u32 magic;
+	u32 crc;	/* CRC32 of the hint */
+	struct boot_hint hint;
+};
+static const u32 boot_hint_magic = 0x544e4948;	/* "HINT" */
+
+static u32 boot_hint_crc(const struct boot_hint *hint) {
+	return ~crc32_update(~(u32)0, (const u8 *)hint, sizeof(*hint));
+}
+
+/* set by read_boot_hint if the flash is large enough to contain the hint sector */
+static _Bool boot_hint_usable = 0;
+
+static void read_boot_hint() {
+	/* on smaller chips, the address would wrap around into the payload */
+	u64 flash_size = rkspi_flash_size(regmap_spi1);
+	if (flash_size < CONFIG_BOOT_HINT_ADDR + 0x1000) {
+		info("SPI flash size 0x%"PRIx64" does not include the boot hint sector, not using it\n", flash_size);
+		boot_hint_read(0);
+		return;
+	}
+	boot_hint_usable = 1;
+	struct boot_hint_record rec;
+	_Static_assert(sizeof(rec) % 2 == 0, "SPI reads are done in halfwords");
+	rkspi_read_flash_poll(regmap_spi1, (u8 *)&rec, sizeof(rec), CONFIG_BOOT_HINT_ADDR);
+	if (rec.magic != boot_hint_magic || rec.crc != boot_hint_crc(&rec.hint)) {
+		info("no valid boot hint in SPI flash\n");
+		boot_hint_read(0);
+		return;
+	}
+	boot_hint_read(&rec.hint);
+}
+
+_Bool spi_write_boot_hint(const struct boot_hint *hint) {
+	if (!boot_hint_usable) {return 0;}
+	volatile struct rkspi_regs *spi = regmap_spi1;
+	struct boot_hint_record rec = {.magic = boot_hint_magic, .crc = boot_hint_crc(hint), .hint = *hint};
+	spi1_clock_enable();
+	u8 wren = 6;
+	/* 4 KiB sector erase */
+	u8 erase[4] = {0x20, CONFIG_BOOT_HINT_ADDR >> 16 & 0xff, CONFIG_BOOT_HINT_ADDR >> 8 & 0xff, CONFIG_BOOT_HINT_ADDR & 0xff};
+	rkspi_tx_cmd(spi, &wren, &wren + 1);
+	rkspi_tx_cmd(spi, erase, erase + 4);
+	_Bool ok = rkspi_flash_wait_ready(spi, MSECS(1000));
+	if (ok) {
+		/* page program */
+		u8 program[4 + sizeof(rec)] = {0x02, CONFIG_BOOT_HINT_ADDR >> 16 & 0xff, CONFIG_BOOT_HINT_ADDR >> 8 & 0xff, CONFIG_BOOT_HINT_ADDR & 0xff};
+		memcpy(program + 4, &rec, sizeof(rec));
+		rkspi_tx_cmd(spi, &wren, &wren + 1);
+		rkspi_tx_cmd(spi, program, program + sizeof(program));
+		ok = rkspi_flash_wait_ready(spi, MSECS(20));
+	}
+	spi1_clock_disable();
+	return ok;
+}
+#endif
+
 void boot_spi() {
 	u32 spi_load_addr = 256 << 10;
 
 	printf("trying SPI\n");
+#if CONFIG_BOOT_HINT
+	spi1_clock_enable();
+	read_boot_hint();
+	spi1_clock_disable();
+#endif
+#if !CONFIG_BOOT_ARBITRATION
 	if (!wait_for_boot_cue(BOOT_MEDIUM_SPI)) {
 		boot_medium_exit(BOOT_MEDIUM_SPI);
 		return;
 	}
 	printf("SPI cued\n");
+#endif
 	u8 *start = blob_buffer.start, *end = blob_buffer.end;
 	if ((size_t)(end - start)  > (16 << 20)) {
 		end = start +(16 << 20);
 	}
+#if CONFIG_BOOT_HINT
+	_Static_assert(CONFIG_BOOT_HINT_ADDR > 256 << 10, "boot hint sector must be after the payload start");
+	/* the hint sector gets rewritten, so it can't be part of the payload */
+	if ((size_t)(end - start) > CONFIG_BOOT_HINT_ADDR - spi_load_addr) {
+		end = start + (CONFIG_BOOT_HINT_ADDR - spi_load_addr);
+	}
+#endif
 
-	static volatile u32 *const cru = regmap_cru;
-	cru[CRU_CLKGATE_CON+23] = SET_BITS16(1, 0) << 11;
-	/* clk_spi1 = CPLL/8 = 100 MHz */
-	cru[CRU_CLKSEL_CON+59] = SET_BITS16(1, 0) << 15 | SET_BITS16(7, 7) << 8;
-	dsb_st();
-	cru[CRU_CLKGATE_CON+9] = SET_BITS16(1, 0) << 13;
-	regmap_spi1->baud = 2;
+	spi1_clock_enable();
+	/* aclk_dmac1_perilp */
+	cru[CRU_CLKGATE_CON+25] = SET_BITS16(1, 0) << 6;
 	printf("setup\n");
 
 	struct async_dummy async = {
-		.async = {pump},
+		.async = {.pump = pump, .stats = get_io_stats(BOOT_MEDIUM_SPI)},
 		.buf = {start, start}
 	};
-	start_irq_flash_read(spi_load_addr, start, end);
+	async.async.stats->requests += 1;
+	spi1_state.interrupts = 0;
+	spi1_state.handler_ticks = 0;
+	timestamp_t start_ts = get_timestamp();
+	_Bool dma = CONFIG_SPI_DMA && start_dma_flash_read(spi_load_addr, start, end);
+	if (!dma) {start_irq_flash_read(spi_load_addr, start, end);}
 	printf("start\n");
 
-	if (IOST_OK == decompress_payload(&async.async)) {
+	/* in arbitration mode, the block devices don't use blob_buffer, so the read can start before the cue */
+	_Bool cued = !CONFIG_BOOT_ARBITRATION || wait_for_boot_cue(BOOT_MEDIUM_SPI);
+	if (cued && IOST_OK == decompress_payload(&async.async)) {
+		boot_medium_payload_location(BOOT_MEDIUM_SPI, 0, 0, 0);
 		boot_medium_loaded(BOOT_MEDIUM_SPI);
 	}
 
-	rkspi_end_irq_flash_read();
-	cru[CRU_CLKGATE_CON+9] = SET_BITS16(1, 1) << 13;
+	if (dma) {
+		end_dma_flash_read();
+	} else {
+		rkspi_end_irq_flash_read();
+	}
+	spi1_clock_disable();
 
+	timestamp_t elapsed = get_timestamp() - start_ts;
 	printf("had read %zu bytes\n", async.buf.end - start);
+	printf("SPI %s: %"PRIu32" interrupts, %"PRIu64" of %"PRIu64" μs in the handler\n", dma ? "DMA" : "IRQ", spi1_state.interrupts, spi1_state.handler_ticks / TICKS_PER_MICROSECOND, elapsed / TICKS_PER_MICROSECOND);
 	boot_medium_exit(BOOT_MEDIUM_SPI);
 }
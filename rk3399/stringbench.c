@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <die.h>
+#include <timer.h>
+
+#include <arch/context.h>
+#include <aarch64.h>
+#include <mmu.h>
+#include <plat/sched.h>
+#include <rktimer_regs.h>
+
+#include <stage.h>
+
+/* an EL2 payload like teststage.bin that measures the string functions from aarch64/string.S at sizes from L1-resident to DRAM-bound */
+
+#define DEFINE_VSTACK(X) X(CPU0)
+#define VSTACK_DEPTH 0x1000
+
+#define DEFINE_REGMAP(MMIO)\
+	MMIO(GIC500D, gic500d, 0xfee00000, struct gic_distributor)\
+	MMIO(GIC500R, gic500r, 0xfef00000, struct gic_redistributor)\
+	MMIO(STIMER0, stimer0, 0xff860000, struct rktimer_regs)\
+	MMIO(UART, uart, 0xff1a0000, struct uart)\
+	/* the generic SoC registers are last, because they are referenced often, meaning they get addresses 0xffffxxxx, which can be generated in a single MOVN instruction */
+#define DEFINE_REGMAP64K(X)\
+	X(GRF, grf, 0xff770000, u32)\
+
+#include <rk3399/vmmap.h>
+
+static UNINITIALIZED _Alignas(4096) u8 vstack_frames[NUM_VSTACK][VSTACK_DEPTH];
+void *const boot_stack_end = (void*)VSTACK_BASE(VSTACK_CPU0);
+
+static u64 _Alignas(4096) UNINITIALIZED pagetable_frames[11][512];
+u64 (*const pagetables)[512] = pagetable_frames;
+const size_t num_pagetables = ARRAY_SIZE(pagetable_frames);
+
+volatile struct uart *const console_uart = regmap_uart;
+
+const struct mmu_multimap initial_mappings[] = {
+	{.addr = 0x100000, .desc = MMU_MAPPING(UNCACHED, 0x100000)},
+	/* continue to start of binary mapping */
+#include <rk3399/base_mappings.inc.c>
+	{.addr = (u64)&__end__, .desc = MMU_MAPPING(UNCACHED, (u64)&__end__)},
+	{.addr = 0xf8000000, .desc = 0},
+	VSTACK_MULTIMAP(CPU0),
+	{}
+};
+
+void plat_handler_fiq() {
+	die("unexpected FIQ");
+}
+void plat_handler_irq() {
+	die("unexpected IRQ");
+}
+
+static struct sched_runqueue runqueue = {};
+struct sched_runqueue *get_runqueue() {return &runqueue;}
+void plat_timer_set_deadline(timestamp_t deadline) {rktimer_set_deadline(regmap_stimer0, deadline);}
+
+enum {MAX_SIZE = 4 << 20, BYTES_PER_RUN = 16 << 20};
+/* in the cached part of the binary mapping */
+static UNINITIALIZED _Alignas(4096) u8 buf_src[MAX_SIZE + 4096], buf_dest[MAX_SIZE + 4096];
+
+/* called through volatile pointers, so the compiler can neither inline nor elide the calls */
+static void *(*volatile const copy)(void *restrict, const void *restrict, size_t) = memcpy;
+static void *(*volatile const move)(void *, const void *, size_t) = memmove;
+static void *(*volatile const fill)(void *, int, size_t) = memset;
+
+static void run_memcpy(size_t size) {copy(buf_dest, buf_src, size);}
+static void run_memcpy_unaligned(size_t size) {copy(buf_dest + 5, buf_src + 3, size);}
+/* overlapping, so memmove has to copy backwards */
+static void run_memmove(size_t size) {move(buf_src + 8, buf_src, size);}
+static void run_memset(size_t size) {fill(buf_dest, 0x55, size);}
+/* uses DC ZVA from 256 bytes up */
+static void run_memset_zero(size_t size) {fill(buf_dest, 0, size);}
+
+static const struct primitive {
+	const char *name;
+	void (*run)(size_t size);
+} primitives[] = {
+	{"memcpy", run_memcpy},
+	{"memcpy+3/5", run_memcpy_unaligned},
+	{"memmove", run_memmove},
+	{"memset", run_memset},
+	{"memset 0", run_memset_zero},
+};
+static const size_t sizes[] = {64, 256, 4096, 32 << 10, 512 << 10, MAX_SIZE};
+
+HEADER_FUNC u64 read_cycles() {
+	u64 res;
+	__asm__ volatile("isb; mrs %0, PMCCNTR_EL0" : "=r"(res));
+	return res;
+}
+
+/* prints a ratio with two decimals */
+static void print_ratio(u64 num, u64 denom) {
+	u64 hundredths = denom ? num * 100 / denom : 0;
+	printf("%4"PRIu64".%02"PRIu64, hundredths / 100, hundredths % 100);
+}
+
+_Noreturn void main() {
+	/* the cycle counter must count at EL2 (NSH) and run as a 64-bit counter */
+	__asm__ volatile("msr PMCCFILTR_EL0, %0" : : "r"((u64)1 << 27));
+	__asm__ volatile("msr PMCR_EL0, %0" : : "r"((u64)(PMCR_E | PMCR_C | PMCR_LC)));
+	__asm__ volatile("msr PMCNTENSET_EL0, %0" : : "r"((u64)1 << 31));
+	u64 dczid;
+	__asm__("mrs %0, DCZID_EL0" : "=r"(dczid));
+	timestamp_t start = get_timestamp();
+	u64 cycles = read_cycles();
+	udelay(10000);
+	cycles = read_cycles() - cycles;
+	printf("CPU clock: %"PRIu64" MHz, DC ZVA block: %u bytes%s\n", cycles * TICKS_PER_MICROSECOND / (get_timestamp() - start), 4u << (dczid & 15), dczid & 16 ? " (prohibited)" : "");
+
+	fill(buf_src, 0xa5, sizeof(buf_src));
+	fill(buf_dest, 0x5a, sizeof(buf_dest));
+	printf("bytes/cycle ");
+	for_array(i, sizes) {printf("%7zu", sizes[i]);}
+	puts("");
+	for_array(i, primitives) {
+		const struct primitive *prim = primitives + i;
+		printf("%s", prim->name);
+		for (size_t len = strnlen(prim->name, 12); len < 12; ++len) {printf(" ");}
+		u64 dram_ticks = 0;
+		for_array(j, sizes) {
+			size_t size = sizes[j];
+			u32 runs = BYTES_PER_RUN / size;
+			/* warm up the caches and TLBs */
+			prim->run(size);
+			timestamp_t ticks = get_timestamp();
+			u64 elapsed = read_cycles();
+			for_range(run, 0, runs) {prim->run(size);}
+			elapsed = read_cycles() - elapsed;
+			dram_ticks = get_timestamp() - ticks;
+			print_ratio((u64)size * runs, elapsed);
+		}
+		/* the last size doesn't fit into the caches */
+		printf("  %"PRIu64" MB/s\n", (u64)BYTES_PER_RUN * TICKS_PER_MICROSECOND / dram_ticks);
+	}
+	halt_and_catch_fire();
+}
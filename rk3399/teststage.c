@@ -7,6 +7,8 @@
 
 #include <arch/context.h>
 #include <mmu.h>
+#include <plat/sched.h>
+#include <rktimer_regs.h>
 
 #include <stage.h>
 
@@ -56,6 +58,7 @@ void plat_handler_irq() {
 
 static struct sched_runqueue runqueue = {};
 struct sched_runqueue *get_runqueue() {return &runqueue;}
+void plat_timer_set_deadline(timestamp_t deadline) {rktimer_set_deadline(regmap_stimer0, deadline);}
 
 _Noreturn void main(u64 x0) {
 	printf("FDT pointer: %"PRIx64"\n", x0);
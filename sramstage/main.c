@@ -3,11 +3,14 @@
 #include <stdbool.h>
 #include <inttypes.h>
 
+#include <boot_timeline.h>
+#include <cache.h>
 #include <compression.h>
 
 #include <arch/context.h>
 #include <irq.h>
 #include <mmu.h>
+#include <plat/sched.h>
 
 #include <sdhci.h>
 #include <dwmmc.h>
@@ -34,6 +37,8 @@ volatile struct uart *const console_uart = regmap_uart;
 
 const struct mmu_multimap initial_mappings[] = {
 #include <rk3399/base_mappings.inc.c>
+	{.addr = BOOT_TIMELINE_SRAM_ADDR, .desc = MMU_MAPPING(NORMAL, BOOT_TIMELINE_SRAM_ADDR)},
+	{.addr = BOOT_TIMELINE_SRAM_ADDR + BOOT_TIMELINE_SRAM_SIZE, .desc = 0},
 	VSTACK_MULTIMAP(CPU0),
 	{}
 };
@@ -71,6 +76,7 @@ void plat_handler_fiq() {
 #else
 		dsb_st();	/* apparently the interrupt clear isn't fast enough, wait for completion */
 #endif
+		sched_expire_timers(get_timestamp());
 #if CONFIG_SD
 		dwmmc_wake_waiters(&sdmmc_state);
 #endif
@@ -115,6 +121,7 @@ const size_t num_pagetables = ARRAY_SIZE(pagetable_frames);
 static struct sched_runqueue runqueue = {};
 
 struct sched_runqueue *get_runqueue() {return &runqueue;}
+void plat_timer_set_deadline(timestamp_t deadline) {rktimer_set_deadline(regmap_stimer0, deadline);}
 
 struct thread threads[] = {
 	THREAD_START_STATE(VSTACK_BASE(VSTACK_DDRC0), ddrinit_primary, (u64)&ddrinit_st),
@@ -135,6 +142,9 @@ void rk3399_set_init_flags(size_t flags) {
 }
 
 _Noreturn void main() {
+	boot_timeline_init((void *)BOOT_TIMELINE_SRAM_ADDR, BOOT_TIMELINE_SRAM_SIZE, 0);
+	boot_timeline_add(BOOT_EVENT_SRAMSTAGE_START, 0);
+
 	/* GPIO0A2: red LED on RockPro64 and Pinebook Pro, not connected on Rock Pi 4 */
 	regmap_gpio0->port |= 1 << 2;
 	regmap_gpio0->direction |= 1 << 2;
@@ -205,7 +215,7 @@ _Noreturn void main() {
 		struct sched_runnable *r = sched_unqueue(get_runqueue());
 		if (r) {
 			irq_unmask();
-			arch_sched_run(r);
+			sched_run(r);
 		} else {
 			bool quit = true;
 			for_array(i, threads) {
@@ -226,5 +236,8 @@ _Noreturn void main() {
 	for_array(i, intids) {gicv2_disable_spi(gic500d, intids[i].intid);}
 	gicv2_wait_disabled(gic500d);
 	info("[%"PRIuTS"] sramstage finish\n", get_timestamp());
+	boot_timeline_add(BOOT_EVENT_SRAMSTAGE_END, 0);
+	/* the next stage may start with the caches off */
+	flush_range((void *)BOOT_TIMELINE_SRAM_ADDR, BOOT_TIMELINE_SRAM_SIZE);
 	sramstage_late();
 }
@@ -13,7 +13,7 @@ void misc_init() {
 	volatile struct rktimer_regs *timer = regmap_stimer0 + 0;
 	timer->control = 0;
 	timer->load_count2 = timer->load_count3 = timer->load_count0 = 0;
-	timer->load_count0 = 240000;
+	timer->load_count0 = RKTIMER_TICK;
 	timer->interrupt_status = 1;
 	timer->control = RKTIMER_ENABLE | RKTIMER_INT_EN;
 
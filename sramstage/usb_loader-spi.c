@@ -12,48 +12,6 @@
 
 static volatile struct rkspi_regs *const spi1 = regmap_spi1;
 
-static void read_sfdp(u32 addr, u8 *buf, size_t size) {
-	assert(!(addr >> 24));
-	spi1->slave_enable = 1;
-	rkspi_tx_cmd4_dummy1(spi1, 0x5a << 24 | addr);
-	rkspi_recv_fast(spi1, buf, size);
-	spi1->slave_enable = 0;
-}
-
-static void tx_cmd(const u8 *buf, const u8 *end) {
-	spi1->slave_enable = 1;
-	spi1->ctrl0 = rkspi_mode_base | RKSPI_XFM_TX | RKSPI_BHT_APB_8BIT;
-	spi1->enable = 1;
-	u32 fifo_left = 32;
-	while (buf < end) {
-		if (!fifo_left) {
-			fifo_left = 32 - spi1->tx_fifo_level;
-		}
-		spi1->tx = *buf++;
-		fifo_left -= 1;
-	}
-	while (spi1->status & 1) {__asm__ volatile("yield");}
-	spi1->enable = 0;
-	spi1->slave_enable = 0;
-}
-
-static void wait_until_ready() {
-	spi1->slave_enable = 1;
-	spi1->ctrl0 = rkspi_mode_base | RKSPI_XFM_TR | RKSPI_BHT_APB_8BIT;
-	spi1->enable = 1;
-	spi1->tx = 5;
-	spi1->tx = 0xff;
-	while (spi1->rx_fifo_level < 2) {__asm__("yield");}
-	spi1->rx;
-	while (spi1->rx & 1) {
-		spi1->tx = 0xff;
-		while (!spi1->rx_fifo_level) {__asm__("yield");}
-		putchar('.');
-	}
-	spi1->enable = 0;
-	spi1->slave_enable = 0;
-}
-
 void sramstage_usb_flash_spi(const u8 *buf, u64 start, u64 length) {
 	static volatile u32 *const cru = regmap_cru;
 	cru[CRU_CLKGATE_CON+23] = SET_BITS16(1, 0) << 11;
@@ -63,7 +21,7 @@ void sramstage_usb_flash_spi(const u8 *buf, u64 start, u64 length) {
 	cru[CRU_CLKGATE_CON+9] = SET_BITS16(1, 0) << 13;
 	spi1->baud = 2;
 	u8 sfdp[1024];
-	read_sfdp(0, sfdp, 8);
+	rkspi_read_sfdp(spi1, 0, sfdp, 8);
 	assert_msg(sfdp[0] == 'S' && sfdp[1] == 'F' && sfdp[2] == 'D' && sfdp[3] == 'P', "SPI flash not present or not SFDP-compatible\n");
 	assert_msg(sfdp[4] == 0 && sfdp[5] != 0, "SFDP version not compatible\n");
 	u32 num_headers = (u32)sfdp[6] + 1;
@@ -72,10 +30,10 @@ void sramstage_usb_flash_spi(const u8 *buf, u64 start, u64 length) {
 	struct erase_op {u8 shift, opcode;} erase_ops[16] = {};
 	u8 num_erase_ops = 0;
 	for_range(i, 0, num_headers) {
-		read_sfdp(8 + i * 8, sfdp, 8);
+		rkspi_read_sfdp(spi1, 8 + i * 8, sfdp, 8);
 		u8 id = sfdp[0], rev_major = sfdp[1], rev_minor = sfdp[2], length = sfdp[3];
 		u32 ptp = sfdp[4] | (u32)sfdp[5] << 8 | (u32)sfdp[6] << 16;
-		read_sfdp(ptp, sfdp, length * 4);
+		rkspi_read_sfdp(spi1, ptp, sfdp, length * 4);
 		if (id == 0) {
 			printf("JEDEC parameter table %"PRIu8".%"PRIu8": address 0x%"PRIx32"–0x%"PRIx32"\n", rev_major, rev_minor, ptp, ptp + (u32)length * 4);
 			dump_mem(sfdp, length * 4);
@@ -129,10 +87,10 @@ void sramstage_usb_flash_spi(const u8 *buf, u64 start, u64 length) {
 		u32 erase_cmd = (u32)erase_ops[p].opcode << 24 | erased_until;
 		erased_until += 1 << erase_ops[p].shift;
 		printf("erase command %08"PRIx32" → %"PRIx64" ", erase_cmd, erased_until);
-		tx_cmd(&wren, &wren + 1);
+		rkspi_tx_cmd(spi1, &wren, &wren + 1);
 		u8 cmd_buf[4] = {erase_cmd >> 24, erase_cmd >> 16, erase_cmd >> 8, erase_cmd};
-		tx_cmd(cmd_buf, cmd_buf + 4);
-		wait_until_ready();
+		rkspi_tx_cmd(spi1, cmd_buf, cmd_buf + 4);
+		if (!rkspi_flash_wait_ready(spi1, MSECS(3000))) {die("SPI flash erase timed out\n");}
 		puts(" erased.");
 	}
 	const u8 *read_ptr = buf;
@@ -147,10 +105,10 @@ void sramstage_usb_flash_spi(const u8 *buf, u64 start, u64 length) {
 		do {
 			cmd_buf[len++] = *read_ptr++;
 		} while (++write_ptr & 0xff);
-		tx_cmd(&wren, &wren + 1);
+		rkspi_tx_cmd(spi1, &wren, &wren + 1);
 		printf("%"PRIu32, len);
-		tx_cmd(cmd_buf, cmd_buf + len);
-		wait_until_ready();
+		rkspi_tx_cmd(spi1, cmd_buf, cmd_buf + len);
+		if (!rkspi_flash_wait_ready(spi1, MSECS(20))) {die("SPI flash program timed out\n");}
 		putchar(' ');
 	}
 	if (write_ptr != end) {
@@ -161,10 +119,10 @@ void sramstage_usb_flash_spi(const u8 *buf, u64 start, u64 length) {
 		do {
 			cmd_buf[len++] = *read_ptr++;
 		} while (++write_ptr < end);
-		tx_cmd(&wren, &wren + 1);
+		rkspi_tx_cmd(spi1, &wren, &wren + 1);
 		printf("trailing %"PRIu32, len);
-		tx_cmd(cmd_buf, cmd_buf + len);
-		wait_until_ready();
+		rkspi_tx_cmd(spi1, cmd_buf, cmd_buf + len);
+		if (!rkspi_flash_wait_ready(spi1, MSECS(20))) {die("SPI flash program timed out\n");}
 	}
 	puts(" programmed.");
 	printf("written until %"PRIx64"\n", write_ptr);
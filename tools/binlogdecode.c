@@ -0,0 +1,294 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#define _POSIX_C_SOURCE 200809L
+#include "../include/defs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <elf.h>
+
+/* decodes the binary log written by dramstage modules configured with --binlog (see include/binlog.h).
+usage: binlogdecode <dramstage.elf> [input]
+
+the input (stdin by default) is either a console log containing the `binlog:` dump that dramstage prints before handing off to BL31, or a raw memory image containing the ring (e. g. a dump of DRAM read back over USB or by a debugger), which is searched for the ring header.
+format strings are looked up in the .binlog section of the ELF, %s arguments in its loaded sections. */
+
+/* duplicated from include/binlog.h, which needs the firmware headers */
+enum {RECORD_WORDS = 8, HEAD_ARGS = 6, CONT_ARGS = 7, MAX_ARGS = HEAD_ARGS + CONT_ARGS};
+enum {HEAD = 0xb1, CONT = 0xb2};
+static const u64 magic = UINT64_C(0x474f4c4e4942424c);
+
+struct section {u64 addr, size; const u8 *data;};
+static struct section formats, loaded[64];
+static u32 num_loaded = 0;
+
+static u8 *read_file(FILE *f, size_t *size) {
+	size_t cap = 1 << 16, len = 0;
+	u8 *buf = malloc(cap);
+	size_t res;
+	while (buf && (res = fread(buf + len, 1, cap - len, f)) > 0) {
+		len += res;
+		if (len == cap) {buf = realloc(buf, cap *= 2);}
+	}
+	if (!buf) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	*size = len;
+	return buf;
+}
+
+static const u8 *find(const u8 *buf, size_t size, const char *str) {
+	size_t len = strlen(str);
+	for (size_t i = 0; i + len <= size; ++i) {
+		if (!memcmp(buf + i, str, len)) {return buf + i;}
+	}
+	return 0;
+}
+
+static u64 read_le64(const u8 *p) {
+	u64 val = 0;
+	for_range(i, 0, 8) {val |= (u64)p[i] << (8 * i);}
+	return val;
+}
+
+static void load_elf(const char *name) {
+	FILE *f = fopen(name, "rb");
+	if (!f) {
+		perror(name);
+		exit(1);
+	}
+	size_t size;
+	u8 *elf = read_file(f, &size);
+	fclose(f);
+	const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)elf;
+	if (size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) || ehdr->e_ident[EI_CLASS] != ELFCLASS64
+		|| ehdr->e_shoff > size || ehdr->e_shnum > (size - ehdr->e_shoff) / sizeof(Elf64_Shdr) || ehdr->e_shstrndx >= ehdr->e_shnum
+	) {
+		fprintf(stderr, "%s: not a 64-bit ELF file with section headers\n", name);
+		exit(1);
+	}
+	const Elf64_Shdr *shdr = (const Elf64_Shdr *)(elf + ehdr->e_shoff);
+	const Elf64_Shdr *strtab = shdr + ehdr->e_shstrndx;
+	for_range(i, 0, ehdr->e_shnum) {
+		const Elf64_Shdr *sh = shdr + i;
+		if (sh->sh_type != SHT_PROGBITS || sh->sh_offset > size || sh->sh_size > size - sh->sh_offset || sh->sh_name >= strtab->sh_size) {continue;}
+		struct section sec = {sh->sh_addr, sh->sh_size, elf + sh->sh_offset};
+		if (!strcmp((const char *)elf + strtab->sh_offset + sh->sh_name, ".binlog")) {
+			formats = sec;
+		} else if (sh->sh_flags & SHF_ALLOC && num_loaded < ARRAY_SIZE(loaded)) {
+			loaded[num_loaded++] = sec;
+		}
+	}
+	if (!formats.data) {
+		fprintf(stderr, "%s has no .binlog section\n", name);
+		exit(1);
+	}
+}
+
+/* returns the NUL-terminated string at `addr` if it is within a section */
+static const char *lookup(const struct section *sec, u32 count, u64 addr) {
+	for_range(i, 0, count) {
+		if (addr < sec[i].addr || addr - sec[i].addr >= sec[i].size) {continue;}
+		const char *str = (const char *)sec[i].data + (addr - sec[i].addr);
+		if (memchr(str, 0, sec[i].size - (addr - sec[i].addr))) {return str;}
+	}
+	return 0;
+}
+
+static u32 timer_hz = 24000000;
+static _Bool line_start = 1;
+
+/* prints one message, interpreting the format string like the firmware's printf would have */
+static void print_message(u32 cpu, u64 timestamp, const char *fmt, const u64 *args, u32 num_args) {
+	u32 arg = 0;
+#define NEXT_ARG (arg < num_args ? args[arg++] : 0)
+	for (const char *p = fmt; *p; ++p) {
+		if (line_start) {
+			printf("[%11.6f] cpu%"PRIu32": ", (double)timestamp / timer_hz, cpu);
+			line_start = 0;
+		}
+		if (*p != '%') {
+			putchar(*p);
+			if (*p == '\n') {line_start = 1;}
+			continue;
+		}
+		char spec[32] = "%";
+		size_t len = 1;
+		int precision = -1;
+		++p;
+		while (*p && strchr("-+ #0", *p) && len < 8) {spec[len++] = *p++;}
+		if (*p == '*') {
+			len += snprintf(spec + len, sizeof(spec) - len, "%d", (int)NEXT_ARG);
+			++p;
+		} else {
+			while (*p >= '0' && *p <= '9' && len < 16) {spec[len++] = *p++;}
+		}
+		if (*p == '.') {
+			++p;
+			if (*p == '*') {
+				precision = (int)NEXT_ARG;
+				len += snprintf(spec + len, sizeof(spec) - len, ".%d", precision);
+				++p;
+			} else {
+				spec[len++] = '.';
+				while (*p >= '0' && *p <= '9' && len < 24) {spec[len++] = *p++;}
+			}
+		}
+		/* argument size in bytes, 0 for int */
+		u32 size = 0;
+		while (*p && strchr("hlzjt", *p)) {
+			size = *p == 'h' ? (size ? 1 : 2) : 8;
+			++p;
+		}
+		if (!*p) {break;}
+		char conv = *p;
+		u64 val = conv == '%' ? 0 : NEXT_ARG;
+		switch (conv) {
+		case '%':
+			putchar('%');
+			break;
+		case 'd': case 'i':
+			spec[len++] = 'l';
+			spec[len++] = 'l';
+			spec[len++] = conv;
+			spec[len] = 0;
+			printf(spec, size == 8 ? (long long)(int64_t)val : size == 2 ? (long long)(int16_t)val : size == 1 ? (long long)(int8_t)val : (long long)(int32_t)val);
+			break;
+		case 'u': case 'x': case 'X': case 'o':
+			spec[len++] = 'l';
+			spec[len++] = 'l';
+			spec[len++] = conv;
+			spec[len] = 0;
+			printf(spec, (unsigned long long)(size == 8 ? val : size == 2 ? (u16)val : size == 1 ? (u8)val : (u32)val));
+			break;
+		case 'c':
+			putchar((char)val);
+			if ((char)val == '\n') {line_start = 1;}
+			break;
+		case 's': {
+			const char *str = lookup(loaded, num_loaded, val);
+			if (!str) {
+				printf("<string at 0x%"PRIx64">", val);
+				break;
+			}
+			spec[len++] = 's';
+			spec[len] = 0;
+			printf(spec, str);
+			size_t n = strlen(str);
+			if (n && str[n - 1] == '\n' && precision < 0) {line_start = 1;}
+			break;
+		}
+		case 'p':
+			printf("0x%"PRIx64, val);
+			break;
+		default:
+			printf("<bad conversion '%c'>", conv);
+		}
+	}
+#undef NEXT_ARG
+}
+
+static void decode(const u64 *records, u64 count) {
+	u64 i = 0;
+	/* the oldest records may be the continuations of an overwritten head record */
+	while (i < count && records[i * RECORD_WORDS] >> 56 == CONT) {++i;}
+	for (; i < count; ++i) {
+		const u64 *rec = records + i * RECORD_WORDS;
+		if (rec[0] >> 56 != HEAD) {
+			fprintf(stderr, "record %"PRIu64" is not a head record: 0x%016"PRIx64"\n", i, rec[0]);
+			continue;
+		}
+		u32 id = (u32)rec[0], num_args = rec[0] >> 32 & 0xff, cpu = rec[0] >> 40 & 0xff;
+		u64 args[MAX_ARGS] = {0};
+		if (num_args > MAX_ARGS) {
+			fprintf(stderr, "record %"PRIu64" has %"PRIu32" arguments\n", i, num_args);
+			continue;
+		}
+		u32 head_args = num_args < HEAD_ARGS ? num_args : HEAD_ARGS;
+		for_range(a, 0, head_args) {args[a] = rec[2 + a];}
+		if (num_args > HEAD_ARGS) {
+			if (i + 1 == count) {
+				fprintf(stderr, "continuation of the last record is missing\n");
+				break;
+			}
+			const u64 *cont = records + ++i * RECORD_WORDS;
+			for_range(a, HEAD_ARGS, num_args) {args[a] = cont[1 + a - HEAD_ARGS];}
+		}
+		const char *fmt = lookup(&formats, 1, id);
+		if (!fmt) {
+			fprintf(stderr, "unknown format ID 0x%"PRIx32" (wrong ELF file?)\n", id);
+			continue;
+		}
+		print_message(cpu, rec[1], fmt, args, num_args);
+	}
+	if (!line_start) {putchar('\n');}
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s <dramstage.elf> [log or memory image]\n", argv[0]);
+		return 1;
+	}
+	load_elf(argv[1]);
+	FILE *in = stdin;
+	if (argc == 3 && !(in = fopen(argv[2], "rb"))) {
+		perror(argv[2]);
+		return 1;
+	}
+	size_t size;
+	u8 *input = read_file(in, &size);
+	if (in != stdin) {fclose(in);}
+
+	u64 *records = 0, count = 0, first = 0, pos = 0;
+	/* console log: the text dump has the records oldest first */
+	const u8 *begin = find(input, size, "binlog: begin ");
+	if (begin) {
+		size_t offset = begin - input;
+		input = realloc(input, size + 1);
+		input[size] = 0;
+		const char *text = (const char *)input + offset;
+		if (sscanf(text, "binlog: begin %"SCNu64" %"SCNu64" %"SCNu32, &first, &pos, &timer_hz) != 3 || pos < first) {
+			fprintf(stderr, "malformed binlog dump header\n");
+			return 1;
+		}
+		records = calloc((pos - first) * RECORD_WORDS, sizeof(u64));
+		u64 words = 0;
+		for (const char *line = strchr(text, '\n'); line && words < (pos - first) * RECORD_WORDS; line = strchr(line + 1, '\n')) {
+			const char *p = strstr(line, "binlog: ");
+			const char *next = strchr(line + 1, '\n');
+			if (!p || (next && p > next)) {continue;}
+			u64 w[4];
+			if (sscanf(p, "binlog: %"SCNx64" %"SCNx64" %"SCNx64" %"SCNx64, w, w + 1, w + 2, w + 3) != 4) {continue;}
+			memcpy(records + words, w, sizeof(w));
+			words += 4;
+		}
+		count = words / RECORD_WORDS;
+		if (count < pos - first) {fprintf(stderr, "the dump is truncated, decoding %"PRIu64" of %"PRIu64" records\n", count, pos - first);}
+	} else {
+		/* memory image: find the ring header */
+		for (size_t off = 0; off + RECORD_WORDS * 8 <= size; off += 8) {
+			if (read_le64(input + off) != magic) {continue;}
+			u64 num_records = read_le64(input + off + 8) & 0xffffffff;
+			if (!num_records || num_records > (size - off) / (RECORD_WORDS * 8) - 1) {continue;}
+			timer_hz = read_le64(input + off + 8) >> 32;
+			pos = read_le64(input + off + 16);
+			first = pos > num_records ? pos - num_records : 0;
+			count = pos - first;
+			records = calloc(count * RECORD_WORDS, sizeof(u64));
+			const u8 *ring = input + off + RECORD_WORDS * 8;
+			for (u64 i = 0; i < count; ++i) {
+				for_range(w, 0, RECORD_WORDS) {records[i * RECORD_WORDS + w] = read_le64(ring + ((first + i) % num_records * RECORD_WORDS + w) * 8);}
+			}
+			break;
+		}
+		if (!records) {
+			fprintf(stderr, "no binlog dump or ring found in the input\n");
+			return 1;
+		}
+	}
+	if (!timer_hz) {timer_hz = 24000000;}
+	if (first) {fprintf(stderr, "the ring overflowed, the first %"PRIu64" records are missing\n", first);}
+	decode(records, count);
+	return 0;
+}
@@ -0,0 +1,9 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#pragma once
+/* stand-in for include/cache.h when building driver code into host tools: host memory is coherent with the mocked devices */
+#include <defs.h>
+
+enum {MIN_CACHELINE_SIZE = 32, MAX_CACHELINE_SIZE = 128};
+
+HEADER_FUNC void flush_range(void UNUSED *ptr, size_t UNUSED size) {}
+HEADER_FUNC void invalidate_range(void UNUSED *ptr, size_t UNUSED size) {}
@@ -0,0 +1,11 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#pragma once
+/* stand-in for include/mmu.h when building driver code into host tools: the tool implements the mapping functions on top of its own address space */
+#include <defs.h>
+
+enum {MEM_TYPE_NORMAL = 4};
+
+void mmu_unmap_range(u64 first, u64 last);
+void mmu_map_range(u64 first, u64 last, u64 paddr, u64 flags);
+
+HEADER_FUNC void mmu_flush() {}
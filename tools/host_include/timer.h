@@ -0,0 +1,8 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#pragma once
+/* stand-in for include/timer.h when building driver code into host tools: the tool provides a (possibly simulated) clock */
+#include <defs.h>
+#include <plat.h>
+
+timestamp_t get_timestamp();
+void udelay(u32 usec);
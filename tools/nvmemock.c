@@ -0,0 +1,460 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+/* host-side NVMe controller model for the NVMe request primitives in lib/nvme_xfer.c, driven by the readahead core in lib/readahead.c.
+ * Commands are executed against a simulated clock: each read spends a fixed latency in the
+ * controller and then takes its turn on the (shared) link, the consumer eats data at a fixed
+ * rate. The data is checked against the disk pattern, so this doubles as a correctness check
+ * for PRP list construction and in-order retirement. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include <nvme.h>
+#include <nvme_regs.h>
+#include <iost.h>
+#include <byteorder.h>
+#include <timer.h>
+#include <runqueue.h>
+#include <log.h>
+
+enum {MAX_DEPTH = 16, PAGE_SIZE = 1 << PLAT_PAGE_SHIFT};
+
+static struct {
+	u32 latency_us, link_mbps, consume_mbps;
+	u32 size, chunk;
+	u32 max_depth, window;
+	/* stream range to redirect to a separate destination buffer, see async_transfer::redirect */
+	u32 redirect_start, redirect_size;
+	/* ring buffer size (0 for a linear buffer), and how far behind the consumer to hold the stream, see async_readahead_start_ring */
+	u32 ring, hold;
+	u8 xfer_shift, lba_shift;
+} cfg = {
+	.latency_us = 80,
+	.link_mbps = 800,
+	.consume_mbps = 400,
+	.size = 32 << 20,
+	.chunk = 64 << 10,
+	.max_depth = 4,
+	.window = 4 << 20,
+	.xfer_shift = 17,
+	.lba_shift = 9,
+};
+
+static timestamp_t now;
+
+static void controller_poll();
+
+timestamp_t get_timestamp() {return now;}
+void usleep(u32 usecs) {
+	/* doorbell writes can't be trapped, so pick up new commands at the time they were submitted */
+	controller_poll();
+	now += USECS(usecs);
+	controller_poll();
+}
+void udelay(u32 usec) {usleep(usec);}
+
+static struct nvme_regs regs;
+static _Atomic u32 sq_doorbell, cq_doorbell;
+static _Atomic(struct nvme_req *) io_cmd[MAX_DEPTH];
+static struct nvme_cq cqs[2];
+static struct nvme_sq sqs[2];
+static struct nvme_state st = {
+	.regs = &regs,
+	.cq = cqs,
+	.sq = sqs,
+};
+static struct nvme_xfer xfers[MAX_DEPTH];
+static struct async_stats stats;
+static struct nvme_blockdev dev = {
+	.ra = {
+		.blk = {
+			.async = {async_readahead_pump, async_readahead_redirect, async_readahead_hold, &stats},
+			.start = async_readahead_start,
+			.start_ring = async_readahead_start_ring,
+		},
+		.start_request = nvme_blk_start_request,
+		.wait_request = nvme_blk_wait_request,
+		.request_done = nvme_blk_request_done,
+	},
+	.st = &st,
+	.xfer = xfers,
+	.nsid = 1,
+};
+
+static u8 *arena, *data_buf, *dest_buf, *stream_base;
+static int arena_fd;
+
+/* the "physical" memory is the arena, which is backed by a memfd so it can be mapped a second time at the stream addresses.
+ * unmapped stream addresses stay reserved, but fault on access */
+void mmu_map_range(u64 first, u64 last, u64 paddr, u64 UNUSED flags) {
+	void *res = mmap((void *)(uintptr_t)first, last - first + 1, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, arena_fd, paddr - (uintptr_t)arena);
+	assert(res != MAP_FAILED);
+}
+
+void mmu_unmap_range(u64 first, u64 last) {
+	void *res = mmap((void *)(uintptr_t)first, last - first + 1, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+	assert(res != MAP_FAILED);
+}
+static u8 (*pages)[PAGE_SIZE];
+enum {PAGE_SQ, PAGE_ACQ, PAGE_IOCQ, PAGE_PRP, NUM_PAGES = PAGE_PRP + MAX_DEPTH};
+
+struct mock_cmd {
+	u16 cid;
+	u64 slba;
+	u32 nlb;
+	u64 prp1, prp2;
+	timestamp_t done;
+};
+
+static struct {
+	u16 sq_head, cq_tail;
+	_Bool phase, failed;
+	u32 num_pending, max_pending;
+	struct mock_cmd pending[MAX_DEPTH + 1];
+	timestamp_t link_free;
+	u64 commands;
+} ctrl;
+
+static u8 pattern(u64 offset) {
+	return (u8)((offset * 0x9e3779b97f4a7c15) >> 56) ^ (u8)(offset >> 12);
+}
+
+static _Bool in_buf(u64 addr, u32 len, const u8 *buf) {
+	return addr >= (u64)(uintptr_t)buf && addr + len <= (u64)(uintptr_t)buf + cfg.size;
+}
+
+static _Bool dma_page(u64 addr, u32 len, u64 disk_offset) {
+	if (!in_buf(addr, len, data_buf) && !in_buf(addr, len, dest_buf)) {
+		fprintf(stderr, "DMA to 0x%"PRIx64"+0x%"PRIx32" outside the data buffer\n", addr, len);
+		return 0;
+	}
+	u8 *ptr = (u8 *)(uintptr_t)addr;
+	for_range(i, 0, len) {ptr[i] = pattern(disk_offset + i);}
+	return 1;
+}
+
+/* walks the PRPs like a controller would, see NVMe base spec 4.3 */
+static _Bool execute_read(const struct mock_cmd *cmd) {
+	u64 bytes = (u64)cmd->nlb << cfg.lba_shift, offset = cmd->slba << cfg.lba_shift;
+	if (cmd->prp1 & 3) {
+		fprintf(stderr, "misaligned PRP1 0x%"PRIx64"\n", cmd->prp1);
+		return 0;
+	}
+	u32 len = PAGE_SIZE - (cmd->prp1 & (PAGE_SIZE - 1));
+	if (len > bytes) {len = bytes;}
+	if (!dma_page(cmd->prp1, len, offset)) {return 0;}
+	bytes -= len;
+	offset += len;
+	if (!bytes) {return 1;}
+	if (bytes <= PAGE_SIZE) {
+		if (cmd->prp2 & (PAGE_SIZE - 1)) {
+			fprintf(stderr, "misaligned PRP2 0x%"PRIx64"\n", cmd->prp2);
+			return 0;
+		}
+		return dma_page(cmd->prp2, bytes, offset);
+	}
+	if (cmd->prp2 & 7) {
+		fprintf(stderr, "misaligned PRP list 0x%"PRIx64"\n", cmd->prp2);
+		return 0;
+	}
+	const u64 *list = (const u64 *)(uintptr_t)cmd->prp2;
+	while (bytes) {
+		u64 entry = from_le64(*list);
+		if (plat_is_page_aligned((void *)(list + 1)) && bytes > PAGE_SIZE) {
+			list = (const u64 *)(uintptr_t)entry;
+			continue;
+		}
+		if (entry & (PAGE_SIZE - 1)) {
+			fprintf(stderr, "misaligned PRP entry 0x%"PRIx64"\n", entry);
+			return 0;
+		}
+		len = bytes < PAGE_SIZE ? bytes : PAGE_SIZE;
+		if (!dma_page(entry, len, offset)) {return 0;}
+		bytes -= len;
+		offset += len;
+		list += 1;
+	}
+	return 1;
+}
+
+static void post_completion(const struct mock_cmd *cmd, u16 status) {
+	struct nvme_cq *cq = cqs + 1;
+	u16 next = ctrl.cq_tail == cq->size ? 0 : ctrl.cq_tail + 1;
+	if (next == from_le32(atomic_load(&cq_doorbell))) {
+		fprintf(stderr, "completion queue overflow\n");
+		ctrl.failed = 1;
+		return;
+	}
+	struct nvme_completion *cqe = cq->buf + ctrl.cq_tail;
+	cqe->cmd_spec = 0;
+	cqe->reserved = 0;
+	cqe->sqhd = to_le16(ctrl.sq_head);
+	cqe->sqid = to_le16(1);
+	cqe->cid = to_le16(cmd->cid);
+	atomic_store_explicit(&cqe->status, to_le16(status << 1 | ctrl.phase), memory_order_release);
+	if (next == 0) {ctrl.phase = !ctrl.phase;}
+	ctrl.cq_tail = next;
+}
+
+static void controller_poll() {
+	struct nvme_sq *sq = sqs + 1;
+	u16 tail = from_le32(atomic_load(&sq_doorbell));
+	while (ctrl.sq_head != tail) {
+		const struct nvme_cmd *cmd = sq->buf + ctrl.sq_head;
+		ctrl.sq_head = ctrl.sq_head == sq->size ? 0 : ctrl.sq_head + 1;
+		assert(ctrl.num_pending < ARRAY_SIZE(ctrl.pending));
+		struct mock_cmd *mc = ctrl.pending + ctrl.num_pending++;
+		if (ctrl.num_pending > ctrl.max_pending) {ctrl.max_pending = ctrl.num_pending;}
+		mc->cid = from_le16(cmd->cid);
+		mc->slba = from_le64(cmd->cmd_spec[0]);
+		mc->nlb = (from_le32(cmd->dw12) & 0xffff) + 1;
+		mc->prp1 = from_le64(cmd->dptr[0]);
+		mc->prp2 = from_le64(cmd->dptr[1]);
+		if (cmd->opc != NVME_NVM_READ || from_le32(cmd->nsid) != 1 || (cmd->fuse_psdt & 0xc0) != NVME_PSDT_PRP) {
+			fprintf(stderr, "unexpected command opc=%02"PRIx8" nsid=%"PRIu32"\n", cmd->opc, from_le32(cmd->nsid));
+			ctrl.failed = 1;
+		}
+		/* flash latency overlaps between commands, link transfers don't */
+		timestamp_t xfer_start = now + USECS(cfg.latency_us);
+		if (xfer_start < ctrl.link_free) {xfer_start = ctrl.link_free;}
+		u64 bytes = (u64)mc->nlb << cfg.lba_shift;
+		mc->done = ctrl.link_free = xfer_start + bytes * TICKS_PER_MICROSECOND / cfg.link_mbps;
+		ctrl.commands += 1;
+	}
+	while (ctrl.num_pending && ctrl.pending[0].done <= now) {
+		_Bool ok = execute_read(ctrl.pending);
+		if (!ok) {ctrl.failed = 1;}
+		post_completion(ctrl.pending, ok ? 0 : 6);	/* internal error */
+		ctrl.num_pending -= 1;
+		memmove(ctrl.pending, ctrl.pending + 1, ctrl.num_pending * sizeof(ctrl.pending[0]));
+	}
+}
+
+static void reset(u32 depth) {
+	memset(&ctrl, 0, sizeof(ctrl));
+	memset(&stats, 0, sizeof(stats));
+	ctrl.phase = 1;
+	memset(pages, 0, NUM_PAGES * PAGE_SIZE);
+	memset(data_buf, 0, cfg.size);
+	memset(dest_buf, 0, cfg.size);
+	atomic_store(&sq_doorbell, 0);
+	atomic_store(&cq_doorbell, 0);
+	for_array(i, io_cmd) {atomic_store(io_cmd + i, 0);}
+	regs.status = NVME_CSTS_RDY;
+	/* state as left by nvme_init_queues, with the admin queue idle */
+	cqs[0] = (struct nvme_cq) {.buf = (struct nvme_completion *)pages[PAGE_ACQ], .size = 3, .phase = 1};
+	cqs[1] = (struct nvme_cq) {.doorbell = &cq_doorbell, .buf = (struct nvme_completion *)pages[PAGE_IOCQ], .size = depth, .phase = 1};
+	sqs[1] = (struct nvme_sq) {.doorbell = &sq_doorbell, .buf = (struct nvme_cmd *)pages[PAGE_SQ], .size = depth, .cq = 1, .max_cid = depth - 1, .cmd = io_cmd};
+	st.num_iocq = st.num_iosq = 1;
+	st.lba_shift = cfg.lba_shift;
+	for_array(i, xfers) {
+		memset(xfers + i, 0, sizeof(xfers[i]));
+		xfers[i].prp_list = (u64 *)pages[PAGE_PRP + i];
+		xfers[i].prp_list_addr = plat_virt_to_phys(pages[PAGE_PRP + i]);
+		xfers[i].prp_cap = PAGE_SIZE >> 3;
+	}
+	dev.ra.blk.block_size = 1 << cfg.lba_shift;
+	dev.ra.blk.num_blocks = UINT64_C(1) << 30 >> cfg.lba_shift;
+	dev.ra.max_inflight = depth;
+	dev.ra.head = dev.ra.inflight = 0;
+	dev.ra.request_size = UINT32_C(1) << cfg.xfer_shift;
+	dev.ra.window = cfg.window;
+	now = 0;
+}
+
+static _Bool run(u32 depth) {
+	reset(depth);
+	const u64 start_lba = 2048;
+	u8 *base = cfg.ring ? stream_base : data_buf;
+	enum iost res;
+	if (cfg.ring) {
+		res = dev.ra.blk.start_ring(&dev.ra.blk, start_lba, cfg.size, (struct async_buf) {data_buf, data_buf + cfg.ring}, stream_base);
+	} else {
+		res = dev.ra.blk.start(&dev.ra.blk, start_lba, data_buf, data_buf + cfg.size);
+	}
+	if (res != IOST_OK) {
+		fprintf(stderr, "start failed: %u\n", res);
+		return 0;
+	}
+	struct async_buf redirected = {base, base};
+	if (cfg.redirect_size) {
+		u8 *start = base + cfg.redirect_start;
+		redirected = dev.ra.blk.async.redirect(&dev.ra.blk.async, start, start + cfg.redirect_size, dest_buf + cfg.redirect_start);
+		if (redirected.start == redirected.end) {
+			fprintf(stderr, "redirect refused\n");
+			return 0;
+		}
+	}
+	if (cfg.hold) {dev.ra.blk.async.hold(&dev.ra.blk.async, base);}
+	u64 disk_offset = start_lba << cfg.lba_shift;
+	size_t consume = 0, total = 0;
+	while (total < cfg.size) {
+		size_t want = cfg.size - total < cfg.chunk ? cfg.size - total : cfg.chunk;
+		struct async_buf buf = dev.ra.blk.async.pump(&dev.ra.blk.async, consume, want);
+		if (buf.end < buf.start) {
+			fprintf(stderr, "pump failed at offset 0x%zx\n", total);
+			return 0;
+		}
+		if (buf.start != base + total || (size_t)(buf.end - buf.start) < want) {
+			fprintf(stderr, "pump returned bad buffer %p–%p at offset 0x%zx\n", buf.start, buf.end, total);
+			return 0;
+		}
+		for_range(i, 0, want) {
+			const u8 *ptr = buf.start + i;
+			/* the redirected part must end up at the destination, and only there */
+			if (ptr >= redirected.start && ptr < redirected.end) {
+				/* ring space is reused, so it can't be checked there */
+				if (!cfg.ring && *ptr) {
+					fprintf(stderr, "redirected data written to the buffer at offset 0x%zx\n", total + i);
+					return 0;
+				}
+				ptr = dest_buf + (ptr - base);
+			}
+			if (*ptr != pattern(disk_offset + total + i)) {
+				fprintf(stderr, "data mismatch at offset 0x%zx\n", total + i);
+				return 0;
+			}
+		}
+		if (ctrl.failed) {return 0;}
+		consume = want;
+		total += want;
+		if (cfg.hold && total > cfg.hold) {
+			/* the held data must not have been recycled */
+			size_t held = total - cfg.hold;
+			if (!(base + held >= redirected.start && base + held < redirected.end) && base[held] != pattern(disk_offset + held)) {
+				fprintf(stderr, "held data at offset 0x%zx overwritten\n", held);
+				return 0;
+			}
+			dev.ra.blk.async.hold(&dev.ra.blk.async, base + held);
+		}
+		now += (u64)want * TICKS_PER_MICROSECOND / cfg.consume_mbps;
+		controller_poll();
+	}
+	struct async_buf buf = dev.ra.blk.async.pump(&dev.ra.blk.async, consume, 0);
+	if (buf.end != buf.start || dev.ra.inflight) {
+		fprintf(stderr, "transfer did not end cleanly\n");
+		return 0;
+	}
+	/* removes the stream mapping */
+	if (cfg.ring && dev.ra.blk.start(&dev.ra.blk, start_lba, data_buf, data_buf) != IOST_OK) {return 0;}
+	if (stats.bytes != cfg.size || stats.requests != ctrl.commands) {
+		fprintf(stderr, "I/O stats counted %"PRIu64" bytes in %"PRIu32" requests\n", stats.bytes, stats.requests);
+		return 0;
+	}
+	u64 usecs = now / TICKS_PER_MICROSECOND;
+	printf("depth %2"PRIu32": %8"PRIu64" μs, %5"PRIu64" MB/s, %6"PRIu64" commands, at most %"PRIu32" in flight, %8"PRIu64" μs waiting\n",
+		depth, usecs, usecs ? cfg.size / usecs : 0, ctrl.commands, ctrl.max_pending, stats.wait_ticks / TICKS_PER_MICROSECOND
+	);
+	return 1;
+}
+
+static _Bool parse_u32(char **argv, u32 *out) {
+	if (!argv[1]) {
+		fprintf(stderr, "%s needs a parameter\n", argv[0]);
+		return 0;
+	}
+	if (1 != sscanf(argv[1], "%"SCNu32, out)) {
+		fprintf(stderr, "could not parse argument: %s %s\n", argv[0], argv[1]);
+		return 0;
+	}
+	return 1;
+}
+
+int main(int UNUSED argc, char **argv) {
+	u32 xfer_shift = cfg.xfer_shift, lba_shift = cfg.lba_shift;
+	const struct {const char *name; u32 *val;} options[] = {
+		{"--latency", &cfg.latency_us},
+		{"--bandwidth", &cfg.link_mbps},
+		{"--consume", &cfg.consume_mbps},
+		{"--size", &cfg.size},
+		{"--chunk", &cfg.chunk},
+		{"--depth", &cfg.max_depth},
+		{"--window", &cfg.window},
+		{"--xfer-shift", &xfer_shift},
+		{"--lba-shift", &lba_shift},
+		{"--redirect-start", &cfg.redirect_start},
+		{"--redirect-size", &cfg.redirect_size},
+		{"--ring", &cfg.ring},
+		{"--hold", &cfg.hold},
+	};
+	while (*++argv) {
+		for_array(i, options) {
+			if (0 == strcmp(*argv, options[i].name)) {
+				if (!parse_u32(argv, options[i].val)) {return 1;}
+				argv += 1;
+				goto next_arg;
+			}
+		}
+		fprintf(stderr, "unknown option %s\n", *argv);
+		return 1;
+	next_arg:;
+	}
+	if (!cfg.max_depth || cfg.max_depth > MAX_DEPTH) {
+		fprintf(stderr, "queue depth must be between 1 and %u\n", MAX_DEPTH);
+		return 1;
+	}
+	if (lba_shift < 9 || lba_shift > 12 || xfer_shift < lba_shift || xfer_shift > 20) {
+		fprintf(stderr, "unsupported LBA or transfer size\n");
+		return 1;
+	}
+	cfg.xfer_shift = xfer_shift;
+	cfg.lba_shift = lba_shift;
+	if (!cfg.size || cfg.size % (1 << lba_shift) || !cfg.chunk || !cfg.link_mbps || !cfg.consume_mbps) {
+		fprintf(stderr, "size must be a nonzero multiple of the LBA size, chunk size and rates must be nonzero\n");
+		return 1;
+	}
+	if (cfg.redirect_start > cfg.size || cfg.redirect_size > cfg.size - cfg.redirect_start) {
+		fprintf(stderr, "redirected range must be within the transfer\n");
+		return 1;
+	}
+	if (cfg.ring && (cfg.ring % ASYNC_RING_SEGMENT || cfg.ring < 2 * ASYNC_RING_SEGMENT || cfg.ring > cfg.size)) {
+		fprintf(stderr, "ring size must be a multiple of %u, at least two of them and at most the transfer size\n", ASYNC_RING_SEGMENT);
+		return 1;
+	}
+	/* the driver hands out 32-bit physical addresses, so everything has to be identity-mapped below 4 GiB.
+	 * the data buffer is aligned for use as a ring */
+	size_t data_offset = (size_t)NUM_PAGES * PAGE_SIZE + ASYNC_RING_SEGMENT - 1;
+	data_offset -= data_offset % ASYNC_RING_SEGMENT;
+	size_t arena_size = data_offset + 2 * (size_t)cfg.size;
+	arena_fd = memfd_create("nvmemock", 0);
+	if (arena_fd < 0 || posix_fallocate(arena_fd, 0, arena_size)) {
+		perror("could not create the memory file");
+		return 1;
+	}
+	int flags = MAP_SHARED;
+#ifdef MAP_32BIT
+	flags |= MAP_32BIT;
+#endif
+	arena = mmap((void *)0x10000000, arena_size, PROT_READ | PROT_WRITE, flags, arena_fd, 0);
+	if (arena == MAP_FAILED || (uintptr_t)arena + arena_size > 0xffe00000 || (uintptr_t)arena % ASYNC_RING_SEGMENT) {
+		fprintf(stderr, "could not allocate %zu bytes below 4 GiB\n", arena_size);
+		return 1;
+	}
+	pages = (u8 (*)[PAGE_SIZE])arena;
+	data_buf = arena + data_offset;
+	dest_buf = data_buf + cfg.size;
+	if (cfg.ring) {
+		/* address space for the stream, aligned to a segment. the mapping extends to the end of the last segment */
+		u8 *reserved = mmap(0, (size_t)cfg.size + 2 * ASYNC_RING_SEGMENT, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (reserved == MAP_FAILED) {
+			perror("could not reserve stream addresses");
+			return 1;
+		}
+		stream_base = reserved + (ASYNC_RING_SEGMENT - (uintptr_t)reserved % ASYNC_RING_SEGMENT) % ASYNC_RING_SEGMENT;
+	}
+	info("%"PRIu32" MiB in %"PRIu32" KiB reads, %"PRIu32" μs latency, %"PRIu32" MB/s link, consuming at %"PRIu32" MB/s\n",
+		cfg.size >> 20, 1 << cfg.xfer_shift >> 10, cfg.latency_us, cfg.link_mbps, cfg.consume_mbps
+	);
+	for_range(depth, 1, cfg.max_depth + 1) {
+		if (!run(depth)) {
+			fprintf(stderr, "depth %"PRIu32" FAILED\n", depth);
+			return 1;
+		}
+	}
+	return 0;
+}
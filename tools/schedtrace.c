@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: CC0-1.0 */
+#define _POSIX_C_SOURCE 200809L
+#include "../include/defs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* converts the scheduler trace that dramstage prints when configured with --sched-trace into the Chrome trace event format, which chrome://tracing and Perfetto can display.
+usage: schedtrace [log file] > trace.json
+
+the input is the serial console log, everything but the `sched-trace:` lines is ignored. the timeline has one track per CPU, showing which thread ran when, and one per thread, showing where it waited and when it was woken. the per-thread totals are added as "levinboot_threads". */
+
+enum {MAX_THREADS = 256, MAX_SITES = 32};
+
+struct thread {
+	u64 addr;
+	char name[64];
+	u64 run_ticks;
+	u32 dispatches;
+	u64 wait_ticks[MAX_SITES];
+	u32 waits[MAX_SITES];
+	/* state while replaying the events */
+	_Bool running, waiting;
+	u32 cpu, site;
+	u64 since;
+};
+
+static struct thread threads[MAX_THREADS];
+static u32 num_threads = 0;
+static char site_names[MAX_SITES][64];
+static u32 ticks_per_us = 24;
+static u64 first_timestamp = 0, last_timestamp = 0;
+static _Bool first_event = 1, seen_begin = 0;
+
+static struct thread *get_thread(u64 addr) {
+	for_range(i, 0, num_threads) {
+		if (threads[i].addr == addr) {return threads + i;}
+	}
+	if (num_threads == MAX_THREADS) {
+		fprintf(stderr, "too many threads\n");
+		exit(1);
+	}
+	struct thread *th = threads + num_threads++;
+	th->addr = addr;
+	snprintf(th->name, sizeof(th->name), "thread@%"PRIx64, addr);
+	return th;
+}
+
+static const char *site_name(u32 site) {
+	return site < MAX_SITES && site_names[site][0] ? site_names[site] : "unknown";
+}
+
+static double usecs(u64 timestamp) {
+	return (double)(timestamp - first_timestamp) / ticks_per_us;
+}
+
+static void emit_comma() {
+	static _Bool first = 1;
+	printf(first ? "\n\t" : ",\n\t");
+	first = 0;
+}
+
+static void emit_slice(u32 pid, u32 tid, const char *name, u64 start, u64 end) {
+	emit_comma();
+	printf("{\"ph\": \"X\", \"pid\": %"PRIu32", \"tid\": %"PRIu32", \"name\": \"%s\", \"ts\": %.3f, \"dur\": %.3f}", pid, tid, name, usecs(start), usecs(end) - usecs(start));
+}
+
+/* ends the running slice of `th` on its CPU track and its own track */
+static void end_run(struct thread *th, u64 timestamp) {
+	if (!th->running) {return;}
+	char name[80];
+	emit_slice(0, th->cpu, th->name, th->since, timestamp);
+	snprintf(name, sizeof(name), "running on CPU%"PRIu32, th->cpu);
+	emit_slice(1, th - threads, name, th->since, timestamp);
+	th->running = 0;
+}
+
+static void event(u64 timestamp, u32 cpu, char kind, u64 addr, u32 site) {
+	if (first_event) {
+		first_timestamp = timestamp;
+		first_event = 0;
+	}
+	last_timestamp = timestamp;
+	struct thread *th = get_thread(addr);
+	switch (kind) {
+	case 'd':
+		if (th->waiting) {emit_slice(1, th - threads, site_name(th->site), th->since, timestamp);}
+		th->waiting = 0;
+		th->running = 1;
+		th->cpu = cpu;
+		th->since = timestamp;
+		break;
+	case 'p':
+		end_run(th, timestamp);
+		th->waiting = 1;
+		th->site = site;
+		th->since = timestamp;
+		break;
+	case 'x':
+		end_run(th, timestamp);
+		break;
+	case 'w':
+		emit_comma();
+		printf("{\"ph\": \"i\", \"s\": \"t\", \"pid\": 1, \"tid\": %td, \"name\": \"wake\", \"ts\": %.3f, \"args\": {\"cpu\": %"PRIu32"}}", th - threads, usecs(timestamp), cpu);
+		break;
+	default:
+		fprintf(stderr, "unknown event kind '%c'\n", kind);
+	}
+}
+
+static void print_json_string(const char *str) {
+	putchar('"');
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\') {
+			printf("\\%c", *str);
+		} else if ((u8)*str < 0x20) {
+			printf("\\u%04x", (unsigned)(u8)*str);
+		} else {
+			putchar(*str);
+		}
+	}
+	putchar('"');
+}
+
+int main(int argc, char **argv) {
+	FILE *in = stdin;
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [log file]\n", argv[0]);
+		return 1;
+	}
+	if (argc == 2 && !(in = fopen(argv[1], "r"))) {
+		perror(argv[1]);
+		return 1;
+	}
+	printf("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	char line[512];
+	u32 recorded = 0, ring_size = 0;
+	while (fgets(line, sizeof(line), in)) {
+		const char *p = strstr(line, "sched-trace: ");
+		if (!p) {continue;}
+		p += strlen("sched-trace: ");
+		u64 a, b, c;
+		u32 x, y;
+		char kind, name[64];
+		if (sscanf(p, "begin %"SCNu32" %"SCNu32" %"SCNu32, &ticks_per_us, &recorded, &ring_size) == 3) {
+			if (!ticks_per_us) {ticks_per_us = 24;}
+			seen_begin = 1;
+		} else if (sscanf(p, "site %"SCNu32" %63s", &x, name) == 2) {
+			if (x < MAX_SITES) {strcpy(site_names[x], name);}
+		} else if (sscanf(p, "thread %"SCNx64" %63s %"SCNu64" %"SCNu32, &a, name, &b, &x) == 4) {
+			struct thread *th = get_thread(a);
+			if (strcmp(name, "-")) {strcpy(th->name, name);}
+			th->run_ticks = b;
+			th->dispatches = x;
+		} else if (sscanf(p, "wait %"SCNx64" %"SCNu32" %"SCNu64" %"SCNu32, &a, &x, &b, &y) == 4) {
+			if (x < MAX_SITES) {
+				struct thread *th = get_thread(a);
+				th->wait_ticks[x] = b;
+				th->waits[x] = y;
+			}
+		} else if (sscanf(p, "event %"SCNu64" %"SCNu32" %c %"SCNx64" %"SCNu32, &a, &x, &kind, &c, &y) == 5) {
+			event(a, x, kind, c, y);
+		}
+	}
+	if (in != stdin) {fclose(in);}
+	if (!seen_begin) {
+		fprintf(stderr, "no sched-trace dump found in the input\n");
+		return 1;
+	}
+	if (recorded > ring_size) {fprintf(stderr, "the ring overflowed, the first %"PRIu32" events are missing from the timeline\n", recorded - ring_size);}
+	/* close what was still open when the dump was taken */
+	for_range(i, 0, num_threads) {
+		struct thread *th = threads + i;
+		if (th->running) {end_run(th, last_timestamp);}
+	}
+	for_range(cpu, 0, 8) {
+		emit_comma();
+		printf("{\"ph\": \"M\", \"pid\": 0, \"tid\": %u, \"name\": \"thread_name\", \"args\": {\"name\": \"CPU%u\"}}", (unsigned)cpu, (unsigned)cpu);
+	}
+	emit_comma();
+	printf("{\"ph\": \"M\", \"pid\": 0, \"name\": \"process_name\", \"args\": {\"name\": \"CPUs\"}}");
+	emit_comma();
+	printf("{\"ph\": \"M\", \"pid\": 1, \"name\": \"process_name\", \"args\": {\"name\": \"threads\"}}");
+	for_range(i, 0, num_threads) {
+		emit_comma();
+		printf("{\"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"name\": \"thread_name\", \"args\": {\"name\": ", (unsigned)i);
+		print_json_string(threads[i].name);
+		printf("}}");
+	}
+	printf("\n], \"levinboot_threads\": [");
+	for_range(i, 0, num_threads) {
+		const struct thread *th = threads + i;
+		printf("%s\n\t{\"name\": ", i ? "," : "");
+		print_json_string(th->name);
+		printf(", \"run_us\": %.1f, \"dispatches\": %"PRIu32", \"waits\": {", (double)th->run_ticks / ticks_per_us, th->dispatches);
+		_Bool first = 1;
+		for_range(s, 0, MAX_SITES) {
+			if (!th->waits[s]) {continue;}
+			printf("%s\"%s\": {\"us\": %.1f, \"count\": %"PRIu32"}", first ? "" : ", ", site_name(s), (double)th->wait_ticks[s] / ticks_per_us, th->waits[s]);
+			first = 0;
+		}
+		printf("}}");
+	}
+	printf("\n]}\n");
+	return 0;
+}